@@ -0,0 +1,213 @@
+#!/usr/bin/env python
+#
+# python-ubus - python bindings for ubus
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU Lesser General Public License version 2.1
+# as published by the Free Software Foundation
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+
+"""
+Benchmarks of the ubus bindings against a local ubusd.
+
+Spawns ``ubusd -s <socket>`` (the same way as tests/fixtures.py does), serves a benchmark
+object from a separate process and prints the results as json so that they can be compared
+between revisions:
+
+    python benchmarks/benchmark.py --output before.json
+"""
+
+import argparse
+import json
+import os
+import platform
+import subprocess
+import sys
+import time
+
+from multiprocessing import Process, Value
+
+import ubus
+
+UBUSD_BENCHMARK_SOCKET_PATH = "/tmp/ubus-benchmark-socket"
+
+timer = getattr(time, "perf_counter", time.time)
+
+
+def percentile(samples, percent):
+    samples = sorted(samples)
+    index = int(round((len(samples) - 1) * percent / 100.0))
+    return samples[index]
+
+
+def payload(size, depth):
+    """ table nested `depth` times which contains approximately `size` bytes of strings """
+    leaf = {"s%d" % i: "x" * 16 for i in range(max(1, size // 16))}
+    leaf["number"] = 1
+    leaf["flag"] = True
+    for _ in range(depth - 1):
+        leaf = {"nested": leaf, "list": [1, "a", 2.5]}
+    return leaf
+
+
+def serve(socket_path, ready):
+    def echo(handler, data):
+        handler.reply(data)
+
+    def empty(handler, data):
+        handler.reply({})
+
+    ubus.connect(socket_path)
+    ubus.add("benchmark_object", {
+        "echo": {"method": echo, "signature": {"data": ubus.BLOBMSG_TYPE_UNSPEC}},
+        "empty": {"method": empty, "signature": {}},
+    })
+    ready.value = 1
+    ubus.loop()
+
+
+def bench_call_latency(socket_path, iterations, sizes, depths):
+    connection = ubus.Connection(socket_path)
+    results = []
+    for size in sizes:
+        for depth in depths:
+            arguments = {"data": payload(size, depth)}
+            connection.call("benchmark_object", "echo", arguments)  # warm up the id cache
+            samples = []
+            for _ in range(iterations):
+                start = timer()
+                connection.call("benchmark_object", "echo", arguments)
+                samples.append(timer() - start)
+            results.append({
+                "payload_bytes": len(ubus.encode(arguments)),
+                "depth": depth,
+                "p50_us": percentile(samples, 50) * 1e6,
+                "p99_us": percentile(samples, 99) * 1e6,
+                "calls_per_s": len(samples) / sum(samples),
+            })
+    connection.disconnect()
+    return results
+
+
+def bench_events(socket_path, count):
+    received = [0]
+
+    def callback(event, data):
+        received[0] += 1
+
+    listening = ubus.Connection(socket_path)
+    sending = ubus.Connection(socket_path)
+    listening.listen(("benchmark_event", callback))
+    data = payload(64, 1)
+
+    results = {}
+    for name, send in (
+        ("send", lambda: [sending.send("benchmark_event", data) for _ in range(count)]),
+        ("send_many", lambda: sending.send_many(("benchmark_event", data) for _ in range(count))),
+    ):
+        received[0] = 0
+        start = timer()
+        send()
+        while received[0] < count:
+            listening.loop(10)
+        elapsed = timer() - start
+        results[name] = {"events": count, "events_per_s": count / elapsed}
+
+    listening.disconnect()
+    sending.disconnect()
+    return results
+
+
+def bench_handler_rate(socket_path, count):
+    connection = ubus.Connection(socket_path)
+    calls = [("benchmark_object", "empty", {})] * count
+    connection.call_many(calls[:10])  # warm up the id cache
+
+    start = timer()
+    results = connection.call_many(calls)
+    elapsed = timer() - start
+    assert all(status == ubus.UBUS_STATUS_OK for status, _ in results)
+
+    connection.disconnect()
+    return {"requests": count, "requests_per_s": count / elapsed}
+
+
+def bench_codec(iterations, sizes, depths):
+    results = []
+    for size in sizes:
+        for depth in depths:
+            data = payload(size, depth)
+            encoded = ubus.encode(data)
+
+            start = timer()
+            for _ in range(iterations):
+                ubus.encode(data)
+            encode_elapsed = timer() - start
+
+            start = timer()
+            for _ in range(iterations):
+                ubus.decode(encoded)
+            decode_elapsed = timer() - start
+
+            results.append({
+                "payload_bytes": len(encoded),
+                "depth": depth,
+                "encode_mb_per_s": len(encoded) * iterations / encode_elapsed / 1e6,
+                "decode_mb_per_s": len(encoded) * iterations / decode_elapsed / 1e6,
+            })
+    return results
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.strip().splitlines()[0])
+    parser.add_argument("--socket", default=UBUSD_BENCHMARK_SOCKET_PATH, help="ubusd socket path")
+    parser.add_argument("--iterations", type=int, default=1000, help="calls per measurement")
+    parser.add_argument("--events", type=int, default=10000, help="events per measurement")
+    parser.add_argument("--output", help="write the results to a file instead of stdout")
+    args = parser.parse_args()
+
+    sizes = [16, 256, 4096]
+    depths = [1, 4, 16]
+
+    ubusd = subprocess.Popen(["ubusd", "-s", args.socket])
+    server = None
+    try:
+        while not os.path.exists(args.socket):
+            time.sleep(0.2)
+
+        ready = Value('i', 0)
+        server = Process(target=serve, args=(args.socket, ready), name="benchmark_server")
+        server.start()
+        while not ready.value:
+            time.sleep(0.05)
+
+        results = {
+            "python": platform.python_version(),
+            "call_latency": bench_call_latency(args.socket, args.iterations, sizes, depths),
+            "events": bench_events(args.socket, args.events),
+            "handler_rate": bench_handler_rate(args.socket, args.iterations * 10),
+            "codec": bench_codec(args.iterations * 10, sizes, depths),
+        }
+    finally:
+        if server:
+            server.terminate()
+            server.join()
+        ubusd.kill()
+        ubusd.wait()
+        if os.path.exists(args.socket):
+            os.unlink(args.socket)
+
+    output = open(args.output, "w") if args.output else sys.stdout
+    json.dump(results, output, indent=2, sort_keys=True)
+    output.write("\n")
+    if args.output:
+        output.close()
+
+
+if __name__ == "__main__":
+    main()
@@ -14,6 +14,8 @@
 #
 
 
+import sys
+
 from setuptools import setup, Extension
 
 extension = Extension(
@@ -30,6 +32,7 @@ setup(
     description="Python bindings for libubus",
     long_description=open("README.rst").read(),
     ext_modules=[extension],
+    py_modules=['ubus_asyncio'] if sys.version_info >= (3, 5) else [],
     provides=['ubus'],
     license="LGPL 2.1",
     setup_requires=['pytest-runner'],
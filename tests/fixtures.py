@@ -138,6 +138,10 @@ def responsive_object():
             def handler_fail(handler, data):
                 raise Exception("Handler Fails")
 
+            def handler_sleep(handler, data):
+                time.sleep(data["ms"] / 1000.0)
+                handler.reply(data)
+
             import ubus
             ubus.connect(UBUSD_TEST_SOCKET_PATH)
             ubus.add(
@@ -153,7 +157,95 @@ def responsive_object():
                     "number": {"method": handler1, "signature": {
                         "number": ubus.BLOBMSG_TYPE_INT32,
                     }},
+                    "sleep": {"method": handler_sleep, "signature": {
+                        "ms": ubus.BLOBMSG_TYPE_INT32,
+                    }},
+                },
+            )
+            guard.touch()
+            ubus.loop()
+
+        p = Process(target=process_function)
+        p.start()
+        guard.wait()
+
+        yield p
+
+        p.terminate()
+        p.join()
+
+
+@pytest.fixture(scope="function")
+def served_objects():
+    with Guard() as guard:
+
+        def process_function():
+
+            def echo(handler, data):
+                handler.reply(data)
+
+            def raw_echo(handler, data):
+                handler.reply(ubus.RawMessage(data))
+
+            def keywords(handler, first, second, third=None):
+                handler.reply({"first": first, "second": second, "third": third})
+
+            def wide_keywords(handler, **arguments):
+                handler.reply(arguments)
+
+            def raw_type(handler, data):
+                handler.reply({"bytes": isinstance(data, bytes)})
+
+            def lazy(handler, data):
+                handler.reply({"first": data["first"], "type": type(data).__name__})
+
+            import ubus
+            ubus.connect(UBUSD_TEST_SOCKET_PATH)
+            ubus.add(
+                "wide_object",
+                {
+                    "method%d" % i: {
+                        "method": echo,
+                        "signature": {"arg%d" % j: ubus.BLOBMSG_TYPE_INT32 for j in range(i % 16)},
+                    } for i in range(64)
+                },
+            )
+            ubus.add(
+                "keywords_object",
+                {
+                    "method": {"method": keywords, "signature": {
+                        "first": ubus.BLOBMSG_TYPE_STRING,
+                        "second": ubus.BLOBMSG_TYPE_TABLE,
+                    }},
+                    "wide": {"method": wide_keywords, "signature": {
+                        "arg%d" % i: ubus.BLOBMSG_TYPE_UNSPEC for i in range(32)
+                    }},
                 },
+                keywords=True,
+            )
+            raw_signature = {
+                "first": ubus.BLOBMSG_TYPE_STRING,
+                "second": ubus.BLOBMSG_TYPE_BOOL,
+                "third": ubus.BLOBMSG_TYPE_INT32,
+            }
+            ubus.add(
+                "raw_object",
+                {
+                    "method": {"method": raw_echo, "signature": raw_signature},
+                    "type": {"method": raw_type, "signature": raw_signature},
+                },
+                raw=True,
+            )
+            ubus.add(
+                "lazy_object",
+                {
+                    "method": {"method": lazy, "signature": {
+                        "first": ubus.BLOBMSG_TYPE_STRING,
+                        "second": ubus.BLOBMSG_TYPE_TABLE,
+                        "third": ubus.BLOBMSG_TYPE_ARRAY,
+                    }},
+                },
+                lazy=True,
             )
             guard.touch()
             ubus.loop()
@@ -168,6 +260,45 @@ def responsive_object():
         p.join()
 
 
+@pytest.fixture(scope="function")
+def replaceable_object():
+    processes = []
+
+    def start():
+        with Guard() as guard:
+
+            def process_function():
+
+                def handler(handler, data):
+                    handler.reply({"pid": os.getpid()})
+
+                import ubus
+                ubus.connect(UBUSD_TEST_SOCKET_PATH)
+                ubus.add(
+                    "replaceable_object",
+                    {"pid": {"method": handler, "signature": {}}},
+                )
+                guard.touch()
+                ubus.loop()
+
+            p = Process(target=process_function)
+            p.start()
+            guard.wait()
+            processes.append(p)
+
+    def stop():
+        p = processes.pop()
+        p.terminate()
+        p.join()
+
+    start()
+
+    yield start, stop
+
+    while processes:
+        stop()
+
+
 @pytest.fixture(scope="function")
 def call_for_object():
     with Guard() as guard:
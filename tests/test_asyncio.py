@@ -0,0 +1,209 @@
+# -*- coding: utf-8 -*-
+
+import pytest
+import ubus
+
+asyncio = pytest.importorskip("asyncio")
+ubus_asyncio = pytest.importorskip("ubus_asyncio")
+
+from .fixtures import (
+    event_sender,
+    disconnect_after,
+    ubusd_test,
+    responsive_object,
+    UBUSD_TEST_SOCKET_PATH,
+)
+
+
+def run(coroutine):
+    loop = asyncio.new_event_loop()
+    try:
+        return loop.run_until_complete(coroutine(loop))
+    finally:
+        loop.close()
+
+
+def test_adapter_attach(ubusd_test, disconnect_after):
+
+    async def test(loop):
+        adapter = ubus_asyncio.Adapter(loop)
+        with pytest.raises(RuntimeError):
+            adapter.attach()
+
+        ubus.connect(socket_path=UBUSD_TEST_SOCKET_PATH)
+        adapter.attach()
+        with pytest.raises(RuntimeError):
+            adapter.attach()
+        adapter.detach()
+        with pytest.raises(RuntimeError):
+            adapter.detach()
+        ubus.disconnect()
+
+    run(test)
+
+
+def test_adapter_call(ubusd_test, responsive_object, disconnect_after):
+    data = {"first": "1", "second": False, "third": 22}
+
+    async def test(loop):
+        ubus.connect(socket_path=UBUSD_TEST_SOCKET_PATH)
+        adapter = ubus_asyncio.Adapter(loop)
+        adapter.attach()
+
+        results = await asyncio.gather(*[
+            adapter.call("responsive_object", "respond", data) for _ in range(10)
+        ])
+        assert results == [
+            [{"first": "1", "second": False, "third": 22, "passed": True}]
+        ] * 10
+
+        with pytest.raises(ubus_asyncio.UbusError):
+            await adapter.call("responsive_object", "fail", {})
+
+        assert await adapter.send("adapter_event", {"a": 1}) is True
+
+        adapter.detach()
+        ubus.disconnect()
+
+    run(test)
+
+
+def test_adapter_call_timeout(ubusd_test, responsive_object, disconnect_after):
+
+    async def test(loop):
+        ubus.connect(socket_path=UBUSD_TEST_SOCKET_PATH)
+        adapter = ubus_asyncio.Adapter(loop)
+        adapter.attach()
+
+        with pytest.raises(ubus_asyncio.UbusError) as excinfo:
+            await adapter.call("responsive_object", "sleep", {"ms": 1000}, timeout=100)
+        assert excinfo.value.status == ubus.UBUS_STATUS_TIMEOUT
+
+        assert await adapter.call("responsive_object", "sleep", {"ms": 1}, timeout=5000) == [{"ms": 1}]
+
+        adapter.detach()
+        ubus.disconnect()
+
+    run(test)
+
+
+def test_adapter_add(ubusd_test, disconnect_after):
+
+    async def echo(handler, data):
+        await asyncio.sleep(0.05)
+        return data
+
+    async def replying(handler, data):
+        handler.reply({"first": 1})
+        await asyncio.sleep(0)
+        handler.reply({"second": 2})
+
+    async def failing(handler, data):
+        await asyncio.sleep(0)
+        raise Exception("failed")
+
+    def plain(handler, data):
+        handler.reply({"plain": True})
+
+    async def test(loop):
+        serving = ubus.Connection(socket_path=UBUSD_TEST_SOCKET_PATH)
+        serving_adapter = ubus_asyncio.Adapter(loop, serving)
+        serving_adapter.attach()
+        serving_adapter.add("async_object", {
+            "echo": {"method": echo, "signature": {"value": ubus.BLOBMSG_TYPE_INT32}},
+            "replying": {"method": replying, "signature": {}},
+            "failing": {"method": failing, "signature": {}},
+            "plain": {"method": plain, "signature": {}},
+        })
+
+        ubus.connect(socket_path=UBUSD_TEST_SOCKET_PATH)
+        adapter = ubus_asyncio.Adapter(loop)
+        adapter.attach()
+
+        # the handlers run concurrently
+        results = await asyncio.wait_for(asyncio.gather(*[
+            adapter.call("async_object", "echo", {"value": i}) for i in range(10)
+        ]), 0.4)
+        assert results == [[{"value": i}] for i in range(10)]
+
+        assert await adapter.call("async_object", "replying", {}) == [{"first": 1}, {"second": 2}]
+        assert await adapter.call("async_object", "plain", {}) == [{"plain": True}]
+
+        loop.set_exception_handler(lambda loop, context: None)
+        with pytest.raises(ubus_asyncio.UbusError) as excinfo:
+            await adapter.call("async_object", "failing", {})
+        assert excinfo.value.status == ubus.UBUS_STATUS_UNKNOWN_ERROR
+
+        adapter.detach()
+        serving_adapter.detach()
+        serving.disconnect()
+        ubus.disconnect()
+
+    run(test)
+
+
+def test_adapter_connection(ubusd_test, responsive_object):
+
+    async def test(loop):
+        connection = ubus.Connection(socket_path=UBUSD_TEST_SOCKET_PATH)
+        adapter = ubus_asyncio.Adapter(loop, connection)
+        adapter.attach()
+
+        results = await adapter.call("responsive_object", "respond", {
+            "first": "1", "second": False, "third": 22,
+        })
+        assert results == [{"first": "1", "second": False, "third": 22, "passed": True}]
+        assert ubus.get_connected() is False
+
+        adapter.detach()
+        connection.disconnect()
+
+    run(test)
+
+
+def test_adapter_listen(ubusd_test, event_sender, disconnect_after):
+    received = []
+
+    def callback(event, data):
+        received.append((event, data))
+
+    async def test(loop):
+        ubus.connect(socket_path=UBUSD_TEST_SOCKET_PATH)
+        ubus.listen(("event_sender", callback))
+        adapter = ubus_asyncio.Adapter(loop)
+        adapter.attach()
+
+        while not received:
+            await asyncio.sleep(0.05)
+
+        adapter.detach()
+        ubus.disconnect()
+
+    run(test)
+    assert received[0] == ("event_sender", dict(a="b", c=3, d=False))
+
+
+def test_adapter_listen_batch(ubusd_test, disconnect_after):
+    batches = []
+
+    async def test(loop):
+        ubus.connect(socket_path=UBUSD_TEST_SOCKET_PATH)
+        ubus.listen(("adapter_batch", batches.append), batch=100, batch_timeout=100)
+        sender = ubus.Connection(socket_path=UBUSD_TEST_SOCKET_PATH)
+        adapter = ubus_asyncio.Adapter(loop)
+        adapter.attach()
+
+        # the batch is passed once its timeout expires although nothing else is received
+        assert sender.send_many(("adapter_batch", {"index": i}) for i in range(3)) == 3
+        await asyncio.wait_for(wait_for(lambda: batches), 1)
+        assert [data["index"] for _, data in batches[0]] == [0, 1, 2]
+
+        adapter.detach()
+        sender.disconnect()
+        ubus.disconnect()
+
+    async def wait_for(condition):
+        while not condition():
+            await asyncio.sleep(0.01)
+
+    run(test)
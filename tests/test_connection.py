@@ -1,7 +1,12 @@
 # -*- coding: utf-8 -*-
 
+import gc
+import json
+import os
+import signal
 import time
 import pytest
+import threading
 import ubus
 import sys
 
@@ -12,7 +17,9 @@ from .fixtures import (
     disconnect_after,
     ubusd_test,
     registered_objects,
+    replaceable_object,
     responsive_object,
+    served_objects,
     UBUSD_TEST_SOCKET_PATH,
 )
 
@@ -123,6 +130,53 @@ def test_send_succeeded(ubusd_test, disconnect_after):
         ubus.disconnect()
 
 
+def test_send_many(ubusd_test, disconnect_after):
+    path = UBUSD_TEST_SOCKET_PATH
+    events = [("bulk_event", dict(a=i, b="True", c=False)) for i in range(100)]
+    received = []
+
+    def callback(event, data):
+        received.append((event, data))
+
+    with CheckRefCount(path, callback):
+
+        with pytest.raises(RuntimeError):
+            ubus.send_many(events)
+
+        listening = ubus.Connection(socket_path=path)
+        listening.listen(("bulk_event", callback))
+
+        ubus.connect(socket_path=path)
+
+        with pytest.raises(TypeError):
+            ubus.send_many(5)
+        with pytest.raises(TypeError):
+            ubus.send_many([["bulk_event", {}]])
+        with pytest.raises(TypeError):
+            ubus.send_many([("bulk_event", object())])
+
+        assert ubus.send_many([]) == 0
+        assert ubus.send_many(iter(events)) == len(events)
+
+        while len(received) < len(events):
+            listening.loop(50)
+        assert received == events
+
+        # nothing is sent when any of the events can't be encoded
+        del received[:]
+        with pytest.raises(TypeError):
+            ubus.send_many(events[:10] + [("bulk_event", object())] + events[10:])
+        assert ubus.send_many(events[:1]) == 1
+
+        while len(received) < 1:
+            listening.loop(50)
+        assert received == events[:1]
+        assert issubclass(ubus.SendError, RuntimeError)
+
+        listening.disconnect()
+        ubus.disconnect()
+
+
 def test_loop(ubusd_test, disconnect_after):
     path = UBUSD_TEST_SOCKET_PATH
 
@@ -158,6 +212,70 @@ def test_loop(ubusd_test, disconnect_after):
         ubus.disconnect()
 
 
+def test_poll_stop(ubusd_test, event_sender, disconnect_after):
+    path = UBUSD_TEST_SOCKET_PATH
+    received = []
+    signals = []
+
+    def callback(event, data):
+        received.append(data)
+
+    def handler(signum, frame):
+        signals.append(signum)
+        ubus.stop()
+
+    with CheckRefCount(path, callback, handler):
+
+        with pytest.raises(RuntimeError):
+            ubus.poll()
+
+        ubus.connect(socket_path=path)
+        ubus.listen(("event_sender", callback))
+
+        with pytest.raises(ValueError):
+            ubus.poll(max_messages=-1)
+        while not received:
+            assert ubus.poll(100) >= 0
+        assert ubus.poll(max_messages=1) <= 1
+
+        # each of the messages is counted
+        polled = []
+        polling = ubus.Connection(socket_path=path)
+        polling.listen(("poll_event", lambda event, data: polled.append(data)))
+        for i in range(5):
+            ubus.send("poll_event", {"i": i})
+        time.sleep(0.2)
+        assert polling.poll(max_messages=1) == 1
+        assert polled == [{"i": 0}]
+        assert polling.poll(max_messages=2) == 2
+        assert polled == [{"i": 0}, {"i": 1}, {"i": 2}]
+        assert polling.poll() == 2
+        assert len(polled) == 5
+        polling.disconnect()
+
+        # stopped from another thread
+        timer = threading.Timer(0.1, ubus.stop)
+        timer.start()
+        start = time.time()
+        ubus.loop(5000)
+        assert time.time() - start < 4
+        timer.join()
+
+        # signal handlers are not postponed until the loop returns
+        original = signal.signal(signal.SIGUSR1, handler)
+        timer = threading.Timer(0.1, os.kill, (os.getpid(), signal.SIGUSR1))
+        timer.start()
+        start = time.time()
+        ubus.loop(5000)
+        assert time.time() - start < 4
+        assert signals == [signal.SIGUSR1]
+        timer.join()
+        signal.signal(signal.SIGUSR1, original)
+
+        del received[:]
+        ubus.disconnect()
+
+
 def test_listen_failed(ubusd_test, disconnect_after):
     path = UBUSD_TEST_SOCKET_PATH
 
@@ -226,6 +344,231 @@ def test_listen(ubusd_test, event_sender, disconnect_after):
         ubus.disconnect()
 
 
+def test_listen_batch(ubusd_test, disconnect_after):
+    path = UBUSD_TEST_SOCKET_PATH
+    batches = []
+
+    def callback(events):
+        batches.append(events)
+
+    with CheckRefCount(path, time, callback):
+
+        ubus.connect(socket_path=path)
+        sender = ubus.Connection(path)
+
+        with pytest.raises(ValueError):
+            ubus.listen(("batch_event", callback), batch=-1)
+        with pytest.raises(ValueError):
+            ubus.listen(("batch_event", callback), batch_timeout=10)
+
+        # batches are limited by their size
+        ubus.listen(("batch_event", callback), batch=2)
+        assert sender.send_many(("batch_event", {"index": i}) for i in range(5)) == 5
+        while sum(len(batch) for batch in batches) < 5:
+            ubus.loop(100)
+        assert all(0 < len(batch) <= 2 for batch in batches)
+        assert [event for batch in batches for event in batch] == [
+            ("batch_event", {"index": i}) for i in range(5)
+        ]
+
+        # or by the time the events wait for the others
+        del batches[:]
+        ubus.listen(("timed_event", callback), batch=100, batch_timeout=200, lazy=True)
+        assert sender.send_many(("timed_event", {"index": i}) for i in range(3)) == 3
+        start = time.time()
+        while not batches:
+            ubus.loop(50)
+        assert time.time() - start >= 0.15
+        assert len(batches) == 1
+        assert [data["index"] for _, data in batches[0]] == [0, 1, 2]
+        del batches[:]
+
+        # the timeout is handled by poll() and process_events() as well
+        assert sender.send_many(("timed_event", {"index": i}) for i in range(3)) == 3
+        start = time.time()
+        while not batches:
+            ubus.poll(50)
+        assert time.time() - start >= 0.15
+        assert [data["index"] for _, data in batches[0]] == [0, 1, 2]
+        del batches[:]
+
+        assert ubus.process_events() == -1
+        assert sender.send_many(("timed_event", {"index": i}) for i in range(3)) == 3
+        time.sleep(0.1)
+        next_timeout = ubus.process_events()
+        assert 0 <= next_timeout <= 200
+        assert not batches
+        time.sleep(next_timeout / 1000.0)
+        assert ubus.process_events() == -1
+        assert [data["index"] for _, data in batches[0]] == [0, 1, 2]
+        del batches[:]
+
+        sender.disconnect()
+        ubus.disconnect()
+        del sender
+
+def test_listen_filter(ubusd_test, disconnect_after):
+    path = UBUSD_TEST_SOCKET_PATH
+    received = []
+
+    def callback(event, data):
+        received.append(data)
+
+    with CheckRefCount(path, time, callback):
+
+        ubus.connect(socket_path=path)
+        sender = ubus.Connection(path)
+
+        for invalid in ([], {"unknown": {}}, {"present": "field"}, {"prefix": {"field": 1}}):
+            with pytest.raises((TypeError, ValueError)):
+                ubus.listen(("filtered_event", callback), filter=invalid)
+
+        ubus.listen(("filtered_event", callback), filter={
+            "equal": {"interface": "lan", "up": True},
+            "present": ["address"],
+            "prefix": {"device": "eth"},
+        })
+        messages = [
+            {"interface": "lan", "up": True, "address": "10.0.0.1", "device": "eth0"},
+            {"interface": "wan", "up": True, "address": "10.0.0.2", "device": "eth1"},
+            {"interface": "lan", "up": False, "address": "10.0.0.3", "device": "eth0"},
+            {"interface": "lan", "up": True, "device": "eth0"},
+            {"interface": "lan", "up": True, "address": "10.0.0.4", "device": "wlan0"},
+            {"interface": "lan", "up": True, "address": "10.0.0.5", "device": "eth0.1"},
+        ]
+        assert sender.send_many(("filtered_event", message) for message in messages) == len(messages)
+        start = time.time()
+        while len(received) < 2 and time.time() - start < 5:
+            ubus.loop(100)
+        ubus.loop(100)
+        assert received == [messages[0], messages[5]]
+
+        sender.disconnect()
+        ubus.disconnect()
+        del sender
+
+def test_unlisten(ubusd_test, disconnect_after):
+    path = UBUSD_TEST_SOCKET_PATH
+    received = []
+
+    def callback(event, data):
+        received.append(("callback", event))
+
+    def wildcard(event, data):
+        received.append(("wildcard", event))
+
+    def receive(sender, events, count):
+        del received[:]
+        for event in events:
+            sender.send(event, {})
+        start = time.time()
+        while len(received) < count and time.time() - start < 5:
+            ubus.loop(100)
+        ubus.loop(100)
+        return sorted(received)
+
+    with CheckRefCount(path, time, callback, wildcard):
+
+        with pytest.raises(RuntimeError):
+            ubus.unlisten("unlisten.first")
+
+        ubus.connect(socket_path=path)
+        sender = ubus.Connection(path)
+
+        with pytest.raises(TypeError):
+            ubus.unlisten()
+        with pytest.raises(TypeError):
+            ubus.unlisten(1)
+
+        ubus.listen(("unlisten.first", callback), ("unlisten.second", callback), ("unlisten.*", wildcard))
+        assert receive(sender, ["unlisten.first"], 2) == [
+            ("callback", "unlisten.first"), ("wildcard", "unlisten.first"),
+        ]
+
+        assert ubus.unlisten(("unlisten.first", wildcard), "unlisten.missing") == 0
+        assert ubus.unlisten(("unlisten.first", callback)) == 1
+        assert receive(sender, ["unlisten.first", "unlisten.second"], 3) == [
+            ("callback", "unlisten.second"), ("wildcard", "unlisten.first"), ("wildcard", "unlisten.second"),
+        ]
+
+        assert ubus.unlisten("unlisten.*", "unlisten.second") == 2
+        assert receive(sender, ["unlisten.first", "unlisten.second"], 0) == []
+
+        # listening again after everything was removed
+        ubus.listen(("unlisten.first", callback))
+        assert receive(sender, ["unlisten.first"], 1) == [("callback", "unlisten.first")]
+
+        sender.disconnect()
+        ubus.disconnect()
+        del sender
+
+
+def test_subscribe(ubusd_test, disconnect_after):
+    path = UBUSD_TEST_SOCKET_PATH
+    received = []
+
+    def callback(type, data):
+        received.append((type, data))
+
+    def handler(handler, data):
+        handler.reply({})
+
+    with CheckRefCount(path, callback, handler):
+
+        with pytest.raises(RuntimeError):
+            ubus.notify("notifying_object", "update", {})
+
+        ubus.connect(socket_path=path)
+        ubus.add("notifying_object", {"method": {"method": handler, "signature": {}}})
+        subscribing = ubus.Connection(socket_path=path)
+
+        with pytest.raises(RuntimeError):
+            subscribing.subscribe("non_existing", callback)
+        with pytest.raises(TypeError):
+            subscribing.subscribe("notifying_object", 5)
+        with pytest.raises(RuntimeError):
+            ubus.notify("non_existing", "update", {})
+
+        assert ubus.notify("notifying_object", "update", {"a": 1}) is False
+
+        subscribing.subscribe("notifying_object", callback)
+        # the object is informed about its subscribers asynchronously
+        while not ubus.notify("notifying_object", "update", {"a": 2}):
+            ubus.loop(50)
+        while not received:
+            subscribing.loop(50)
+        assert received == [("update", {"a": 2})]
+
+        assert subscribing.unsubscribe("notifying_object") is True
+        assert subscribing.unsubscribe("notifying_object") is False
+
+        with pytest.raises(TypeError):
+            subscribing.subscribe("notifying_object", callback, raw=True, lazy=True)
+
+        # data can be passed to the callback without being decoded
+        del received[:]
+        subscribing.subscribe("notifying_object", callback, raw=True)
+        while not ubus.notify("notifying_object", "update", {"a": 3}):
+            ubus.loop(50)
+        while not received:
+            subscribing.loop(50)
+        assert received == [("update", ubus.encode({"a": 3}))]
+        assert subscribing.unsubscribe("notifying_object") is True
+
+        del received[:]
+        subscribing.subscribe("notifying_object", callback, lazy=True)
+        while not ubus.notify("notifying_object", "update", {"a": 4}):
+            ubus.loop(50)
+        while not received:
+            subscribing.loop(50)
+        assert received[0][1]["a"] == 4
+        assert subscribing.unsubscribe("notifying_object") is True
+        del received[:]
+
+        subscribing.disconnect()
+        ubus.disconnect()
+
+
 def test_add_object_failed(ubusd_test, registered_objects, disconnect_after):
     path = UBUSD_TEST_SOCKET_PATH
 
@@ -294,6 +637,105 @@ def test_add_object(ubusd_test, disconnect_after):
         ubus.disconnect()
 
 
+def test_add_many_and_remove(ubusd_test, disconnect_after):
+    path = UBUSD_TEST_SOCKET_PATH
+
+    def fake(*args):
+        pass
+
+    objects = {
+        "many_object%d" % i: {"test": {"method": fake, "signature": dict(arg=3)}} for i in range(32)
+    }
+
+    with CheckRefCount(path, fake, *objects):
+
+        with pytest.raises(RuntimeError):
+            ubus.add_many(objects)
+
+        ubus.connect(socket_path=path)
+        lister = ubus.Connection(path)
+
+        assert ubus.add_many(objects) is None
+        assert sorted(lister.objects("many_object*")) == sorted(objects)
+
+        for i in range(0, 32, 2):
+            assert ubus.remove("many_object%d" % i) is None
+        assert sorted(lister.objects("many_object*")) == sorted("many_object%d" % i for i in range(1, 32, 2))
+
+        with pytest.raises(RuntimeError):
+            ubus.remove("many_object0")
+        with pytest.raises(RuntimeError):
+            ubus.notify("many_object0", "update", {})
+
+        # nothing is added when any of the objects can't be added
+        with pytest.raises(RuntimeError):
+            ubus.add_many({"many_object0": {}, "many_object1": {}})
+        with pytest.raises(TypeError):
+            ubus.add_many({"many_object0": {}, "many_object2": {"test": 5}})
+        assert "many_object0" not in lister.objects("many_object*")
+
+        # removed object can be added again
+        assert ubus.add("many_object0", objects["many_object0"]) is None
+        assert "many_object0" in lister.objects("many_object*")
+
+        lister.disconnect()
+        ubus.disconnect()
+        del lister
+
+
+def test_call_wide_object(ubusd_test, served_objects, disconnect_after):
+    path = UBUSD_TEST_SOCKET_PATH
+
+    with CheckRefCount(path):
+
+        ubus.connect(socket_path=path)
+
+        for i in range(64):
+            arguments = {"arg%d" % j: j for j in range(i % 16)}
+            assert ubus.call("wide_object", "method%d" % i, arguments) == [arguments]
+
+        # wrong type, missing and unknown arguments
+        for arguments in ({"arg0": "0"}, {}, {"arg0": 0, "unknown": 1}):
+            with pytest.raises(RuntimeError):
+                ubus.call("wide_object", "method1", arguments)
+
+        with pytest.raises(RuntimeError):
+            ubus.call("wide_object", "method64", {})
+
+        ubus.disconnect()
+
+
+def test_call_keywords(ubusd_test, served_objects, disconnect_after):
+    path = UBUSD_TEST_SOCKET_PATH
+
+    def handler(handler, first, second, third=None):
+        handler.reply({"first": first, "second": second, "third": third})
+
+    with CheckRefCount(path, handler):
+
+        ubus.connect(socket_path=path)
+
+        with pytest.raises(TypeError):
+            ubus.add("keywords_object", {"method": {"method": handler, "signature": {}}}, keywords=1)
+
+        assert ubus.call("keywords_object", "method", {"first": "1", "second": {"a": [1]}}) == [
+            {"first": "1", "second": {"a": [1]}, "third": None}
+        ]
+        arguments = {"arg%d" % i: i if i % 2 else str(i) for i in range(32)}
+        assert ubus.call("keywords_object", "wide", arguments) == [arguments]
+
+        # wrong type, missing and unknown arguments
+        for arguments in (
+            {"first": 1, "second": {}},
+            {"first": "1"},
+            {"first": "1", "second": {}, "third": 3},
+        ):
+            with pytest.raises(RuntimeError):
+                ubus.call("keywords_object", "method", arguments)
+
+        ubus.disconnect()
+
+
 def test_list_objects_failed(ubusd_test, registered_objects, disconnect_after):
     path = UBUSD_TEST_SOCKET_PATH
 
@@ -409,6 +851,43 @@ def test_list_objects_empty(ubusd_test, disconnect_after):
         ubus.disconnect()
 
 
+def test_list_objects_cached(ubusd_test, disconnect_after):
+    path = UBUSD_TEST_SOCKET_PATH
+
+    def fake(*args):
+        pass
+
+    methods = {"method": {"method": fake, "signature": {"first": ubus.BLOBMSG_TYPE_STRING}}}
+
+    with CheckRefCount(path, fake):
+
+        ubus.connect(path)
+        owner = ubus.Connection(path)
+        owner.add("cached_object1", methods)
+
+        assert ubus.objects("cached_object*", cached=True) == {
+            "cached_object1": {"method": {"first": ubus.BLOBMSG_TYPE_STRING}},
+        }
+
+        # the catalogue is updated when the object events are processed
+        owner.add("cached_object2", methods)
+        owner.remove("cached_object1")
+        ubus.loop(100)
+        assert ubus.objects("cached_object*", cached=True) == ubus.objects("cached_object*")
+        assert list(ubus.objects("cached_object*", cached=True)) == ["cached_object2"]
+
+        # returned signatures are copies
+        ubus.objects("cached_object2", cached=True)["cached_object2"]["method"]["first"] = None
+        assert ubus.objects("cached_object2", cached=True) == ubus.objects("cached_object2")
+
+        owner.disconnect()
+        ubus.loop(100)
+        assert ubus.objects("cached_object*", cached=True) == {}
+
+        ubus.disconnect()
+        del owner
+
+
 def test_reply_out_of_handler():
     data = {"this": "should fail"}
 
@@ -514,6 +993,71 @@ def test_reply(ubusd_test, call_for_object, disconnect_after):
         ubus.disconnect()
 
 
+def test_deferred_reply(ubusd_test, disconnect_after):
+    path = UBUSD_TEST_SOCKET_PATH
+    deferred = []
+
+    def slow(handler, data):
+        handler.defer()
+        with pytest.raises(RuntimeError):
+            handler.defer()
+        deferred.append(handler)
+
+    def finish(handler, data):
+        slow_handler = deferred.pop()
+        assert slow_handler.reply({"deferred": True})
+        slow_handler.complete()
+        with pytest.raises(RuntimeError):
+            slow_handler.complete()
+        handler.reply(data)
+
+    def dropped(handler, data):
+        handler.defer()
+
+    def failing(handler, data):
+        handler.defer()
+        raise Exception("failed")
+
+    with CheckRefCount(path, deferred, slow, finish, dropped, failing):
+
+        handler = ubus.__ResponseHandler()
+        with pytest.raises(RuntimeError):
+            handler.defer()
+        del handler
+
+        ubus.connect(socket_path=path)
+        ubus.add(
+            "deferred_object",
+            {
+                "slow": {"method": slow, "signature": {}},
+                "finish": {"method": finish, "signature": {
+                    "first": ubus.BLOBMSG_TYPE_INT32,
+                }},
+                "dropped": {"method": dropped, "signature": {}},
+                "failing": {"method": failing, "signature": {}},
+            },
+        )
+
+        slow_request = ubus.call_async("deferred_object", "slow", {})
+        finish_request = ubus.call_async("deferred_object", "finish", {"first": 1})
+        assert finish_request.wait() == [{"first": 1}]
+        assert slow_request.wait() == [{"deferred": True}]
+        assert deferred == []
+
+        request = ubus.call_async("deferred_object", "dropped", {})
+        with pytest.raises(RuntimeError):
+            request.wait()
+        assert request.status == ubus.UBUS_STATUS_NO_DATA
+
+        request = ubus.call_async("deferred_object", "failing", {})
+        with pytest.raises(RuntimeError):
+            request.wait()
+        assert request.status == ubus.UBUS_STATUS_UNKNOWN_ERROR
+
+        del slow_request, finish_request, request
+        ubus.disconnect()
+
+
 def test_call_failed(ubusd_test, responsive_object, disconnect_after):
     path = UBUSD_TEST_SOCKET_PATH
 
@@ -586,18 +1130,263 @@ def test_call(ubusd_test, responsive_object, disconnect_after):
         ubus.disconnect()
 
 
+def test_call_async(ubusd_test, responsive_object, disconnect_after):
+    path = UBUSD_TEST_SOCKET_PATH
+    data = {"first": "1", "second": False, "third": 22}
+    completed = []
+
+    def callback(status, results):
+        completed.append((status, results))
+
+    with CheckRefCount(path, data, callback):
+
+        with pytest.raises(RuntimeError):
+            ubus.call_async("responsive_object", "respond", data)
+
+        ubus.connect(socket_path=path)
+
+        with pytest.raises(TypeError):
+            ubus.call_async("responsive_object", "respond", data, callback=5)
+        with pytest.raises(RuntimeError):
+            ubus.call_async("non_existing_object", "respond", data)
+
+        requests = [
+            ubus.call_async("responsive_object", "respond", data, callback=callback)
+            for _ in range(10)
+        ]
+        while not all(request.done for request in requests):
+            ubus.loop(50)
+
+        assert len(completed) == 10
+        for request, (status, results) in zip(requests, completed):
+            assert request.status == status == 0
+            assert results == [{"first": "1", "second": False, "third": 22, "passed": True}]
+            assert request.results is results
+
+        request = ubus.call_async("responsive_object", "multi_respond", {})
+        res = request.wait()
+        assert len(res) == 3
+        assert res[2] == {"passed1": True, "passed2": True, "passed3": True}
+
+        request = ubus.call_async("responsive_object", "fail", {})
+        with pytest.raises(RuntimeError):
+            request.wait()
+        assert request.done
+
+        request = ubus.call_async("responsive_object", "respond", data, callback=callback)
+        assert request.cancel() is True
+        assert request.cancel() is False
+        assert request.done and request.status is None
+        with pytest.raises(RuntimeError):
+            request.wait()
+
+        # a callback which refers to its own request is collected
+        def cycle():
+            requests = []
+            requests.append(ubus.call_async(
+                "responsive_object", "respond", data, callback=lambda *args: (requests, callback)
+            ))
+            requests[0].wait()
+        cycle()
+        gc.collect()
+
+        del requests, request, res, completed[:]
+        ubus.disconnect()
+
+
+def test_call_iter(ubusd_test, responsive_object, disconnect_after):
+    path = UBUSD_TEST_SOCKET_PATH
+    data = {"first": "1", "second": False, "third": 22}
+
+    with CheckRefCount(path, data):
+
+        with pytest.raises(RuntimeError):
+            ubus.call_iter("responsive_object", "multi_respond", {})
+
+        ubus.connect(socket_path=path)
+
+        with pytest.raises(ValueError):
+            ubus.call_iter("responsive_object", "multi_respond", {}, max_replies=-1)
+        with pytest.raises(RuntimeError):
+            ubus.call_iter("non_existing_object", "respond", data)
+
+        replies = ubus.call_iter("responsive_object", "multi_respond", {})
+        assert next(replies) == {"passed1": True}
+        assert list(replies) == [
+            {"passed1": True, "passed2": True}, {"passed1": True, "passed2": True, "passed3": True},
+        ]
+        assert replies.done and replies.status == 0
+
+        assert list(ubus.call_iter("responsive_object", "respond", data)) == [dict(data, passed=True)]
+
+        # the request is aborted once the limit is reached
+        replies = ubus.call_iter("responsive_object", "multi_respond", {}, max_replies=2)
+        assert len(list(replies)) == 2
+        replies = ubus.call_iter("responsive_object", "multi_respond", {}, max_bytes=1)
+        assert list(replies) == []
+        assert replies.done
+
+        raw = list(ubus.call_iter("responsive_object", "multi_respond", {}, raw=True))
+        assert [ubus.decode(e) for e in raw] == ubus.call("responsive_object", "multi_respond", {})
+
+        with pytest.raises(RuntimeError):
+            list(ubus.call_iter("responsive_object", "fail", {}))
+
+        # requests of call_async() can't be iterated
+        request = ubus.call_async("responsive_object", "respond", data)
+        with pytest.raises(TypeError):
+            next(request)
+        request.wait()
+
+        del replies, raw, request
+        ubus.disconnect()
+
+
+def test_call_many(ubusd_test, responsive_object, disconnect_after):
+    path = UBUSD_TEST_SOCKET_PATH
+    data = {"first": "1", "second": False, "third": 22}
+
+    with CheckRefCount(path, data):
+
+        with pytest.raises(RuntimeError):
+            ubus.call_many([("responsive_object", "respond", data)])
+
+        ubus.connect(socket_path=path)
+
+        with pytest.raises(TypeError):
+            ubus.call_many(5)
+        with pytest.raises(TypeError):
+            ubus.call_many([["responsive_object", "respond", data]])
+        with pytest.raises(TypeError):
+            ubus.call_many([("responsive_object", "respond", {"first": object()})])
+        assert ubus.call_many([]) == []
+
+        # nothing is sent when any of the arguments can't be encoded
+        # (the object would be blocked by the sleep otherwise)
+        with pytest.raises(TypeError):
+            ubus.call_many([
+                ("responsive_object", "sleep", {"ms": 1000}),
+                ("responsive_object", "respond", {"first": object()}),
+            ])
+        start = time.time()
+        assert ubus.call("responsive_object", "respond", data)
+        assert time.time() - start < 0.5
+
+        results = ubus.call_many([
+            ("responsive_object", "respond", data),
+            ("non_existing_object", "respond", data),
+            ("responsive_object", "fail", {}),
+            ("responsive_object", "multi_respond", {}),
+            ("responsive_object", "respond", {"first": "1"}),
+        ])
+        assert results[0] == (0, [{"first": "1", "second": False, "third": 22, "passed": True}])
+        assert results[1] == (ubus.UBUS_STATUS_NOT_FOUND, [])
+        assert results[2][0] == ubus.UBUS_STATUS_UNKNOWN_ERROR
+        assert results[3][0] == 0 and len(results[3][1]) == 3
+        assert results[4] == (ubus.UBUS_STATUS_INVALID_ARGUMENT, [])
+
+        many = [("responsive_object", "number", {"number": i}) for i in range(100)]
+        assert ubus.call_many(many) == [(0, [{"number": i, "passed": True}]) for i in range(100)]
+
+        start = time.time()
+        results = ubus.call_many([("responsive_object", "sleep", {"ms": 500})], timeout=100)
+        assert results == [(ubus.UBUS_STATUS_TIMEOUT, [])]
+        assert time.time() - start < 0.4
+        assert ubus.call("responsive_object", "respond", data)
+
+        del results, many
+        ubus.disconnect()
+
+
+def test_call_threads(ubusd_test, responsive_object, disconnect_after):
+    path = UBUSD_TEST_SOCKET_PATH
+    ticks = []
+    failed = []
+
+    def spin():
+        while not stop.is_set():
+            ticks.append(time.time())
+            time.sleep(0.01)
+
+    def worker(index):
+        try:
+            for i in range(20):
+                data = {"first": str(index), "second": True, "third": i}
+                res = ubus.call("responsive_object", "respond", data)
+                assert res == [dict(data, passed=True)]
+        except Exception as e:
+            failed.append(e)
+
+    with CheckRefCount(path):
+
+        ubus.connect(socket_path=path)
+
+        # other threads should run while the call is waiting for the reply
+        stop = threading.Event()
+        spinner = threading.Thread(target=spin)
+        spinner.start()
+        start = time.time()
+        assert ubus.call("responsive_object", "sleep", {"ms": 300}) == [{"ms": 300}]
+        end = time.time()
+        stop.set()
+        spinner.join()
+        assert [e for e in ticks if start + 0.1 < e < end - 0.1]
+
+        # concurrent calls using the same connection
+        workers = [threading.Thread(target=worker, args=(i, )) for i in range(8)]
+        for thread in workers:
+            thread.start()
+        for thread in workers:
+            thread.join()
+        assert failed == []
+
+        ubus.disconnect()
+
+
+def test_call_object_replaced(ubusd_test, replaceable_object, disconnect_after):
+    path = UBUSD_TEST_SOCKET_PATH
+    start, stop = replaceable_object
+
+    with CheckRefCount(path):
+
+        ubus.connect(socket_path=path)
+        pid1 = ubus.call("replaceable_object", "pid", {})[0]["pid"]
+        assert ubus.call("replaceable_object", "pid", {})[0]["pid"] == pid1
+
+        # the cached object id becomes stale
+        stop()
+        start()
+        pid2 = ubus.call("replaceable_object", "pid", {})[0]["pid"]
+        assert pid1 != pid2
+
+        stop()
+        with pytest.raises(RuntimeError):
+            ubus.call("replaceable_object", "pid", {})
+
+        ubus.disconnect()
+
+
 def test_call_max_min_number(ubusd_test, responsive_object, disconnect_after):
     path = UBUSD_TEST_SOCKET_PATH
     data1 = {"number": 2 ** 32}
     data2 = {"number": -(2 ** 32)}
+    data3 = {"number": 2 ** 64}
 
-    with CheckRefCount(path, data1, data2):
+    with CheckRefCount(path, data1, data2, data3):
 
         ubus.connect(socket_path=path)
-        res = ubus.call("responsive_object", "number", data1)
+
+        # both codecs clamp the numbers to int32
+        for native in (True, False):
+            ubus.set_native_codec(native)
+            res = ubus.call("responsive_object", "number", data1)
+            assert res[0] == {"number": 2 ** 31 - 1, "passed": True}
+            res = ubus.call("responsive_object", "number", data2)
+            assert res[0] == {"number": -(2 ** 31), "passed": True}
+        ubus.set_native_codec(True)
+
+        res = ubus.call("responsive_object", "number", data3)
         assert res[0] == {"number": 2 ** 31 - 1, "passed": True}
-        res = ubus.call("responsive_object", "number", data2)
-        assert res[0] == {"number": -(2 ** 31), "passed": True}
 
         del res
         ubus.disconnect()
@@ -663,3 +1452,312 @@ def test_unicode(ubusd_test, responsive_object, disconnect_after):
 
         del res
         ubus.disconnect()
+
+
+def test_native_codec(ubusd_test, responsive_object, disconnect_after):
+    path = UBUSD_TEST_SOCKET_PATH
+    data = {"first": u"Příliš žluťoučký kůň", "second": True, "third": -20}
+
+    with CheckRefCount(path, data):
+
+        assert ubus.get_native_codec() is True
+        with pytest.raises(TypeError):
+            ubus.set_native_codec(1)
+
+        ubus.connect(socket_path=path)
+        res_native = ubus.call("responsive_object", "respond", data)
+        res_native_multi = ubus.call("responsive_object", "multi_respond", {})
+
+        ubus.set_native_codec(False)
+        assert ubus.get_native_codec() is False
+        res_json = ubus.call("responsive_object", "respond", data)
+        res_json_multi = ubus.call("responsive_object", "multi_respond", {})
+        ubus.set_native_codec(True)
+
+        assert res_native == res_json
+        assert res_native_multi == res_json_multi
+        assert res_native[0]["third"] == -20
+        for key in res_native[0]:
+            assert type(res_native[0][key]) == type(res_json[0][key])
+
+        del res_native, res_native_multi, res_json, res_json_multi
+        ubus.disconnect()
+
+
+def test_codec(ubusd_test, responsive_object, disconnect_after):
+    path = UBUSD_TEST_SOCKET_PATH
+    data = {"first": u"Příliš žluťoučký kůň", "second": True, "third": -20}
+    calls = []
+
+    def loads(string):
+        calls.append("loads")
+        return json.loads(string)
+
+    def dumps(obj):
+        calls.append("dumps")
+        return json.dumps(obj).encode("utf-8")  # bytes are accepted as well
+
+    with CheckRefCount(path, data, loads, dumps):
+
+        assert ubus.get_codec() == (json.loads, json.dumps)
+        with pytest.raises(TypeError):
+            ubus.set_codec(loads)
+        with pytest.raises(TypeError):
+            ubus.set_codec(1, 2)
+
+        ubus.set_codec(loads, dumps)
+        assert ubus.get_codec() == (loads, dumps)
+
+        ubus.connect(socket_path=path)
+        res_native = ubus.call("responsive_object", "respond", data)
+        assert calls == []
+
+        ubus.set_native_codec(False)
+        res_json = ubus.call("responsive_object", "respond", data)
+        ubus.set_native_codec(True)
+        assert res_native == res_json
+        assert calls == ["dumps", "loads"]
+
+        ubus.set_codec()
+        assert ubus.get_codec() == (json.loads, json.dumps)
+
+        del res_native, res_json
+        ubus.disconnect()
+
+
+def test_raw(ubusd_test, responsive_object, served_objects, disconnect_after):
+    path = UBUSD_TEST_SOCKET_PATH
+    data = {"first": u"Příliš žluťoučký kůň", "second": True, "third": -20}
+    received = []
+
+    def callback(event, data):
+        received.append(data)
+
+    with CheckRefCount(path, data, callback):
+
+        ubus.connect(socket_path=path)
+
+        with pytest.raises(TypeError):
+            ubus.add("raw_object", {}, keywords=True, raw=True)
+
+        raw = ubus.call("raw_object", "method", data, raw=True)
+        assert len(raw) == 1 and isinstance(raw[0], bytes)
+        assert ubus.call("raw_object", "type", data) == [{"bytes": True}]
+        message = ubus.RawMessage(memoryview(raw[0]))
+        assert message.data == raw[0]
+        assert ubus.call("raw_object", "method", message, raw=True) == raw
+        assert ubus.call("responsive_object", "respond", message) == [dict(data, passed=True)]
+
+        # buffers are sent without conversion only when they are wrapped
+        with pytest.raises(TypeError):
+            ubus.call("responsive_object", "respond", raw[0])
+
+        # nested attributes are checked as well
+        nested = ubus.encode({"table": {"array": [1, "a"]}})
+        assert ubus.decode(ubus.RawMessage(nested).data) == {"table": {"array": [1, "a"]}}
+        broken = bytearray(nested)
+        broken[-4:-2] = b"ab"  # unterminated string in the array
+        for invalid in (b"", b"\x00\x00\x00\x08", raw[0][:-1], bytes(broken)):
+            with pytest.raises(ValueError):
+                ubus.RawMessage(invalid)
+
+        ubus.listen(("raw_event", callback), raw=True)
+        ubus.send("raw_event", message)
+        while not received:
+            ubus.loop(50)
+        assert isinstance(received[0], bytes)
+        received_message = ubus.RawMessage(received[0])
+        assert ubus.call("responsive_object", "respond", received_message) == [dict(data, passed=True)]
+
+        del raw, message, received_message, received[:]
+        ubus.disconnect()
+
+
+def test_lazy(ubusd_test, responsive_object, served_objects, disconnect_after):
+    path = UBUSD_TEST_SOCKET_PATH
+    data = {"first": "1", "second": {"a": [1, {"b": True}, "c"], "d": 2.5}, "third": []}
+    received = []
+
+    def callback(event, data):
+        received.append(data)
+
+    with CheckRefCount(path, callback):
+
+        ubus.connect(socket_path=path)
+
+        with pytest.raises(TypeError):
+            ubus.call("responsive_object", "respond", data, raw=True, lazy=True)
+
+        assert ubus.call("lazy_object", "method", data) == [{"first": "1", "type": "MessageView"}]
+
+        ubus.listen(("lazy_event", callback), lazy=True)
+        ubus.send("lazy_event", data)
+        while not received:
+            ubus.loop(50)
+        view = received.pop()
+
+        assert isinstance(view, ubus.MessageView)
+        assert len(view) == 3
+        assert view == data
+        assert view.to_dict() == data
+        assert sorted(view) == sorted(data.keys())
+        assert "first" in view and "fourth" not in view
+        assert view.get("fourth") is None
+        with pytest.raises(KeyError):
+            view["fourth"]
+
+        # views can be forwarded without decoding
+        assert ubus.call("lazy_object", "method", view) == [{"first": "1", "type": "MessageView"}]
+
+        nested = view["second"]["a"]
+        del view
+        assert isinstance(nested, ubus.MessageView)
+        assert nested[1]["b"] is True
+        assert nested[-1] == "c"
+        assert 1 in nested
+        with pytest.raises(IndexError):
+            nested[3]
+
+        del nested
+        ubus.disconnect()
+
+
+def test_encode_decode():
+    data = {"first": u"Příliš žluťoučký kůň", "second": {"a": [1, True, 2.5]}, "third": -20}
+
+    with CheckRefCount(data):
+
+        encoded = ubus.encode(data)
+        assert isinstance(encoded, bytes)
+        assert ubus.decode(encoded) == data
+        assert ubus.decode(memoryview(encoded), lazy=True) == data
+        assert ubus.decode(ubus.encode({})) == {}
+
+        with pytest.raises(TypeError):
+            ubus.encode([1])
+        with pytest.raises(ValueError):
+            ubus.decode(encoded[:-1])
+
+        del encoded
+
+
+def test_stats(ubusd_test, responsive_object, call_for_object, event_sender, disconnect_after):
+    path = UBUSD_TEST_SOCKET_PATH
+    data = {"first": "1", "second": False, "third": 3}
+
+    def handler(handler, data):
+        handler.reply(data)
+
+    def callback(event, data):
+        pass
+
+    def served(stats, method):
+        return stats["methods"]["callee_object"][method]["invocations"]
+
+    with CheckRefCount(path, data, handler, callback):
+
+        with pytest.raises(RuntimeError):
+            ubus.stats()
+
+        ubus.connect(socket_path=path)
+        ubus.add("callee_object", {
+            "method1": {"method": handler, "signature": {"first": ubus.BLOBMSG_TYPE_INT32}},
+            "method2": {"method": handler, "signature": {"first": ubus.BLOBMSG_TYPE_INT32}},
+        })
+        ubus.listen(("event_sender", callback))
+
+        ubus.call("responsive_object", "respond", data)
+        stats = ubus.stats()
+        assert stats["enabled"] is False
+        assert stats["calls"] == {} and stats["events"]["event_sender"]["invocations"] == 0
+
+        ubus.enable_stats()
+        ubus.call("responsive_object", "respond", data)
+        with pytest.raises(RuntimeError):
+            ubus.call("responsive_object", "fail", {})
+
+        stats = ubus.stats()
+        while not served(stats, "method1") or not served(stats, "method2") \
+                or not stats["events"]["event_sender"]["invocations"]:
+            ubus.loop(50)
+            stats = ubus.stats()
+
+        respond = stats["calls"]["responsive_object"]["respond"]
+        assert respond["invocations"] == 1 and respond["errors"] == {}
+        assert respond["bytes_in"] > 0 and respond["bytes_out"] > 0
+        assert respond["reply"]["count"] == 1 and sum(respond["reply"]["buckets"]) == 1
+        assert len(respond["reply"]["buckets"]) == len(stats["bounds_us"]) + 1
+        assert list(stats["calls"]["responsive_object"]["fail"]["errors"].values()) == [1]
+
+        method1 = stats["methods"]["callee_object"]["method1"]
+        assert method1["errors"] == {}
+        assert method1["decode"]["count"] == method1["callback"]["count"] == method1["invocations"]
+        assert method1["reply"]["count"] == method1["invocations"]
+        # method2 is called without the "first" argument
+        method2 = stats["methods"]["callee_object"]["method2"]
+        assert list(method2["errors"].values()) == [method2["invocations"]]
+        assert method2["callback"]["count"] == 0
+
+        ubus.stats(reset=True)
+        assert ubus.stats()["calls"]["responsive_object"]["respond"]["invocations"] == 0
+
+        ubus.publish_stats("stats_object")
+        published = ubus.call_async("stats_object", "stats", {}).wait()
+        assert published[0]["enabled"] is True
+        assert "callee_object" in published[0]["methods"]
+
+        del stats, respond, method1, method2, published
+        ubus.disconnect()
+
+
+def test_connection_objects(ubusd_test, responsive_object):
+    path = UBUSD_TEST_SOCKET_PATH
+    data = {"first": "1", "second": False, "third": 22}
+    received = []
+
+    def callback(event, data):
+        received.append((event, data))
+
+    def handler(handler, data):
+        handler.reply({"passed": True})
+
+    with CheckRefCount(path, data, callback, handler):
+
+        with pytest.raises(IOError):
+            ubus.Connection(socket_path="/non/existing/path")
+
+        listening = ubus.Connection(socket_path=path)
+        calling = ubus.Connection(socket_path=path)
+        assert listening.get_connected() is True
+        assert listening.get_socket_path() == path
+        assert listening.get_fd() != calling.get_fd()
+
+        # module connection is independent
+        assert ubus.get_connected() is False
+        with pytest.raises(RuntimeError):
+            ubus.call("responsive_object", "respond", data)
+
+        listening.listen(("connection_event", callback))
+        listening.add("connection_object", {"method": {"method": handler, "signature": {}}})
+
+        assert calling.call("responsive_object", "respond", data) == [
+            {"first": "1", "second": False, "third": 22, "passed": True}
+        ]
+        request = calling.call_async("connection_object", "method", {})
+        assert request.wait() == [{"passed": True}]
+
+        assert calling.send("connection_event", {"a": 1})
+        while not received:
+            listening.loop(50)
+        assert received == [("connection_event", {"a": 1})]
+
+        calling.disconnect()
+        assert calling.get_connected() is False
+        assert calling.get_socket_path() is None
+        with pytest.raises(RuntimeError):
+            calling.call("responsive_object", "respond", data)
+        with pytest.raises(RuntimeError):
+            calling.disconnect()
+        assert listening.get_connected() is True
+
+        del listening, calling, request, received[:]
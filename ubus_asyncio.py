@@ -0,0 +1,144 @@
+#
+# python-ubus - python bindings for ubus
+#
+# Copyright (C) 2017-2018 Stepan Henek <stepan.henek@nic.cz>
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU Lesser General Public License version 2.1
+# as published by the Free Software Foundation
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+
+"""
+asyncio integration for ubus
+
+The ubus connection is registered as a reader in the asyncio event loop so that
+incoming messages are processed without calling ubus.loop().
+"""
+
+import asyncio
+
+import ubus
+
+
+class UbusError(RuntimeError):
+
+    def __init__(self, status):
+        super(UbusError, self).__init__("ubus error occured: %d" % status)
+        self.status = status
+
+
+class Adapter(object):
+
+    def __init__(self, loop=None, connection=None):
+        self.loop = loop or asyncio.get_event_loop()
+        # ubus module serves as the default connection
+        self.connection = connection or ubus
+        self.fd = None
+        self.timer = None
+
+    def attach(self):
+        """ Starts to process ubus messages within the event loop """
+        if self.fd is not None:
+            raise RuntimeError("Adapter is already attached.")
+        self.fd = self.connection.get_fd()
+        self.loop.add_reader(self.fd, self._process_events)
+
+    def detach(self):
+        """ Stops to process ubus messages within the event loop """
+        if self.fd is None:
+            raise RuntimeError("Adapter is not attached.")
+        self.loop.remove_reader(self.fd)
+        self.fd = None
+        if self.timer:
+            self.timer.cancel()
+            self.timer = None
+
+    def _process_events(self):
+        if self.timer:
+            self.timer.cancel()
+            self.timer = None
+        # batches of the listeners which wait for batch_timeout are passed later
+        timeout = self.connection.process_events()
+        if timeout >= 0:
+            self.timer = self.loop.call_later(timeout / 1000.0, self._process_events)
+
+    async def _wait(self, start_request):
+        future = self.loop.create_future()
+
+        def callback(status, results):
+            if future.done():
+                return
+            if status:
+                future.set_exception(UbusError(status))
+            else:
+                future.set_result(results)
+
+        request = start_request(callback)
+        try:
+            return await future
+        except asyncio.CancelledError:
+            request.cancel()
+            raise
+
+    async def call(self, object, method, arguments, timeout=0):
+        """ Awaitable ubus.call() (timeout in ms, 0 = no timeout) """
+        # the timeout of call_async() is handled only by ubus.loop()
+        waiting = self._wait(
+            lambda callback: self.connection.call_async(
+                object, method, arguments, callback=callback
+            )
+        )
+        if not timeout:
+            return await waiting
+        try:
+            return await asyncio.wait_for(waiting, timeout / 1000.0)
+        except asyncio.TimeoutError:
+            raise UbusError(ubus.UBUS_STATUS_TIMEOUT)
+
+    async def send(self, event, data):
+        """ Awaitable ubus.send() """
+        await self._wait(
+            lambda callback: self.connection.send_async(event, data, callback=callback)
+        )
+        return True
+
+    def add(self, object_name, methods, **kwargs):
+        """ ubus.add() which accepts coroutine functions as the methods as well
+
+        The response is deferred until the coroutine finishes. Its result (if not None)
+        is sent as the reply and an exception finishes the call with UBUS_STATUS_UNKNOWN_ERROR.
+        """
+        wrapped = {}
+        for name, method in methods.items():
+            wrapped[name] = dict(method)
+            if asyncio.iscoroutinefunction(method.get("method")):
+                wrapped[name]["method"] = self._handler(method["method"])
+        return self.connection.add(object_name, wrapped, **kwargs)
+
+    def _handler(self, coroutine_function):
+
+        def handler(response, *args, **kwargs):
+            response.defer()
+            self.loop.create_task(self._respond(response, coroutine_function(response, *args, **kwargs)))
+
+        return handler
+
+    async def _respond(self, response, coroutine):
+        try:
+            result = await coroutine
+            if result is not None:
+                response.reply(result)
+        except Exception as e:
+            self.loop.call_exception_handler({"message": "ubus method failed", "exception": e})
+            status = ubus.UBUS_STATUS_UNKNOWN_ERROR
+        else:
+            status = ubus.UBUS_STATUS_OK
+        try:
+            response.complete(status)
+        except RuntimeError:
+            pass  # connection was closed in the meantime
@@ -18,7 +18,12 @@
 #include <dlfcn.h>
 #include <libubox/blobmsg_json.h>
 #include <libubus.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
 #include <stdio.h>
+#include <time.h>
+#include <unistd.h>
 
 #ifndef UBUS_UNIX_SOCKET
 #define UBUS_UNIX_SOCKET "/var/run/ubus/ubus.sock"
@@ -26,6 +31,10 @@
 
 #define DEFAULT_SOCKET UBUS_UNIX_SOCKET
 #define RESPONSE_HANDLER_OBJECT_NAME "ubus.__ResponseHandler"
+#define REQUEST_OBJECT_NAME "ubus.__Request"
+#define CONNECTION_OBJECT_NAME "ubus.Connection"
+#define MESSAGE_VIEW_OBJECT_NAME "ubus.MessageView"
+#define RAW_MESSAGE_OBJECT_NAME "ubus.RawMessage"
 
 #define MSG_ALLOCATION_FAILS "Failed to allocate memory!"
 #define MSG_LISTEN_TUPLE_EXPECTED "Expected (event, callback) tuple"
@@ -48,6 +57,7 @@ struct module_state {
 #define GETSTATE(m) ((struct module_state*)PyModule_GetState(m))
 #define PyStr_Check PyUnicode_Check
 #define PyInt_Check PyLong_Check
+#define PyInt_FromLong PyLong_FromLong
 
 #else
 #define PyStr_Check(x) (PyString_Check(x) || PyUnicode_Check(x))
@@ -56,16 +66,162 @@ struct module_state {
 static struct module_state _state;
 #endif
 
+typedef struct ubus_Connection ubus_Connection;
+
+enum message_format {
+	FORMAT_DECODED,  // python objects
+	FORMAT_RAW,  // serialized blobmsg (bytes)
+	FORMAT_LAZY,  // MessageView
+};
+
+#define STATS_BUCKETS 16  // log2 latency buckets starting at 1us, the last one collects the rest
+
+struct latency_histogram {
+	uint64_t count;
+	uint64_t total_ns;
+	uint64_t buckets[STATS_BUCKETS];
+};
+
+struct stats {
+	uint64_t invocations;
+	uint64_t errors[__UBUS_STATUS_LAST];  // indexed by ubus status
+	uint64_t bytes_in;
+	uint64_t bytes_out;
+	struct latency_histogram decode;
+	struct latency_histogram callback;
+	struct latency_histogram reply;
+};
+
+struct name_slot {
+	const char *name;  // NULL for empty slots
+	uint32_t hash;
+	int idx;
+};
+
+struct name_index {
+	struct name_slot *slots;
+	uint32_t mask;  // number of slots - 1
+};
+
+typedef struct {
+	PyObject *callable;
+	struct name_index policy_index;
+	PyObject *names;  // argument names in the policy order (keyword mode only)
+	struct stats stats;
+} ubus_Method;
+
 typedef struct {
 	struct ubus_object object;
+	PyObject *name;  // object.name points to it
 	PyObject *methods;
+	ubus_Connection *connection;
+	struct name_index method_index;
+	ubus_Method *dispatch;  // indexed the same way as object.methods
+	bool keywords;  // arguments are passed to the methods as keyword arguments
+	enum message_format format;  // how the arguments are passed to the methods
+	int busy;  // number of its methods which are being called
+	bool removed;  // it is freed once its methods return
 } ubus_Object;
 
+/* listener filters are compiled from python and evaluated before the GIL is acquired */
+enum filter_kind {
+	FILTER_PRESENT,  // the field is present
+	FILTER_EQUAL,  // the field equals to the value (numbers are compared by their values)
+	FILTER_PREFIX,  // the string field starts with the value
+};
+
+struct filter_rule {
+	enum filter_kind kind;
+	const char *name;  // kept alive by the filter_refs of the listener
+	int type;  // BLOBMSG_TYPE_STRING, BLOBMSG_TYPE_INT64 or BLOBMSG_TYPE_DOUBLE (type of the value)
+	union {
+		int64_t integer;
+		double number;
+		struct {
+			const char *data;  // kept alive by the filter_refs of the listener
+			size_t len;
+		} string;
+	} value;
+};
+
+struct event_filter {
+	int n_rules;
+	struct filter_rule rules[];  // all of them need to match
+};
+
 typedef struct {
-	struct ubus_event_handler handler;
+	struct list_head list;  // all the listeners of the connection
+	struct list_head pattern_list;  // listeners of the same pattern
+	PyObject *event;
 	PyObject *callback;
+	PyObject *filter_refs;  // strings used by the filter
+	enum message_format format;
+	ubus_Connection *connection;
+	const char *pattern;  // utf-8 of the event
+	bool removed;  // by unlisten() (it is freed once no event is being dispatched)
+	struct stats stats;
+	int batch_size;  // events are passed to the callback in lists (0 = one by one)
+	int batch_timeout;  // ms the queued events wait for more (0 = until the socket is drained)
+	struct blob_buf batch;  // queued events (event type as the name of each field)
+	int batch_count;
+	struct uloop_timeout batch_timer;
+	struct event_filter *filter;  // NULL = all the events are passed
 }ubus_Listener ;
 
+/*
+ * Trie of the listened patterns. Wildcard patterns (e.g. "network.*") are stored
+ * without the trailing '*' and their listeners are kept apart.
+ */
+struct pattern_node {
+	struct pattern_node *children;
+	struct pattern_node *next;  // next sibling
+	char key;
+	bool registered;  // the pattern is registered in ubusd
+	bool prefix_registered;  // the wildcard pattern is registered in ubusd
+	struct list_head exact;  // listeners of the pattern
+	struct list_head prefix;  // listeners of the wildcard pattern
+};
+
+typedef struct {
+	struct ubus_subscriber subscriber;
+	struct list_head list;
+	char *object;
+	PyObject *callback;
+	enum message_format format;
+} ubus_Subscriber;
+
+struct ubus_Connection {
+	PyObject_HEAD
+	char *socket_path;
+	struct list_head listeners;
+	struct pattern_node *patterns;  // NULL when nothing is listened
+	struct ubus_event_handler event_handler;  // all the patterns are registered through it
+	int dispatch_depth;  // listeners are freed only when no event is being dispatched
+	bool listeners_removed;
+	ubus_Object **objects;
+	size_t objects_size;
+	size_t objects_capacity;
+	struct name_index object_index;  // object name -> position in objects
+	struct blob_buf buf;
+	struct ubus_context context;
+	struct ubus_context *ctx;  // points to context when connected
+	uloop_fd_handler socket_cb;
+	uloop_timeout_handler pending_cb;
+	pid_t uloop_pid;  // process which registered the socket in its uloop
+	PyThread_type_lock lock;
+	unsigned long lock_owner;
+	int lock_depth;
+	PyObject *object_ids;
+	struct ubus_event_handler object_event_handler;
+	PyObject *catalogue;  // {path: signatures or None when they need to be looked up}
+	struct list_head pending_requests;
+	struct list_head deferred_handlers;
+	struct list_head subscribers;
+	bool stats_enabled;
+	PyObject *call_stats;  // {(object, method): capsule with struct stats}
+	bool batches_pending;  // some listeners wait until the socket is drained
+};
+
 
 PyObject *prepare_bool(bool yes)
 {
@@ -80,21 +236,50 @@ PyObject *prepare_bool(bool yes)
 
 /* ubus module objects */
 static PyMethodDef ubus_methods[];
-PyObject *python_alloc_list = NULL;
-char *socket_path = NULL;
-ubus_Listener **listeners = NULL;
-size_t listerners_size = 0;
-ubus_Object **objects = NULL;
-size_t objects_size = 0;
-struct blob_buf python_buf;
-struct ubus_context *ctx = NULL;
+ubus_Connection *default_connection = NULL;  // used by the module functions
+
+#define CONNECTED(connection) ((connection) && (connection)->ctx != NULL)
+
+/* connection lock - ubus context can't be used by several threads at once */
+
+void connection_lock(ubus_Connection *connection, bool gil_held)
+{
+	unsigned long thread = PyThread_get_thread_ident();
+	if (connection->lock_depth > 0 && connection->lock_owner == thread) {
+		// callbacks are triggered while the lock is held
+		connection->lock_depth++;
+		return;
+	}
+
+	if (!PyThread_acquire_lock(connection->lock, NOWAIT_LOCK)) {
+		if (gil_held) {
+			// the thread which holds the lock might be waiting for the GIL
+			Py_BEGIN_ALLOW_THREADS
+			PyThread_acquire_lock(connection->lock, WAIT_LOCK);
+			Py_END_ALLOW_THREADS
+		} else {
+			PyThread_acquire_lock(connection->lock, WAIT_LOCK);
+		}
+	}
+	connection->lock_owner = thread;
+	connection->lock_depth = 1;
+}
 
-#define CONNECTED (ctx != NULL)
+void connection_unlock(ubus_Connection *connection)
+{
+	if (--connection->lock_depth == 0) {
+		connection->lock_owner = 0;
+		PyThread_release_lock(connection->lock);
+	}
+}
 
 
 /* json module handlers */
 PyObject *json_module = NULL;
 
+/* raised when send_many() can't send all the events */
+PyObject *send_error = NULL;
+
 enum json_function {
 	LOADS,
 	DUMPS,
@@ -105,122 +290,294 @@ const char *json_function_names[2] = {
 	[DUMPS] = "dumps",
 };
 
+// resolved once (json module by default, can be replaced by set_codec())
+PyObject *json_functions[2] = {
+	[LOADS] = NULL,
+	[DUMPS] = NULL,
+};
 
-PyObject *perform_json_function(enum json_function json_function, PyObject *input)
+bool set_json_functions(PyObject *loads, PyObject *dumps)
 {
-	PyObject *function = PyObject_GetAttrString(json_module, json_function_names[json_function]);
-	if (!function) {
-		return NULL;
+	PyObject *functions[2] = {
+		[LOADS] = loads,
+		[DUMPS] = dumps,
+	};
+
+	for (int i = 0; i < 2; i++) {
+		if (functions[i]) {
+			Py_INCREF(functions[i]);
+		} else {
+			functions[i] = PyObject_GetAttrString(json_module, json_function_names[i]);
+			if (!functions[i]) {
+				Py_XDECREF(functions[LOADS]);
+				return false;
+			}
+		}
 	}
-	PyObject *arglist = Py_BuildValue("(O)", input);
-	if (!arglist) {
-		Py_DECREF(function);
-		return NULL;
+
+	for (int i = 0; i < 2; i++) {
+		PyObject *old = json_functions[i];
+		json_functions[i] = functions[i];
+		Py_XDECREF(old);
 	}
-	PyObject *data_object = PyObject_CallObject(function, arglist);
+	return true;
+}
+
+PyObject *perform_json_function(enum json_function json_function, PyObject *input)
+{
+	// codec can be replaced during the call
+	PyObject *function = json_functions[json_function];
+	Py_INCREF(function);
+	PyObject *data_object = PyObject_CallFunctionObjArgs(function, input, NULL);
 	Py_DECREF(function);
-	Py_DECREF(arglist);
 
 	return data_object;  // New reference - should be decreased by the caller
 }
 
-/* ResponseHandler */
+/* native blobmsg codec */
+bool native_codec = true;
 
-typedef struct {
-	PyObject_HEAD
-	struct ubus_context *ctx;
-	struct ubus_request_data *req;
-	struct blob_buf buf;
-} ubus_ResponseHandler;
+PyObject *decode_attr(struct blob_attr *attr);
 
-static void ubus_ResponseHandler_dealloc(ubus_ResponseHandler* self)
+PyObject *decode_attrs(struct blob_attr *head, size_t len, bool table)
 {
-	blob_buf_free(&self->buf);
-	Py_TYPE(self)->tp_free((PyObject*)self);
+	PyObject *res = table ? PyDict_New() : PyList_New(0);
+	if (!res) {
+		return NULL;
+	}
+
+	struct blob_attr *cur;
+	size_t rem = len;
+	__blob_for_each_attr(cur, head, rem) {
+		if (!blobmsg_check_attr(cur, table)) {
+			PyErr_Format(PyExc_RuntimeError, MSG_JSON_FROM_UBUS_FAILED);
+			goto decode_attrs_error;
+		}
+
+		PyObject *value = decode_attr(cur);
+		if (!value) {
+			goto decode_attrs_error;
+		}
+
+		int failed;
+		if (table) {
+			PyObject *key = PyUnicode_FromString(blobmsg_name(cur));
+			if (!key) {
+				Py_DECREF(value);
+				goto decode_attrs_error;
+			}
+			failed = PyDict_SetItem(res, key, value);
+			Py_DECREF(key);
+		} else {
+			failed = PyList_Append(res, value);
+		}
+		Py_DECREF(value);
+		if (failed) {
+			goto decode_attrs_error;
+		}
+	}
+
+	return res;
+
+decode_attrs_error:
+	Py_DECREF(res);
+	return NULL;
 }
 
-PyDoc_STRVAR(
-	ResponseHandler_reply_doc,
-	"reply(data)\n"
-	"\n"
-	":param data: JSON to be send as a response to a ubus call.\n"
-	":type data: dict\n"
-);
+PyObject *decode_attr(struct blob_attr *attr)
+{
+	PyObject *res = NULL;
+
+	switch (blobmsg_type(attr)) {
+		case BLOBMSG_TYPE_UNSPEC:
+			Py_INCREF(Py_None);
+			return Py_None;
+		case BLOBMSG_TYPE_TABLE:
+		case BLOBMSG_TYPE_ARRAY:
+			if (Py_EnterRecursiveCall(" while decoding a ubus message")) {
+				return NULL;
+			}
+			res = decode_attrs(
+					blobmsg_data(attr), blobmsg_data_len(attr),
+					blobmsg_type(attr) == BLOBMSG_TYPE_TABLE);
+			Py_LeaveRecursiveCall();
+			return res;
+		case BLOBMSG_TYPE_STRING:
+			return PyUnicode_FromString(blobmsg_get_string(attr));
+		case BLOBMSG_TYPE_INT64:
+			return PyLong_FromLongLong((int64_t) blobmsg_get_u64(attr));
+		case BLOBMSG_TYPE_INT32:
+			return PyInt_FromLong((int32_t) blobmsg_get_u32(attr));
+		case BLOBMSG_TYPE_INT16:
+			return PyInt_FromLong((int16_t) blobmsg_get_u16(attr));
+		case BLOBMSG_TYPE_BOOL:
+			return prepare_bool(blobmsg_get_bool(attr));
+		case BLOBMSG_TYPE_DOUBLE:
+			return PyFloat_FromDouble(blobmsg_get_double(attr));
+		default:
+			PyErr_Format(PyExc_RuntimeError, MSG_JSON_FROM_UBUS_FAILED);
+			return NULL;
+	}
+}
 
-static PyObject *ubus_ResponseHandler_reply(ubus_ResponseHandler *self, PyObject *args, PyObject *kwargs)
+PyObject *decode_message(struct blob_attr *msg)
 {
-	if (!CONNECTED) {
-		PyErr_Format(PyExc_RuntimeError, MSG_NOT_CONNECTED);
+	if (native_codec) {
+		if (!msg) {
+			return PyDict_New();
+		}
+		return decode_attrs(blob_data(msg), blob_len(msg), true);
+	}
+
+	// format json and call python function json.loads
+	char *str = blobmsg_format_json(msg, true);
+	if (!str) {
+		PyErr_Format(PyExc_RuntimeError, MSG_JSON_FROM_UBUS_FAILED);
+		return NULL;
+	}
+	PyObject *data = PyUnicode_FromString(str);
+	free(str);
+	if (!data) {
 		return NULL;
 	}
+	PyObject *data_object = perform_json_function(LOADS, data);
+	Py_DECREF(data);
+
+	return data_object;  // New reference - should be decreased by the caller
+}
+
+/* raw blobmsg messages - passed as bytes without any conversion */
+
+PyObject *decode_raw_message(struct blob_attr *msg)
+{
+	if (!msg) {
+		// empty message
+		struct blob_attr empty = {0};
+		blob_set_raw_len(&empty, sizeof(empty));
+		return PyBytes_FromStringAndSize((char *)&empty, sizeof(empty));
+	}
+	return PyBytes_FromStringAndSize((char *)msg, blob_raw_len(msg));
+}
+
+bool check_raw_attrs(struct blob_attr *head, size_t len, bool table)
+{
+	// nested tables and arrays are forwarded as they are, so they are checked as well
+	if (Py_EnterRecursiveCall(" while checking a raw ubus message")) {
+		return false;
+	}
+
+	bool res = true;
+	struct blob_attr *cur;
+	size_t rem = len;
+	__blob_for_each_attr(cur, head, rem) {
+		if (!blobmsg_check_attr(cur, table)) {
+			res = false;
+			break;
+		}
+		int type = blobmsg_type(cur);
+		if ((type == BLOBMSG_TYPE_TABLE || type == BLOBMSG_TYPE_ARRAY)
+				&& !check_raw_attrs(blobmsg_data(cur), blobmsg_data_len(cur), type == BLOBMSG_TYPE_TABLE)) {
+			res = false;
+			break;
+		}
+	}
+	Py_LeaveRecursiveCall();
+
+	return res && rem == 0;
+}
+
+bool check_raw_message(struct blob_attr *msg, Py_ssize_t len)
+{
+	if (len < sizeof(struct blob_attr) || blob_raw_len(msg) < sizeof(struct blob_attr)
+			|| blob_raw_len(msg) > len || !check_raw_attrs(blob_data(msg), blob_len(msg), true)) {
+		if (!PyErr_Occurred()) {
+			PyErr_Format(PyExc_ValueError, "Invalid raw blobmsg message.");
+		}
+		return false;
+	}
 
+	return true;
+}
+
+/* raw message wrapper - marks serialized messages which are sent without any conversion */
+
+typedef struct {
+	PyObject_HEAD
+	PyObject *data;  // checked copy of the message (bytes)
+} ubus_RawMessage;
+
+static PyTypeObject ubus_RawMessageType;
+
+static PyObject *ubus_RawMessage_new(PyTypeObject *type, PyObject *args, PyObject *kwargs)
+{
 	PyObject *data = NULL;
-	static char *kwlist[] = {"data",  NULL};
-	if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O", kwlist, &data)) {
+	static char *kwlist[] = {"data", NULL};
+	if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O", kwlist, &data)){
 		return NULL;
 	}
 
-	// Call python function json.dumps
-	PyObject *json_str = perform_json_function(DUMPS, data);
-	if (!json_str) {
+	Py_buffer view;
+	if (PyObject_GetBuffer(data, &view, PyBUF_SIMPLE)) {
 		return NULL;
 	}
 
-	// put json string into buffer
-	blob_buf_init(&self->buf, 0);
-	bool res = blobmsg_add_json_from_string(&self->buf, PyUnicode_AsUTF8(json_str));
-	Py_DECREF(json_str);
-	if (!res) {
-		PyErr_Format(PyExc_TypeError, MSG_JSON_TO_UBUS_FAILED);
-		return NULL;
+	ubus_RawMessage *self = NULL;
+	struct blob_attr *msg = (struct blob_attr *)view.buf;
+	// the attributes are checked once here and the message is copied later as it is
+	if (!check_raw_message(msg, view.len)) {
+		goto raw_message_new_exit;
 	}
 
-	// handler is not linked to a call response
-	if (!self->req || !self->ctx) {
-		PyErr_Format(PyExc_RuntimeError, "Handler is not linked to a call response.");
-		return NULL;
+	self = (ubus_RawMessage *)type->tp_alloc(type, 0);
+	if (!self) {
+		goto raw_message_new_exit;
+	}
+	self->data = PyBytes_FromStringAndSize((char *)msg, blob_raw_len(msg));
+	if (!self->data) {
+		Py_CLEAR(self);
 	}
 
-	int retval = ubus_send_reply(self->ctx, self->req, self->buf.head);
-	return prepare_bool(!retval);
+raw_message_new_exit:
+	PyBuffer_Release(&view);
+	return (PyObject *)self;
+}
+
+static void ubus_RawMessage_dealloc(ubus_RawMessage *self)
+{
+	Py_XDECREF(self->data);
+	Py_TYPE(self)->tp_free((PyObject *)self);
+}
+
+static PyObject *ubus_RawMessage_get_data(ubus_RawMessage *self, void *closure)
+{
+	Py_INCREF(self->data);
+	return self->data;
 }
 
 PyDoc_STRVAR(
-	ResponseHandler_doc,
-	"__ResponseHandler\n"
+	RawMessage_doc,
+	"RawMessage(data)\n"
 	"\n"
-	"Object which is used to handle responses to ubus calls.\n"
+	"Serialized blobmsg message which is sent without any conversion.\n"
+	"\n"
+	":param data: serialized message (bytes or any other buffer) \n"
+	":type data: bytes\n"
+	"\n"
+	"The message is checked and copied when the object is created.\n"
+	"ValueError is raised when it is not a valid blobmsg message.\n"
 );
 
-static PyMethodDef ubus_ResponseHandler_methods[] = {
-	{"reply", (PyCFunction)ubus_ResponseHandler_reply, METH_VARARGS|METH_KEYWORDS, ResponseHandler_reply_doc},
+static PyGetSetDef ubus_RawMessage_getset[] = {
+	{"data", (getter)ubus_RawMessage_get_data, NULL, "serialized message (bytes)", NULL},
 	{NULL},
 };
 
-static int ubus_ResponseHandler_init(ubus_ResponseHandler *self, PyObject *args, PyObject *kwargs)
-{
-	static char *kwlist[] = {NULL};
-	if (!PyArg_ParseTupleAndKeywords(args, kwargs, "", kwlist)){
-		return -1;
-	}
-	memset(&self->buf, 0, sizeof(self->buf));
-	self->ctx = NULL;
-	self->req = NULL;
-	return 0;
-}
-
-static PyObject *ubus_ResponseHandler_new(PyTypeObject *type, PyObject *args, PyObject *kwargs)
-{
-	ubus_ResponseHandler *self = (ubus_ResponseHandler *)type->tp_alloc(type, 0);
-	return (PyObject *)self;
-}
-
-static PyTypeObject ubus_ResponseHandlerType = {
+static PyTypeObject ubus_RawMessageType = {
 	PyVarObject_HEAD_INIT(NULL, 0)
-	RESPONSE_HANDLER_OBJECT_NAME,				/* tp_name */
-	sizeof(ubus_ResponseHandler),				/* tp_basicsize */
+	RAW_MESSAGE_OBJECT_NAME,					/* tp_name */
+	sizeof(ubus_RawMessage),					/* tp_basicsize */
 	0,											/* tp_itemsize */
-	(destructor)ubus_ResponseHandler_dealloc,	/* tp_dealloc */
+	(destructor)ubus_RawMessage_dealloc,		/* tp_dealloc */
 	0,											/* tp_print */
 	0,											/* tp_getattr */
 	0,											/* tp_setattr */
@@ -235,384 +592,2598 @@ static PyTypeObject ubus_ResponseHandlerType = {
 	0,											/* tp_getattro */
 	0,											/* tp_setattro */
 	0,											/* tp_as_buffer */
-	Py_TPFLAGS_DEFAULT | Py_TPFLAGS_BASETYPE,	/* tp_flags */
-	ResponseHandler_doc,						/* tp_doc */
+	Py_TPFLAGS_DEFAULT,							/* tp_flags */
+	RawMessage_doc,								/* tp_doc */
 	0,											/* tp_traverse */
 	0,											/* tp_clear */
 	0,											/* tp_richcompare */
 	0,											/* tp_weaklistoffset */
 	0,											/* tp_iter */
 	0,											/* tp_iternext */
-	ubus_ResponseHandler_methods,				/* tp_methods */
+	0,											/* tp_methods */
 	0,											/* tp_members */
-	0,											/* tp_getset */
+	ubus_RawMessage_getset,						/* tp_getset */
 	0,											/* tp_base */
 	0,											/* tp_dict */
 	0,											/* tp_descr_get */
 	0,											/* tp_descr_set */
 	0,											/* tp_dictoffset */
-	(initproc)ubus_ResponseHandler_init,		/* tp_init */
+	0,											/* tp_init */
 	0,											/* tp_alloc */
-	ubus_ResponseHandler_new,					/* tp_new */
+	ubus_RawMessage_new,						/* tp_new */
 };
 
+bool encode_raw(struct blob_buf *buf, ubus_RawMessage *raw)
+{
+	// the message was checked when the wrapper was created
+	struct blob_attr *msg = (struct blob_attr *)PyBytes_AS_STRING(raw->data);
+	if (blob_len(msg) > 0 && !blob_put_raw(buf, blob_data(msg), blob_len(msg))) {
+		PyErr_Format(PyExc_MemoryError, MSG_ALLOCATION_FAILS);
+		return false;
+	}
+	return true;
+}
+
+/* lazy message view - fields are decoded when they are accessed */
+
 typedef struct {
 	PyObject_HEAD
-	PyObject *socket_path;
-	ubus_Listener **listeners;
-	size_t listerners_size;
-	ubus_Object **objects;
-	size_t objects_size;
-	PyObject *alloc_list;  // Used for easy deallocation
-	struct blob_buf buf;
-	struct ubus_context *ctx;
-} ubus_Connection;
+	PyObject *owner;  // bytes which contain the copied message
+	struct blob_attr *head;  // first attribute of the table or array
+	size_t len;
+	bool table;
+	Py_ssize_t size;  // -1 until counted
+} ubus_MessageView;
 
-void free_ubus_object(ubus_Object *obj)
+static PyTypeObject ubus_MessageViewType;
+
+PyObject *create_message_view(PyObject *owner, struct blob_attr *head, size_t len, bool table)
 {
-	if (obj->object.methods) {
-		for (int i = 0; i < obj->object.n_methods; i++) {
-			if (&obj->object.methods[i] && obj->object.methods[i].policy) {
-				free((struct blobmsg_policy *)obj->object.methods[i].policy);
-			}
-		}
-		free((struct ubus_method *)obj->object.methods);
+	ubus_MessageView *view = PyObject_New(ubus_MessageView, &ubus_MessageViewType);
+	if (!view) {
+		return NULL;
 	}
+	Py_INCREF(owner);
+	view->owner = owner;
+	view->head = head;
+	view->len = len;
+	view->table = table;
+	view->size = -1;
+	return (PyObject *)view;
+}
 
-	if (obj->object.type) {
-		free(obj->object.type);
+PyObject *decode_lazy_message(struct blob_attr *msg)
+{
+	// the message is copied once and all the nested views point into the copy
+	PyObject *owner = PyBytes_FromStringAndSize((char *)msg, msg ? blob_raw_len(msg) : 0);
+	if (!owner) {
+		return NULL;
 	}
-	free(obj);
+	struct blob_attr *attr = (struct blob_attr *)PyBytes_AS_STRING(owner);
+	PyObject *view = create_message_view(owner, msg ? blob_data(attr) : NULL, msg ? blob_len(attr) : 0, true);
+	Py_DECREF(owner);
+	return view;
 }
 
-
-#if PY_MAJOR_VERSION >= 3
-static struct PyModuleDef moduledef = {
-        PyModuleDef_HEAD_INIT,
-        "ubus",
-        NULL,
-        sizeof(struct module_state),
-        ubus_methods,
-        NULL,
-        NULL,
-        NULL,
-        NULL
-};
-#endif
-
-PyObject *ubus_python_module_init(void)
+PyObject *decode_view_attr(ubus_MessageView *view, struct blob_attr *attr)
 {
-#if PY_MAJOR_VERSION >= 3
-	PyObject *module = PyModule_Create(&moduledef);
-#else
-	PyObject *module = Py_InitModule3("ubus", ubus_methods, "Ubus bindings");
-#endif
-	return module;
+	if (!blobmsg_check_attr(attr, view->table)) {
+		PyErr_Format(PyExc_RuntimeError, MSG_JSON_FROM_UBUS_FAILED);
+		return NULL;
+	}
+	switch (blobmsg_type(attr)) {
+		case BLOBMSG_TYPE_TABLE:
+		case BLOBMSG_TYPE_ARRAY:
+			return create_message_view(view->owner, blobmsg_data(attr), blobmsg_data_len(attr),
+					blobmsg_type(attr) == BLOBMSG_TYPE_TABLE);
+		default:
+			return decode_attr(attr);
+	}
 }
 
-PyDoc_STRVAR(
-	disconnect_doc,
-	"disconnect(deregister=True)\n"
-	"\n"
-	":param deregister: Deregisters object and handlers from ubus as well.\n"
-	":type deregister: bool\n"
-	"Disconnects from ubus and disposes all connection structures.\n"
-);
+static void ubus_MessageView_dealloc(ubus_MessageView *self)
+{
+	Py_XDECREF(self->owner);
+	PyObject_Del(self);
+}
 
-void dispose_connection(bool deregister)
+static Py_ssize_t ubus_MessageView_length(ubus_MessageView *self)
 {
-	if (ctx != NULL) {
-		if (deregister) {
-			// remove objects
-			for (int i = 0; i < objects_size; i++) {
-				ubus_remove_object(ctx, &objects[i]->object);
-			}
+	if (self->size < 0) {
+		struct blob_attr *cur;
+		size_t rem = self->len;
+		self->size = 0;
+		__blob_for_each_attr(cur, self->head, rem) {
+			self->size++;
+		}
+	}
+	return self->size;
+}
 
-			// remove listeners
-			for (int i = 0; i < listerners_size; i++) {
-				ubus_unregister_event_handler(ctx, &listeners[i]->handler);
+struct blob_attr *find_view_attr(ubus_MessageView *self, PyObject *key)
+{
+	struct blob_attr *cur;
+	size_t rem = self->len;
+
+	if (self->table) {
+		if (!PyStr_Check(key)) {
+			return NULL;
+		}
+		const char *name = PyUnicode_AsUTF8(key);
+		if (!name) {
+			PyErr_Clear();
+			return NULL;
+		}
+		__blob_for_each_attr(cur, self->head, rem) {
+			if (blobmsg_check_attr(cur, true) && !strcmp(blobmsg_name(cur), name)) {
+				return cur;
 			}
 		}
+		return NULL;
+	}
 
-		ubus_free(ctx);
-		ctx = NULL;
+	if (!PyIndex_Check(key)) {
+		return NULL;
 	}
-	uloop_done();
-	blob_buf_free(&python_buf);
-	if (python_alloc_list) {
-		Py_DECREF(python_alloc_list);
-		python_alloc_list = NULL;
+	Py_ssize_t idx = PyNumber_AsSsize_t(key, PyExc_IndexError);
+	if (idx == -1 && PyErr_Occurred()) {
+		PyErr_Clear();
+		return NULL;
 	}
-	// clear event listeners
-	if (listeners) {
-		for (int i = 0; i < listerners_size; i++) {
-			free(listeners[i]);
-		}
-		free(listeners);
-		listerners_size = 0;
-		listeners = NULL;
+	if (idx < 0) {
+		idx += ubus_MessageView_length(self);
 	}
-	// clear objects
-	if (objects) {
-		for (int i = 0; i < objects_size; i++) {
-			free_ubus_object(objects[i]);
+	__blob_for_each_attr(cur, self->head, rem) {
+		if (idx-- == 0) {
+			return cur;
 		}
-		free(objects);
-		objects_size = 0;
-		objects = NULL;
-	}
-
-	if (socket_path) {
-		free(socket_path);
-		socket_path = NULL;
 	}
+	return NULL;
 }
 
-static PyObject *ubus_python_disconnect(PyObject *module, PyObject *args, PyObject *kwargs)
+static PyObject *ubus_MessageView_subscript(ubus_MessageView *self, PyObject *key)
 {
-	if (!CONNECTED) {
-		PyErr_Format(PyExc_RuntimeError, MSG_NOT_CONNECTED);
-		return NULL;
-	}
-
-	PyObject* deregister = Py_True;
-	static char *kwlist[] = {"deregister", NULL};
-	if (!PyArg_ParseTupleAndKeywords(args, kwargs, "|O!", kwlist, &PyBool_Type, &deregister)){
+	struct blob_attr *attr = find_view_attr(self, key);
+	if (!attr) {
+		if (self->table) {
+			PyErr_SetObject(PyExc_KeyError, key);
+		} else {
+			PyErr_Format(PyExc_IndexError, "index out of range");
+		}
 		return NULL;
 	}
-
-	dispose_connection(PyObject_IsTrue(deregister));
-
-	Py_INCREF(Py_None);
-	return Py_None;
+	return decode_view_attr(self, attr);
 }
 
-PyDoc_STRVAR(
-	connect_doc,
-	"connect(socket_path='" DEFAULT_SOCKET "')\n"
-	"\n"
-	"Establishes a connection to ubus.\n"
-);
-
-static PyObject *ubus_python_connect(PyObject *module, PyObject *args, PyObject *kwargs)
+static int ubus_MessageView_contains(ubus_MessageView *self, PyObject *key)
 {
-	if (CONNECTED) {
-		PyErr_Format(PyExc_RuntimeError, MSG_ALREADY_CONNECTED);
-		return NULL;
+	if (self->table) {
+		return find_view_attr(self, key) != NULL;
 	}
 
-	static char *kwlist[] = {"socket_path", NULL};
-	if (!PyArg_ParseTupleAndKeywords(args, kwargs, "|s", kwlist, &socket_path)){
-		return NULL;
+	// arrays contain values
+	struct blob_attr *cur;
+	size_t rem = self->len;
+	__blob_for_each_attr(cur, self->head, rem) {
+		PyObject *value = decode_view_attr(self, cur);
+		if (!value) {
+			return -1;
+		}
+		int res = PyObject_RichCompareBool(value, key, Py_EQ);
+		Py_DECREF(value);
+		if (res != 0) {
+			return res;
+		}
 	}
+	return 0;
+}
+
+enum view_items {
+	VIEW_KEYS,
+	VIEW_VALUES,
+	VIEW_ITEMS,
+};
 
-	// Init object list
-	python_alloc_list = PyList_New(0);
-	if (!python_alloc_list) {
+PyObject *list_view_items(ubus_MessageView *self, enum view_items items)
+{
+	PyObject *res = PyList_New(0);
+	if (!res) {
 		return NULL;
 	}
 
-	// socket path
-	if (!socket_path) {
-		socket_path = strdup(DEFAULT_SOCKET);
-		if (!socket_path) {
-			PyErr_Format(PyExc_MemoryError, MSG_ALLOCATION_FAILS);
-			return NULL;
+	struct blob_attr *cur;
+	size_t rem = self->len;
+	__blob_for_each_attr(cur, self->head, rem) {
+		PyObject *item = NULL;
+		if (items == VIEW_KEYS) {
+			if (!blobmsg_check_attr(cur, true)) {
+				PyErr_Format(PyExc_RuntimeError, MSG_JSON_FROM_UBUS_FAILED);
+			} else {
+				item = PyUnicode_FromString(blobmsg_name(cur));
+			}
+		} else if (items == VIEW_VALUES) {
+			item = decode_view_attr(self, cur);
+		} else {
+			PyObject *value = decode_view_attr(self, cur);
+			if (value) {
+				item = Py_BuildValue("(sN)", blobmsg_name(cur), value);
+			}
 		}
-	} else {
-		char *tmp = strdup(socket_path);
-		if (!tmp) {
-			PyErr_Format(PyExc_MemoryError, MSG_ALLOCATION_FAILS);
+		if (!item || PyList_Append(res, item)) {
+			Py_XDECREF(item);
+			Py_DECREF(res);
 			return NULL;
 		}
-		socket_path = tmp;
+		Py_DECREF(item);
 	}
 
-	// Init event listner array
-	listeners = NULL;
-	listerners_size = 0;
-
-	// Init objects array
-	objects = NULL;
-	objects_size = 0;
+	return res;
+}
 
-	// Connect to ubus
-	ctx = ubus_connect(socket_path);
-	if (!ctx) {
-		PyErr_Format(
-				PyExc_IOError,
-				"Failed to connect to the ubus socket '%s'\n", socket_path
-		);
-		dispose_connection(true);
+static PyObject *ubus_MessageView_iter(ubus_MessageView *self)
+{
+	// tables are iterated by keys (like dict) and arrays by values (like list)
+	PyObject *items = list_view_items(self, self->table ? VIEW_KEYS : VIEW_VALUES);
+	if (!items) {
 		return NULL;
 	}
-	ubus_add_uloop(ctx);
-	memset(&python_buf, 0, sizeof(python_buf));
-
-	return prepare_bool(true);
+	PyObject *iter = PyObject_GetIter(items);
+	Py_DECREF(items);
+	return iter;
 }
 
 PyDoc_STRVAR(
-	get_connected_doc,
-	"get_connected()\n"
+	MessageView_to_dict_doc,
+	"to_dict()\n"
 	"\n"
-	"Determines whether we are connected to ubus.\n"
-	":return: True if connected, False otherwise.\n"
-	":rtype: bool \n"
-);
-
-static PyObject *ubus_python_get_connected(PyObject *module, PyObject *args, PyObject *kwargs)
-{
-	return prepare_bool(CONNECTED);
-}
-
-PyDoc_STRVAR(
-	get_socket_path_doc,
-	"get_socket_path()\n"
+	"Decodes the whole message.\n"
 	"\n"
-	"Gets socket path for the current connection.\n"
-	":return: path to socket if connected, None otherwise.\n"
-	":rtype: bool or str \n"
+	":return: dict for tables, list for arrays \n"
+	":rtype: dict or list\n"
 );
 
-static PyObject *ubus_python_get_socket_path(PyObject *module, PyObject *args, PyObject *kwargs)
+static PyObject *ubus_MessageView_to_dict(ubus_MessageView *self, PyObject *args)
 {
-	if (socket_path) {
-		return PyUnicode_FromString(socket_path);
-	} else {
-		Py_INCREF(Py_None);
-		return Py_None;
-	}
+	return decode_attrs(self->head, self->len, self->table);
 }
 
 PyDoc_STRVAR(
-	connect_send_doc,
-	"send(event, data)\n"
-	"\n"
-	"Send an event via ubus.\n"
+	MessageView_get_doc,
+	"get(key, default=None)\n"
 	"\n"
-	":param event: ubus event which will be used \n"
-	":type event: str\n"
-	":param data: python object which can be serialized to json \n"
-	":type data: dict or list \n"
-	":return: True on success, False otherwise \n"
-	":rtype: bool \n"
+	"Decodes a single field of the message.\n"
 );
 
-static PyObject *ubus_python_send(PyObject *module, PyObject *args, PyObject *kwargs)
+static PyObject *ubus_MessageView_get(ubus_MessageView *self, PyObject *args)
 {
-	if (!CONNECTED) {
-		PyErr_Format(PyExc_RuntimeError, MSG_NOT_CONNECTED);
-		return NULL;
-	}
-
-	char *event = NULL;
-	PyObject *data = NULL;
-	static char *kwlist[] = {"event", "data",  NULL};
-	if (!PyArg_ParseTupleAndKeywords(args, kwargs, "sO", kwlist, &event, &data)){
+	PyObject *key = NULL, *default_value = Py_None;
+	if (!PyArg_ParseTuple(args, "O|O", &key, &default_value)) {
 		return NULL;
 	}
 
-	// Call python function json.dumps
-	PyObject *json_str = perform_json_function(DUMPS, data);
-	if (!json_str) {
-		return NULL;
+	struct blob_attr *attr = find_view_attr(self, key);
+	if (!attr) {
+		Py_INCREF(default_value);
+		return default_value;
 	}
+	return decode_view_attr(self, attr);
+}
 
-	// put json string into buffer
-	blob_buf_init(&python_buf, 0);
-	bool res = blobmsg_add_json_from_string(&python_buf, PyUnicode_AsUTF8(json_str));
-	Py_DECREF(json_str);
-	if (!res) {
-		PyErr_Format(PyExc_TypeError, MSG_JSON_TO_UBUS_FAILED);
-		return NULL;
-	}
+static PyObject *ubus_MessageView_keys(ubus_MessageView *self, PyObject *args)
+{
+	return list_view_items(self, VIEW_KEYS);
+}
 
-	int retval = ubus_send_event(ctx, event, python_buf.head);
-	return prepare_bool(!retval);
+static PyObject *ubus_MessageView_values(ubus_MessageView *self, PyObject *args)
+{
+	return list_view_items(self, VIEW_VALUES);
 }
 
-static void ubus_python_event_handler(struct ubus_context *ctx, struct ubus_event_handler *ev,
-			const char *type, struct blob_attr *msg)
+static PyObject *ubus_MessageView_items(ubus_MessageView *self, PyObject *args)
 {
-	PyGILState_STATE gstate = PyGILState_Ensure();
+	return list_view_items(self, VIEW_ITEMS);
+}
 
-	// Prepare event
-	PyObject *event = PyUnicode_FromString(type);
-	if (!event) {
-		goto event_handler_cleanup0;
+static PyObject *ubus_MessageView_richcompare(ubus_MessageView *self, PyObject *other, int op)
+{
+	if (op != Py_EQ && op != Py_NE) {
+		Py_INCREF(Py_NotImplemented);
+		return Py_NotImplemented;
 	}
 
-	// Prepare json data
-	char *str = blobmsg_format_json(msg, true);
-	if (!str) {
-		goto event_handler_cleanup1;
-	}
-	PyObject *data = PyUnicode_FromString(str);
-	free(str);
-	if (!data) {
-		goto event_handler_cleanup1;
+	PyObject *decoded = ubus_MessageView_to_dict(self, NULL);
+	if (!decoded) {
+		return NULL;
 	}
-
-	// Call python function json.loads
-	PyObject *data_object = perform_json_function(LOADS, data);
-	if (!data_object) {
-		goto event_handler_cleanup2;
+	if (PyObject_TypeCheck(other, &ubus_MessageViewType)) {
+		other = ubus_MessageView_to_dict((ubus_MessageView *)other, NULL);
+	} else {
+		Py_INCREF(other);
 	}
-	
-	// Get PyObject callback
-	ubus_Listener *listener = container_of(ev, ubus_Listener, handler);
-
-	// Trigger callback
-	PyObject *callback_arglist = Py_BuildValue("(O, O)", event, data_object);
-	if (!callback_arglist) {
-		goto event_handler_cleanup3;
+	if (!other) {
+		Py_DECREF(decoded);
+		return NULL;
 	}
+	PyObject *res = PyObject_RichCompare(decoded, other, op);
+	Py_DECREF(decoded);
+	Py_DECREF(other);
+	return res;
+}
 
-	PyObject *result = PyObject_CallObject(listener->callback, callback_arglist);
-	if (result) {
-		Py_DECREF(result);  // result of the callback is quite useless
-	} else {
-		PyErr_Print();
+static PyObject *ubus_MessageView_repr(ubus_MessageView *self)
+{
+	PyObject *decoded = ubus_MessageView_to_dict(self, NULL);
+	if (!decoded) {
+		return NULL;
 	}
-	Py_DECREF(callback_arglist);
+	PyObject *res = PyObject_Repr(decoded);
+	Py_DECREF(decoded);
+	return res;
+}
 
-event_handler_cleanup3:
-	Py_DECREF(data_object);
-event_handler_cleanup2:
-	Py_DECREF(data);
-event_handler_cleanup1:
-	Py_DECREF(event);
+static PyMappingMethods ubus_MessageView_as_mapping = {
+	(lenfunc)ubus_MessageView_length,			/* mp_length */
+	(binaryfunc)ubus_MessageView_subscript,		/* mp_subscript */
+	0,											/* mp_ass_subscript */
+};
 
-event_handler_cleanup0:
-	// Clear python exceptions
-	PyErr_Clear();
+static PySequenceMethods ubus_MessageView_as_sequence = {
+	0,											/* sq_length */
+	0,											/* sq_concat */
+	0,											/* sq_repeat */
+	0,											/* sq_item */
+	0,											/* sq_slice */
+	0,											/* sq_ass_item */
+	0,											/* sq_ass_slice */
+	(objobjproc)ubus_MessageView_contains,		/* sq_contains */
+};
 
-	PyGILState_Release(gstate);
-}
+static PyMethodDef ubus_MessageView_methods[] = {
+	{"to_dict", (PyCFunction)ubus_MessageView_to_dict, METH_NOARGS, MessageView_to_dict_doc},
+	{"get", (PyCFunction)ubus_MessageView_get, METH_VARARGS, MessageView_get_doc},
+	{"keys", (PyCFunction)ubus_MessageView_keys, METH_NOARGS, NULL},
+	{"values", (PyCFunction)ubus_MessageView_values, METH_NOARGS, NULL},
+	{"items", (PyCFunction)ubus_MessageView_items, METH_NOARGS, NULL},
+	{NULL},
+};
 
 PyDoc_STRVAR(
-	connect_listen_doc,
-	"listen(event, ...)\n"
-	"\n"
-	"Adds a listener on ubus events.\n"
-	"\n"
-	":param event: tuple contaning event string and a callback (str, callable) \n"
-	":type event: tuple\n"
+	MessageView_doc,
+	"Read-only view of a received message (table or array).\n"
+	"Fields are decoded only when they are accessed.\n"
 );
 
-static PyObject *ubus_python_listen(PyObject *module, PyObject *args, PyObject *kwargs)
+static PyTypeObject ubus_MessageViewType = {
+	PyVarObject_HEAD_INIT(NULL, 0)
+	MESSAGE_VIEW_OBJECT_NAME,					/* tp_name */
+	sizeof(ubus_MessageView),					/* tp_basicsize */
+	0,											/* tp_itemsize */
+	(destructor)ubus_MessageView_dealloc,		/* tp_dealloc */
+	0,											/* tp_print */
+	0,											/* tp_getattr */
+	0,											/* tp_setattr */
+	0,											/* tp_compare */
+	(reprfunc)ubus_MessageView_repr,			/* tp_repr */
+	0,											/* tp_as_number */
+	&ubus_MessageView_as_sequence,				/* tp_as_sequence */
+	&ubus_MessageView_as_mapping,				/* tp_as_mapping */
+	0,											/* tp_hash */
+	0,											/* tp_call */
+	0,											/* tp_str */
+	0,											/* tp_getattro */
+	0,											/* tp_setattro */
+	0,											/* tp_as_buffer */
+	Py_TPFLAGS_DEFAULT,							/* tp_flags */
+	MessageView_doc,							/* tp_doc */
+	0,											/* tp_traverse */
+	0,											/* tp_clear */
+	(richcmpfunc)ubus_MessageView_richcompare,	/* tp_richcompare */
+	0,											/* tp_weaklistoffset */
+	(getiterfunc)ubus_MessageView_iter,			/* tp_iter */
+	0,											/* tp_iternext */
+	ubus_MessageView_methods,					/* tp_methods */
+	0,											/* tp_members */
+	0,											/* tp_getset */
+	0,											/* tp_base */
+	0,											/* tp_dict */
+	0,											/* tp_descr_get */
+	0,											/* tp_descr_set */
+	0,											/* tp_dictoffset */
+	0,											/* tp_init */
+	0,											/* tp_alloc */
+	0,											/* tp_new */
+};
+
+/* received messages can be passed as python objects, raw bytes or lazy views */
+
+PyObject *decode_message_format(struct blob_attr *msg, enum message_format format)
 {
-	if (!CONNECTED) {
-		PyErr_Format(PyExc_RuntimeError, MSG_NOT_CONNECTED);
-		return NULL;
+	switch (format) {
+		case FORMAT_RAW:
+			return decode_raw_message(msg);
+		case FORMAT_LAZY:
+			return decode_lazy_message(msg);
+		default:
+			return decode_message(msg);
 	}
+}
 
-	args = PySequence_Fast(args, "expected a sequence");
-	int len = PySequence_Size(args);
-	if (!len) {
-		PyErr_Format(PyExc_TypeError, "You need to set at least one event.");
-		goto listen_error1;
+bool parse_message_format(PyObject *raw, PyObject *lazy, enum message_format *format)
+{
+	if (raw == Py_True && lazy == Py_True) {
+		PyErr_Format(PyExc_TypeError, "raw and lazy can't be combined.");
+		return false;
+	}
+	*format = raw == Py_True ? FORMAT_RAW : (lazy == Py_True ? FORMAT_LAZY : FORMAT_DECODED);
+	return true;
+}
+
+bool encode_object(struct blob_buf *buf, const char *name, PyObject *obj);
+
+bool encode_items(struct blob_buf *buf, PyObject *dict)
+{
+	PyObject *key = NULL, *value = NULL;
+	Py_ssize_t pos = 0;
+	while (PyDict_Next(dict, &pos, &key, &value)) {
+		if (!PyStr_Check(key)) {
+			PyErr_Format(PyExc_TypeError, "Keys must be strings.");
+			return false;
+		}
+		const char *name = PyUnicode_AsUTF8(key);
+		if (!name || !encode_object(buf, name, value)) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+bool encode_sequence(struct blob_buf *buf, PyObject *sequence)
+{
+	PyObject *fast = PySequence_Fast(sequence, "expected a sequence");
+	if (!fast) {
+		return false;
+	}
+
+	Py_ssize_t len = PySequence_Fast_GET_SIZE(fast);
+	for (Py_ssize_t i = 0; i < len; i++) {
+		if (!encode_object(buf, NULL, PySequence_Fast_GET_ITEM(fast, i))) {
+			Py_DECREF(fast);
+			return false;
+		}
+	}
+	Py_DECREF(fast);
+
+	return true;
+}
+
+bool encode_object(struct blob_buf *buf, const char *name, PyObject *obj)
+{
+	int res = 0;
+
+	if (obj == Py_None) {
+		res = blobmsg_add_field(buf, BLOBMSG_TYPE_UNSPEC, name, NULL, 0);
+
+	} else if (PyBool_Check(obj)) {
+		res = blobmsg_add_u8(buf, name, obj == Py_True);
+
+	} else if (PyInt_Check(obj) || PyLong_Check(obj)) {
+		int overflow = 0;
+		long long value = PyLong_AsLongLongAndOverflow(obj, &overflow);
+		if (value == -1 && !overflow && PyErr_Occurred()) {
+			return false;
+		}
+		// clamped to int32 the same way as by the json codec
+		if (overflow > 0 || value > INT32_MAX) {
+			value = INT32_MAX;
+		} else if (overflow < 0 || value < INT32_MIN) {
+			value = INT32_MIN;
+		}
+		res = blobmsg_add_u32(buf, name, (uint32_t) value);
+
+	} else if (PyFloat_Check(obj)) {
+		res = blobmsg_add_double(buf, name, PyFloat_AsDouble(obj));
+
+	} else if (PyStr_Check(obj)) {
+		const char *str = PyUnicode_AsUTF8(obj);
+		if (!str) {
+			return false;
+		}
+		res = blobmsg_add_string(buf, name, str);
+
+	} else if (PyDict_Check(obj) || PyList_Check(obj) || PyTuple_Check(obj)) {
+		bool table = PyDict_Check(obj);
+		void *cookie = blobmsg_open_nested(buf, name, !table);
+		if (!cookie) {
+			PyErr_Format(PyExc_MemoryError, MSG_ALLOCATION_FAILS);
+			return false;
+		}
+		if (Py_EnterRecursiveCall(" while encoding a ubus message")) {
+			return false;
+		}
+		bool passed = table ? encode_items(buf, obj) : encode_sequence(buf, obj);
+		Py_LeaveRecursiveCall();
+		if (!passed) {
+			return false;
+		}
+		blob_nest_end(buf, cookie);
+
+	} else {
+		PyErr_Format(
+				PyExc_TypeError,
+				"Object of type '%s' can't be sent to ubus.", Py_TYPE(obj)->tp_name
+		);
+		return false;
+	}
+
+	if (res) {
+		PyErr_Format(PyExc_MemoryError, MSG_ALLOCATION_FAILS);
+		return false;
+	}
+
+	return true;
+}
+
+bool encode_data(struct blob_buf *buf, PyObject *data)
+{
+	if (PyObject_TypeCheck(data, &ubus_RawMessageType)) {
+		// already encoded message - buffers are sent as they are only when they are wrapped
+		return encode_raw(buf, (ubus_RawMessage *)data);
+	}
+
+	if (PyObject_TypeCheck(data, &ubus_MessageViewType) && ((ubus_MessageView *)data)->table) {
+		// received message can be forwarded without decoding
+		ubus_MessageView *view = (ubus_MessageView *)data;
+		if (view->len > 0 && !blob_put_raw(buf, view->head, view->len)) {
+			PyErr_Format(PyExc_MemoryError, MSG_ALLOCATION_FAILS);
+			return false;
+		}
+		return true;
+	}
+
+	if (native_codec) {
+		if (!PyDict_Check(data)) {
+			PyErr_Format(PyExc_TypeError, MSG_JSON_TO_UBUS_FAILED);
+			return false;
+		}
+		return encode_items(buf, data);
+	}
+
+	// Call python function json.dumps
+	PyObject *json_str = perform_json_function(DUMPS, data);
+	if (!json_str) {
+		return false;
+	}
+
+	// put json string into buffer (some libraries produce bytes instead of str)
+	const char *json_data = PyBytes_Check(json_str) ? PyBytes_AS_STRING(json_str) : PyUnicode_AsUTF8(json_str);
+	if (!json_data) {
+		Py_DECREF(json_str);
+		return false;
+	}
+	bool res = blobmsg_add_json_from_string(buf, json_data);
+	Py_DECREF(json_str);
+	if (!res) {
+		PyErr_Format(PyExc_TypeError, MSG_JSON_TO_UBUS_FAILED);
+		return false;
+	}
+
+	return true;
+}
+
+bool encode_message(struct blob_buf *buf, PyObject *data)
+{
+	blob_buf_init(buf, 0);
+	return encode_data(buf, data);
+}
+
+bool encode_event(struct blob_buf *buf, const char *event, PyObject *data)
+{
+	// the same message as ubus_send_event() sends to the event object
+	blob_buf_init(buf, 0);
+	if (blobmsg_add_string(buf, "id", event)) {
+		PyErr_Format(PyExc_MemoryError, MSG_ALLOCATION_FAILS);
+		return false;
+	}
+	void *cookie = blobmsg_open_table(buf, "data");
+	if (!cookie) {
+		PyErr_Format(PyExc_MemoryError, MSG_ALLOCATION_FAILS);
+		return false;
+	}
+	if (!encode_data(buf, data)) {
+		return false;
+	}
+	blobmsg_close_table(buf, cookie);
+
+	return true;
+}
+
+/* statistics - counters of served methods, outgoing calls and listener callbacks */
+
+static inline uint64_t stats_now(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+void stats_record_latency(struct latency_histogram *histogram, uint64_t elapsed_ns)
+{
+	// bucket N holds latencies lower than 2^N us
+	uint64_t us = elapsed_ns / 1000;
+	int bucket = us ? 64 - __builtin_clzll(us) : 0;
+	if (bucket >= STATS_BUCKETS) {
+		bucket = STATS_BUCKETS - 1;
+	}
+	histogram->buckets[bucket]++;
+	histogram->count++;
+	histogram->total_ns += elapsed_ns;
+}
+
+void stats_record_status(struct stats *stats, int status)
+{
+	if (status == UBUS_STATUS_OK) {
+		return;
+	}
+	if (status < 0 || status >= __UBUS_STATUS_LAST) {
+		status = UBUS_STATUS_UNKNOWN_ERROR;
+	}
+	stats->errors[status]++;
+}
+
+static void merge_histogram(struct latency_histogram *dst, const struct latency_histogram *src)
+{
+	dst->count += src->count;
+	dst->total_ns += src->total_ns;
+	for (int i = 0; i < STATS_BUCKETS; i++) {
+		dst->buckets[i] += src->buckets[i];
+	}
+}
+
+void stats_merge(struct stats *dst, const struct stats *src)
+{
+	dst->invocations += src->invocations;
+	for (int i = 0; i < __UBUS_STATUS_LAST; i++) {
+		dst->errors[i] += src->errors[i];
+	}
+	dst->bytes_in += src->bytes_in;
+	dst->bytes_out += src->bytes_out;
+	merge_histogram(&dst->decode, &src->decode);
+	merge_histogram(&dst->callback, &src->callback);
+	merge_histogram(&dst->reply, &src->reply);
+}
+
+PyObject *histogram_to_dict(const struct latency_histogram *histogram)
+{
+	PyObject *buckets = PyList_New(STATS_BUCKETS);
+	if (!buckets) {
+		return NULL;
+	}
+	for (int i = 0; i < STATS_BUCKETS; i++) {
+		PyObject *count = PyLong_FromUnsignedLongLong(histogram->buckets[i]);
+		if (!count) {
+			Py_DECREF(buckets);
+			return NULL;
+		}
+		PyList_SET_ITEM(buckets, i, count);
+	}
+
+	return Py_BuildValue("{s:K,s:d,s:N}",
+			"count", (unsigned long long)histogram->count,
+			"total_us", histogram->total_ns / 1000.0,
+			"buckets", buckets);
+}
+
+PyObject *stats_to_dict(const struct stats *stats)
+{
+	PyObject *errors = PyDict_New();
+	if (!errors) {
+		return NULL;
+	}
+	for (int i = 0; i < __UBUS_STATUS_LAST; i++) {
+		if (!stats->errors[i]) {
+			continue;
+		}
+		PyObject *count = PyLong_FromUnsignedLongLong(stats->errors[i]);
+		if (!count || PyDict_SetItemString(errors, ubus_strerror(i), count)) {
+			Py_XDECREF(count);
+			Py_DECREF(errors);
+			return NULL;
+		}
+		Py_DECREF(count);
+	}
+
+	return Py_BuildValue("{s:K,s:N,s:K,s:K,s:N,s:N,s:N}",
+			"invocations", (unsigned long long)stats->invocations,
+			"errors", errors,
+			"bytes_in", (unsigned long long)stats->bytes_in,
+			"bytes_out", (unsigned long long)stats->bytes_out,
+			"decode", histogram_to_dict(&stats->decode),
+			"callback", histogram_to_dict(&stats->callback),
+			"reply", histogram_to_dict(&stats->reply));
+}
+
+static void free_stats_capsule(PyObject *capsule)
+{
+	free(PyCapsule_GetPointer(capsule, NULL));
+}
+
+/*
+ * Returns the counters of calls of object's method (created on the first call).
+ * NULL is returned when the statistics are disabled or when they can't be allocated.
+ */
+struct stats *call_stats_entry(ubus_Connection *connection, const char *object, const char *method)
+{
+	if (!connection->stats_enabled) {
+		return NULL;
+	}
+	if (!connection->call_stats) {
+		connection->call_stats = PyDict_New();
+		if (!connection->call_stats) {
+			PyErr_Clear();
+			return NULL;
+		}
+	}
+
+	PyObject *key = Py_BuildValue("(ss)", object, method);
+	if (!key) {
+		PyErr_Clear();
+		return NULL;
+	}
+	struct stats *stats = NULL;
+	PyObject *capsule = PyDict_GetItem(connection->call_stats, key);
+	if (capsule) {
+		stats = PyCapsule_GetPointer(capsule, NULL);
+	} else {
+		stats = calloc(1, sizeof(struct stats));
+		capsule = stats ? PyCapsule_New(stats, NULL, free_stats_capsule) : NULL;
+		if (!capsule || PyDict_SetItem(connection->call_stats, key, capsule)) {
+			if (!capsule) {
+				free(stats);
+			}
+			stats = NULL;
+		}
+		Py_XDECREF(capsule);
+	}
+	Py_DECREF(key);
+	PyErr_Clear();  // statistics are optional
+
+	return stats;
+}
+
+/* ResponseHandler */
+
+typedef struct {
+	PyObject_HEAD
+	ubus_Connection *connection;
+	struct ubus_context *ctx;
+	struct ubus_request_data *req;
+	struct ubus_request_data deferred_req;
+	struct list_head list;
+	bool deferred;
+	struct blob_buf buf;
+	struct stats *stats;  // NULL when the statistics are disabled
+	uint64_t reply_ns;  // time spent in reply() (excluded from the callback time)
+} ubus_ResponseHandler;
+
+void ubus_ResponseHandler_complete_deferred(ubus_ResponseHandler *self, int status)
+{
+	if (!self->deferred) {
+		return;
+	}
+
+	ubus_Connection *connection = self->connection;
+	Py_INCREF(connection);
+	connection_lock(connection, true);
+	// the response might be completed by another thread meanwhile
+	if (self->deferred) {
+		if (self->ctx && self->req) {
+			ubus_complete_deferred_request(self->ctx, self->req, status);
+			if (self->stats) {
+				stats_record_status(self->stats, status);
+			}
+		}
+		list_del_init(&self->list);
+		self->deferred = false;
+		self->req = NULL;
+		self->ctx = NULL;
+		self->stats = NULL;
+		self->connection = NULL;
+		Py_DECREF(connection);  // reference held by the deferred response
+	}
+	connection_unlock(connection);
+	Py_DECREF(connection);
+}
+
+void unlink_deferred_handlers(ubus_Connection *connection)
+{
+	ubus_ResponseHandler *handler, *tmp;
+	list_for_each_entry_safe(handler, tmp, &connection->deferred_handlers, list) {
+		// connection is being closed -> the requests can't be completed
+		handler->ctx = NULL;
+		handler->req = NULL;
+		ubus_ResponseHandler_complete_deferred(handler, UBUS_STATUS_CONNECTION_FAILED);
+	}
+}
+
+static void ubus_ResponseHandler_dealloc(ubus_ResponseHandler* self)
+{
+	// caller would wait for the response otherwise
+	ubus_ResponseHandler_complete_deferred(self, UBUS_STATUS_NO_DATA);
+	blob_buf_free(&self->buf);
+	Py_TYPE(self)->tp_free((PyObject*)self);
+}
+
+PyDoc_STRVAR(
+	ResponseHandler_reply_doc,
+	"reply(data)\n"
+	"\n"
+	":param data: JSON to be send as a response to a ubus call.\n"
+	":type data: dict\n"
+);
+
+static PyObject *ubus_ResponseHandler_reply(ubus_ResponseHandler *self, PyObject *args, PyObject *kwargs)
+{
+	if (self->connection && !CONNECTED(self->connection)) {
+		PyErr_Format(PyExc_RuntimeError, MSG_NOT_CONNECTED);
+		return NULL;
+	}
+
+	PyObject *data = NULL;
+	static char *kwlist[] = {"data",  NULL};
+	if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O", kwlist, &data)) {
+		return NULL;
+	}
+
+	uint64_t start = self->stats ? stats_now() : 0;
+
+	// put data into buffer
+	if (!encode_message(&self->buf, data)) {
+		return NULL;
+	}
+
+	// handler is not linked to a call response
+	if (!self->req || !self->ctx || !self->connection) {
+		PyErr_Format(PyExc_RuntimeError, "Handler is not linked to a call response.");
+		return NULL;
+	}
+
+	ubus_Connection *connection = self->connection;
+	Py_INCREF(connection);
+	connection_lock(connection, true);
+	int retval = UBUS_STATUS_NO_DATA;
+	if (self->req && self->ctx) {
+		retval = ubus_send_reply(self->ctx, self->req, self->buf.head);
+		if (self->stats) {
+			uint64_t elapsed = stats_now() - start;
+			stats_record_latency(&self->stats->reply, elapsed);
+			self->stats->bytes_out += blob_len(self->buf.head);
+			self->reply_ns += elapsed;
+		}
+	}
+	connection_unlock(connection);
+	Py_DECREF(connection);
+
+	return prepare_bool(!retval);
+}
+
+PyDoc_STRVAR(
+	ResponseHandler_defer_doc,
+	"defer()\n"
+	"\n"
+	"Keeps the call response open after the method callback returns.\n"
+	"reply() can be used later and the response has to be finished by complete().\n"
+);
+
+static PyObject *ubus_ResponseHandler_defer(ubus_ResponseHandler *self, PyObject *args, PyObject *kwargs)
+{
+	if (self->connection && !CONNECTED(self->connection)) {
+		PyErr_Format(PyExc_RuntimeError, MSG_NOT_CONNECTED);
+		return NULL;
+	}
+
+	// handler is not linked to a call response
+	if (!self->req || !self->ctx || !self->connection) {
+		PyErr_Format(PyExc_RuntimeError, "Handler is not linked to a call response.");
+		return NULL;
+	}
+
+	if (self->deferred) {
+		PyErr_Format(PyExc_RuntimeError, "Response is already deferred.");
+		return NULL;
+	}
+
+	ubus_defer_request(self->ctx, self->req, &self->deferred_req);
+	self->req = &self->deferred_req;
+	self->deferred = true;
+	list_add_tail(&self->list, &self->connection->deferred_handlers);
+
+	Py_INCREF(Py_None);
+	return Py_None;
+}
+
+PyDoc_STRVAR(
+	ResponseHandler_complete_doc,
+	"complete(status=0)\n"
+	"\n"
+	"Finishes the deferred response.\n"
+	"\n"
+	":param status: ubus status which will be returned to the caller (UBUS_STATUS_*)\n"
+	":type status: int\n"
+);
+
+static PyObject *ubus_ResponseHandler_complete(ubus_ResponseHandler *self, PyObject *args, PyObject *kwargs)
+{
+	if (self->connection && !CONNECTED(self->connection)) {
+		PyErr_Format(PyExc_RuntimeError, MSG_NOT_CONNECTED);
+		return NULL;
+	}
+
+	int status = UBUS_STATUS_OK;
+	static char *kwlist[] = {"status",  NULL};
+	if (!PyArg_ParseTupleAndKeywords(args, kwargs, "|i", kwlist, &status)) {
+		return NULL;
+	}
+
+	if (!self->deferred || !self->req || !self->ctx) {
+		PyErr_Format(PyExc_RuntimeError, "Handler is not linked to a deferred response.");
+		return NULL;
+	}
+
+	ubus_ResponseHandler_complete_deferred(self, status);
+
+	Py_INCREF(Py_None);
+	return Py_None;
+}
+
+PyDoc_STRVAR(
+	ResponseHandler_doc,
+	"__ResponseHandler\n"
+	"\n"
+	"Object which is used to handle responses to ubus calls.\n"
+);
+
+static PyMethodDef ubus_ResponseHandler_methods[] = {
+	{"reply", (PyCFunction)ubus_ResponseHandler_reply, METH_VARARGS|METH_KEYWORDS, ResponseHandler_reply_doc},
+	{"defer", (PyCFunction)ubus_ResponseHandler_defer, METH_NOARGS, ResponseHandler_defer_doc},
+	{"complete", (PyCFunction)ubus_ResponseHandler_complete, METH_VARARGS|METH_KEYWORDS, ResponseHandler_complete_doc},
+	{NULL},
+};
+
+static int ubus_ResponseHandler_init(ubus_ResponseHandler *self, PyObject *args, PyObject *kwargs)
+{
+	static char *kwlist[] = {NULL};
+	if (!PyArg_ParseTupleAndKeywords(args, kwargs, "", kwlist)){
+		return -1;
+	}
+	memset(&self->buf, 0, sizeof(self->buf));
+	self->connection = NULL;
+	self->ctx = NULL;
+	self->req = NULL;
+	self->stats = NULL;
+	self->reply_ns = 0;
+	return 0;
+}
+
+static PyObject *ubus_ResponseHandler_new(PyTypeObject *type, PyObject *args, PyObject *kwargs)
+{
+	ubus_ResponseHandler *self = (ubus_ResponseHandler *)type->tp_alloc(type, 0);
+	if (self) {
+		INIT_LIST_HEAD(&self->list);
+	}
+	return (PyObject *)self;
+}
+
+static PyTypeObject ubus_ResponseHandlerType = {
+	PyVarObject_HEAD_INIT(NULL, 0)
+	RESPONSE_HANDLER_OBJECT_NAME,				/* tp_name */
+	sizeof(ubus_ResponseHandler),				/* tp_basicsize */
+	0,											/* tp_itemsize */
+	(destructor)ubus_ResponseHandler_dealloc,	/* tp_dealloc */
+	0,											/* tp_print */
+	0,											/* tp_getattr */
+	0,											/* tp_setattr */
+	0,											/* tp_compare */
+	0,											/* tp_repr */
+	0,											/* tp_as_number */
+	0,											/* tp_as_sequence */
+	0,											/* tp_as_mapping */
+	0,											/* tp_hash */
+	0,											/* tp_call */
+	0,											/* tp_str */
+	0,											/* tp_getattro */
+	0,											/* tp_setattro */
+	0,											/* tp_as_buffer */
+	Py_TPFLAGS_DEFAULT | Py_TPFLAGS_BASETYPE,	/* tp_flags */
+	ResponseHandler_doc,						/* tp_doc */
+	0,											/* tp_traverse */
+	0,											/* tp_clear */
+	0,											/* tp_richcompare */
+	0,											/* tp_weaklistoffset */
+	0,											/* tp_iter */
+	0,											/* tp_iternext */
+	ubus_ResponseHandler_methods,				/* tp_methods */
+	0,											/* tp_members */
+	0,											/* tp_getset */
+	0,											/* tp_base */
+	0,											/* tp_dict */
+	0,											/* tp_descr_get */
+	0,											/* tp_descr_set */
+	0,											/* tp_dictoffset */
+	(initproc)ubus_ResponseHandler_init,		/* tp_init */
+	0,											/* tp_alloc */
+	ubus_ResponseHandler_new,					/* tp_new */
+};
+
+/* name index - open addressing hash table which maps names to array indexes */
+
+static uint32_t name_hash(const char *name)
+{
+	uint32_t hash = 2166136261u;  // FNV-1a
+	for (; *name; name++) {
+		hash = (hash ^ (unsigned char)*name) * 16777619u;
+	}
+	return hash;
+}
+
+bool name_index_init(struct name_index *index, int count)
+{
+	// keep at least half of the slots empty so that the lookups end quickly
+	uint32_t size = 1;
+	while (size < 2 * (uint32_t)count) {
+		size <<= 1;
+	}
+	index->slots = calloc(size, sizeof(struct name_slot));
+	index->mask = size - 1;
+	return index->slots != NULL;
+}
+
+void name_index_insert(struct name_index *index, const char *name, int idx)
+{
+	uint32_t hash = name_hash(name);
+	uint32_t pos = hash & index->mask;
+	while (index->slots[pos].name) {
+		pos = (pos + 1) & index->mask;
+	}
+	index->slots[pos].name = name;
+	index->slots[pos].hash = hash;
+	index->slots[pos].idx = idx;
+}
+
+int name_index_find(const struct name_index *index, const char *name)
+{
+	if (!index->slots) {
+		return -1;
+	}
+	uint32_t hash = name_hash(name);
+	for (uint32_t pos = hash & index->mask; index->slots[pos].name; pos = (pos + 1) & index->mask) {
+		struct name_slot *slot = &index->slots[pos];
+		if (slot->hash == hash && (slot->name == name || !strcmp(slot->name, name))) {
+			return slot->idx;
+		}
+	}
+	return -1;
+}
+
+/* grows the index (if needed) so that count names fit in */
+bool name_index_reserve(struct name_index *index, int count)
+{
+	if (index->slots && index->mask + 1 >= 2 * (uint32_t)count) {
+		return true;
+	}
+
+	struct name_index grown;
+	if (!name_index_init(&grown, count)) {
+		return false;
+	}
+	if (index->slots) {
+		for (uint32_t pos = 0; pos <= index->mask; pos++) {
+			if (index->slots[pos].name) {
+				name_index_insert(&grown, index->slots[pos].name, index->slots[pos].idx);
+			}
+		}
+		free(index->slots);
+	}
+	*index = grown;
+	return true;
+}
+
+static struct name_slot *name_index_slot(const struct name_index *index, const char *name)
+{
+	uint32_t hash = name_hash(name);
+	for (uint32_t pos = hash & index->mask; index->slots[pos].name; pos = (pos + 1) & index->mask) {
+		struct name_slot *slot = &index->slots[pos];
+		if (slot->hash == hash && (slot->name == name || !strcmp(slot->name, name))) {
+			return slot;
+		}
+	}
+	return NULL;
+}
+
+void name_index_update(struct name_index *index, const char *name, int idx)
+{
+	struct name_slot *slot = name_index_slot(index, name);
+	if (slot) {
+		slot->idx = idx;
+	}
+}
+
+void name_index_remove(struct name_index *index, const char *name)
+{
+	struct name_slot *slot = name_index_slot(index, name);
+	if (!slot) {
+		return;
+	}
+
+	// shift back the following names which wouldn't be found behind the hole otherwise
+	uint32_t hole = slot - index->slots;
+	for (uint32_t pos = (hole + 1) & index->mask; index->slots[pos].name; pos = (pos + 1) & index->mask) {
+		uint32_t home = index->slots[pos].hash & index->mask;
+		if (((pos - home) & index->mask) >= ((pos - hole) & index->mask)) {
+			index->slots[hole] = index->slots[pos];
+			hole = pos;
+		}
+	}
+	index->slots[hole].name = NULL;
+}
+
+void free_ubus_object(ubus_Object *obj)
+{
+	if (obj->dispatch) {
+		for (int i = 0; i < obj->object.n_methods; i++) {
+			Py_XDECREF(obj->dispatch[i].callable);
+			Py_XDECREF(obj->dispatch[i].names);
+			free(obj->dispatch[i].policy_index.slots);
+		}
+		free(obj->dispatch);
+	}
+	free(obj->method_index.slots);
+
+	if (obj->object.methods) {
+		for (int i = 0; i < obj->object.n_methods; i++) {
+			if (&obj->object.methods[i] && obj->object.methods[i].policy) {
+				free((struct blobmsg_policy *)obj->object.methods[i].policy);
+			}
+		}
+		free((struct ubus_method *)obj->object.methods);
+	}
+
+	if (obj->object.type) {
+		free(obj->object.type);
+	}
+	Py_XDECREF(obj->name);
+	Py_XDECREF(obj->methods);
+	free(obj);
+}
+
+
+#if PY_MAJOR_VERSION >= 3
+static struct PyModuleDef moduledef = {
+        PyModuleDef_HEAD_INIT,
+        "ubus",
+        NULL,
+        sizeof(struct module_state),
+        ubus_methods,
+        NULL,
+        NULL,
+        NULL,
+        NULL
+};
+#endif
+
+PyObject *ubus_python_module_init(void)
+{
+#if PY_MAJOR_VERSION >= 3
+	PyObject *module = PyModule_Create(&moduledef);
+#else
+	PyObject *module = Py_InitModule3("ubus", ubus_methods, "Ubus bindings");
+#endif
+	return module;
+}
+
+/* object id cache */
+
+enum {
+	OBJECT_EVENT_PATH,
+	__OBJECT_EVENT_MAX,
+};
+
+static const struct blobmsg_policy object_event_policy[__OBJECT_EVENT_MAX] = {
+	[OBJECT_EVENT_PATH] = { .name = "path", .type = BLOBMSG_TYPE_STRING },
+};
+
+static void ubus_python_object_event_handler(struct ubus_context *ctx, struct ubus_event_handler *ev,
+			const char *type, struct blob_attr *msg)
+{
+	struct blob_attr *tb[__OBJECT_EVENT_MAX];
+	blobmsg_parse(object_event_policy, __OBJECT_EVENT_MAX, tb, blob_data(msg), blob_len(msg));
+	if (!tb[OBJECT_EVENT_PATH]) {
+		return;
+	}
+
+	ubus_Connection *connection = container_of(ev, ubus_Connection, object_event_handler);
+
+	const char *path = blobmsg_get_string(tb[OBJECT_EVENT_PATH]);
+
+	PyGILState_STATE gstate = PyGILState_Ensure();
+
+	// the object was added or removed -> cached id is no longer valid
+	if (connection->object_ids && PyDict_DelItemString(connection->object_ids, path)) {
+		PyErr_Clear();  // the path was not cached
+	}
+
+	// signatures of added objects are looked up when the catalogue is used
+	if (connection->catalogue) {
+		bool failed = false;
+		if (!strcmp(type, "ubus.object.add")) {
+			PyObject *key = PyUnicode_FromString(path);
+			failed = !key || PyDict_SetItem(connection->catalogue, key, Py_None);
+			Py_XDECREF(key);
+		} else if (PyDict_DelItemString(connection->catalogue, path)) {
+			PyErr_Clear();  // the object was not listed
+		}
+		if (failed) {
+			// the catalogue can't be kept current anymore
+			PyErr_Clear();
+			Py_CLEAR(connection->catalogue);
+		}
+	}
+
+	PyGILState_Release(gstate);
+}
+
+/*
+ * The object events are received only when the catalogue is used. The events received
+ * during synchronous calls would be queued by libubus without any limit otherwise.
+ * Cached object ids don't depend on them (stale ids are detected by UBUS_STATUS_NOT_FOUND).
+ */
+int init_object_events(ubus_Connection *connection)
+{
+	if (connection->object_event_handler.cb) {
+		return UBUS_STATUS_OK;
+	}
+
+	connection->object_event_handler.cb = ubus_python_object_event_handler;
+	int retval = ubus_register_event_handler(
+			connection->ctx, &connection->object_event_handler, "ubus.object.*");
+	if (retval != UBUS_STATUS_OK) {
+		connection->object_event_handler.cb = NULL;
+	}
+
+	return retval;
+}
+
+int lookup_object_id(ubus_Connection *connection, const char *path, uint32_t *id, bool *cached)
+{
+	*cached = false;
+	if (connection->object_ids) {
+		PyObject *cached_id = PyDict_GetItemString(connection->object_ids, path);
+		if (cached_id) {
+			*id = PyLong_AsUnsignedLong(cached_id);
+			*cached = true;
+			return UBUS_STATUS_OK;
+		}
+	}
+
+	int retval = ubus_lookup_id(connection->ctx, path, id);
+	if (retval != UBUS_STATUS_OK || !connection->object_ids) {
+		return retval;
+	}
+
+	PyObject *new_id = PyLong_FromUnsignedLong(*id);
+	if (!new_id || PyDict_SetItemString(connection->object_ids, path, new_id)) {
+		PyErr_Clear();  // caching is optional
+	}
+	Py_XDECREF(new_id);
+
+	return retval;
+}
+
+void invalidate_object_id(ubus_Connection *connection, const char *path)
+{
+	if (connection->object_ids && PyDict_DelItemString(connection->object_ids, path)) {
+		PyErr_Clear();
+	}
+}
+
+PyDoc_STRVAR(
+	disconnect_doc,
+	"disconnect(deregister=True)\n"
+	"\n"
+	":param deregister: Deregisters object and handlers from ubus as well.\n"
+	":type deregister: bool\n"
+	"Disconnects from ubus and disposes all connection structures.\n"
+);
+
+void abort_requests(ubus_Connection *connection, bool trigger_callbacks);
+void free_ubus_subscriber(ubus_Subscriber *subscriber);
+void free_listener(ubus_Listener *listener);
+void release_object(ubus_Connection *connection, ubus_Object *object);
+void free_pattern_nodes(struct pattern_node *node);
+
+void dispose_connection(ubus_Connection *connection, bool deregister)
+{
+	if (connection->ctx != NULL) {
+		abort_requests(connection, true);
+		unlink_deferred_handlers(connection);
+
+		if (deregister) {
+			// remove objects
+			for (int i = 0; i < connection->objects_size; i++) {
+				ubus_remove_object(connection->ctx, &connection->objects[i]->object);
+			}
+
+			// remove subscribers
+			ubus_Subscriber *subscriber;
+			list_for_each_entry(subscriber, &connection->subscribers, list) {
+				ubus_unregister_subscriber(connection->ctx, &subscriber->subscriber);
+			}
+
+			// remove listeners
+			if (connection->event_handler.obj.id) {
+				ubus_unregister_event_handler(connection->ctx, &connection->event_handler);
+			}
+
+			// remove catalogue listener
+			if (connection->object_event_handler.cb) {
+				ubus_unregister_event_handler(connection->ctx, &connection->object_event_handler);
+			}
+		}
+
+		if (connection->uloop_pid != getpid()) {
+			// the socket is registered in the poll set of the parent process (after fork())
+			connection->ctx->sock.registered = false;
+		}
+		ubus_shutdown(connection->ctx);
+		connection->ctx = NULL;
+	}
+	blob_buf_free(&connection->buf);
+	Py_CLEAR(connection->object_ids);
+	Py_CLEAR(connection->catalogue);
+	Py_CLEAR(connection->call_stats);
+	// clear event listeners (queued events are dropped)
+	while (!list_empty(&connection->listeners)) {
+		free_listener(list_first_entry(&connection->listeners, ubus_Listener, list));
+	}
+	free_pattern_nodes(connection->patterns);
+	connection->patterns = NULL;
+	memset(&connection->event_handler, 0, sizeof(connection->event_handler));
+	connection->listeners_removed = false;
+	connection->batches_pending = false;
+	// clear subscribers
+	while (!list_empty(&connection->subscribers)) {
+		free_ubus_subscriber(list_first_entry(&connection->subscribers, ubus_Subscriber, list));
+	}
+	// clear objects
+	if (connection->objects) {
+		for (int i = 0; i < connection->objects_size; i++) {
+			release_object(connection, connection->objects[i]);
+		}
+		free(connection->objects);
+		connection->objects_size = 0;
+		connection->objects_capacity = 0;
+		connection->objects = NULL;
+	}
+	free(connection->object_index.slots);
+	connection->object_index.slots = NULL;
+
+	if (connection->socket_path) {
+		free(connection->socket_path);
+		connection->socket_path = NULL;
+	}
+}
+
+static PyObject *ubus_Connection_disconnect(ubus_Connection *self, PyObject *args, PyObject *kwargs)
+{
+	if (!CONNECTED(self)) {
+		PyErr_Format(PyExc_RuntimeError, MSG_NOT_CONNECTED);
+		return NULL;
+	}
+
+	PyObject* deregister = Py_True;
+	static char *kwlist[] = {"deregister", NULL};
+	if (!PyArg_ParseTupleAndKeywords(args, kwargs, "|O!", kwlist, &PyBool_Type, &deregister)){
+		return NULL;
+	}
+
+	dispose_connection(self, PyObject_IsTrue(deregister));
+
+	Py_INCREF(Py_None);
+	return Py_None;
+}
+
+PyDoc_STRVAR(
+	connect_doc,
+	"connect(socket_path='" DEFAULT_SOCKET "')\n"
+	"\n"
+	"Establishes a connection to ubus.\n"
+);
+
+void flush_drained_batches(ubus_Connection *connection);
+void flush_expired_batches(ubus_Connection *connection);
+int next_batch_timeout(ubus_Connection *connection);
+
+static void ubus_python_socket_handler(struct uloop_fd *sock, unsigned int events)
+{
+	ubus_Connection *connection = container_of(sock, ubus_Connection, context.sock);
+
+	connection_lock(connection, false);
+	if (CONNECTED(connection)) {
+		connection->socket_cb(sock, events);
+		flush_drained_batches(connection);
+	}
+	connection_unlock(connection);
+}
+
+static void ubus_python_pending_handler(struct uloop_timeout *timeout)
+{
+	ubus_Connection *connection = container_of(timeout, ubus_Connection, context.pending_timer);
+
+	connection_lock(connection, false);
+	if (CONNECTED(connection)) {
+		connection->pending_cb(timeout);
+		flush_drained_batches(connection);
+	}
+	connection_unlock(connection);
+}
+
+/* uloop is shared by all the connections and it is initialized once per process */
+
+pid_t uloop_pid = 0;  // process which initialized uloop (forked children need their own)
+int wake_pipe[2] = {-1, -1};  // stop() and signals wake up the loop through this pipe
+struct uloop_fd wake_fd;
+struct uloop_timeout loop_timeout;
+volatile sig_atomic_t stop_requested = 0;
+bool loop_woken = false;
+
+static void ubus_python_wake_handler(struct uloop_fd *fd, unsigned int events)
+{
+	char buf[64];
+	while (read(fd->fd, buf, sizeof(buf)) > 0);
+	loop_woken = true;
+	uloop_end();
+}
+
+static void ubus_python_timeout_handler(struct uloop_timeout *timeout) {
+	uloop_end();
+}
+
+PyObject *set_wakeup_fd = NULL;  // signal.set_wakeup_fd (resolved once)
+
+/*
+ * Replaces the descriptor which is written when a signal arrives and returns the previous one.
+ * -2 is returned when it can't be replaced (e.g. outside of the main thread).
+ */
+int swap_wakeup_fd(int fd)
+{
+	if (!set_wakeup_fd) {
+		PyObject *signal_module = PyImport_ImportModule("signal");
+		if (signal_module) {
+			set_wakeup_fd = PyObject_GetAttrString(signal_module, "set_wakeup_fd");
+			Py_DECREF(signal_module);
+		}
+		if (!set_wakeup_fd) {
+			PyErr_Clear();
+			return -2;
+		}
+	}
+
+	PyObject *res = PyObject_CallFunction(set_wakeup_fd, "i", fd);
+	if (!res) {
+		PyErr_Clear();
+		return -2;
+	}
+	int previous = PyLong_AsLong(res);
+	Py_DECREF(res);
+
+	return previous;
+}
+
+bool init_uloop(void)
+{
+	pid_t pid = getpid();
+	if (uloop_pid == pid) {
+		return true;
+	}
+
+	if (uloop_pid) {
+		// the poll set and the pipe are shared with the parent process after fork()
+		// so nothing may be removed from the set, only the references of this process are released
+		wake_fd.registered = false;
+		close(wake_pipe[0]);
+		close(wake_pipe[1]);
+		wake_pipe[0] = wake_pipe[1] = -1;
+		uloop_done();
+		uloop_pid = 0;
+	}
+
+	if (uloop_init()) {
+		PyErr_Format(PyExc_RuntimeError, "Failed to initialize uloop.");
+		return false;
+	}
+	if (pipe2(wake_pipe, O_NONBLOCK | O_CLOEXEC)) {
+		PyErr_SetFromErrno(PyExc_OSError);
+		uloop_done();
+		return false;
+	}
+	memset(&wake_fd, 0, sizeof(wake_fd));
+	wake_fd.fd = wake_pipe[0];
+	wake_fd.cb = ubus_python_wake_handler;
+	uloop_fd_add(&wake_fd, ULOOP_READ);
+	memset(&loop_timeout, 0, sizeof(loop_timeout));
+	loop_timeout.cb = ubus_python_timeout_handler;
+	uloop_pid = pid;
+
+	return true;
+}
+
+bool connect_connection(ubus_Connection *connection, const char *socket_path)
+{
+	// socket path
+	connection->socket_path = strdup(socket_path ? socket_path : DEFAULT_SOCKET);
+	if (!connection->socket_path) {
+		PyErr_Format(PyExc_MemoryError, MSG_ALLOCATION_FAILS);
+		dispose_connection(connection, true);
+		return false;
+	}
+
+	// Init objects array
+	connection->objects = NULL;
+	connection->objects_size = 0;
+	connection->objects_capacity = 0;
+	connection->object_index.slots = NULL;
+
+	// Connect to ubus
+	if (ubus_connect_ctx(&connection->context, connection->socket_path)) {
+		PyErr_Format(
+				PyExc_IOError,
+				"Failed to connect to the ubus socket '%s'\n", connection->socket_path
+		);
+		dispose_connection(connection, true);
+		return false;
+	}
+	connection->ctx = &connection->context;
+
+	// process incoming messages only while the connection lock is held
+	connection->socket_cb = connection->ctx->sock.cb;
+	connection->ctx->sock.cb = ubus_python_socket_handler;
+	connection->pending_cb = connection->ctx->pending_timer.cb;
+	connection->ctx->pending_timer.cb = ubus_python_pending_handler;
+	if (!init_uloop()) {
+		dispose_connection(connection, true);
+		return false;
+	}
+	ubus_add_uloop(connection->ctx);
+	connection->uloop_pid = uloop_pid;
+	memset(&connection->buf, 0, sizeof(connection->buf));
+
+	// object events are received once the catalogue is used
+	memset(&connection->object_event_handler, 0, sizeof(connection->object_event_handler));
+	connection->object_ids = PyDict_New();
+	if (!connection->object_ids) {
+		dispose_connection(connection, true);
+		return false;
+	}
+
+	return true;
+}
+
+PyDoc_STRVAR(
+	get_connected_doc,
+	"get_connected()\n"
+	"\n"
+	"Determines whether we are connected to ubus.\n"
+	":return: True if connected, False otherwise.\n"
+	":rtype: bool \n"
+);
+
+static PyObject *ubus_Connection_get_connected(ubus_Connection *self, PyObject *args, PyObject *kwargs)
+{
+	return prepare_bool(CONNECTED(self));
+}
+
+PyDoc_STRVAR(
+	get_socket_path_doc,
+	"get_socket_path()\n"
+	"\n"
+	"Gets socket path for the current connection.\n"
+	":return: path to socket if connected, None otherwise.\n"
+	":rtype: bool or str \n"
+);
+
+static PyObject *ubus_Connection_get_socket_path(ubus_Connection *self, PyObject *args, PyObject *kwargs)
+{
+	if (self && self->socket_path) {
+		return PyUnicode_FromString(self->socket_path);
+	} else {
+		Py_INCREF(Py_None);
+		return Py_None;
+	}
+}
+
+PyDoc_STRVAR(
+	get_fd_doc,
+	"get_fd()\n"
+	"\n"
+	"Gets file descriptor of the current connection.\n"
+	"It can be registered in an external event loop which calls process_events()\n"
+	"when the descriptor becomes readable.\n"
+	":return: file descriptor\n"
+	":rtype: int\n"
+);
+
+static PyObject *ubus_Connection_get_fd(ubus_Connection *self, PyObject *args, PyObject *kwargs)
+{
+	if (!CONNECTED(self)) {
+		PyErr_Format(PyExc_RuntimeError, MSG_NOT_CONNECTED);
+		return NULL;
+	}
+
+	return PyInt_FromLong(self->ctx->sock.fd);
+}
+
+PyDoc_STRVAR(
+	process_events_doc,
+	"process_events()\n"
+	"\n"
+	"Processes messages which are pending on the connection without blocking.\n"
+	"\n"
+	":return: ms after which process_events() needs to be called again to pass the batches\n"
+	"         waiting for batch_timeout (-1 = only when a message is received)\n"
+	":rtype: int\n"
+);
+
+static PyObject *ubus_Connection_process_events(ubus_Connection *self, PyObject *args, PyObject *kwargs)
+{
+	if (!CONNECTED(self)) {
+		PyErr_Format(PyExc_RuntimeError, MSG_NOT_CONNECTED);
+		return NULL;
+	}
+
+	struct ubus_context *ctx = self->ctx;
+	int next = -1;
+	Py_BEGIN_ALLOW_THREADS
+	ubus_handle_event(ctx);
+
+	// messages queued during synchronous calls are normally dispatched by uloop
+	if (ctx->pending_timer.pending) {
+		uloop_timeout_cancel(&ctx->pending_timer);
+		ctx->pending_timer.cb(&ctx->pending_timer);
+	}
+	if (CONNECTED(self)) {
+		flush_expired_batches(self);
+		next = CONNECTED(self) ? next_batch_timeout(self) : -1;
+	}
+	Py_END_ALLOW_THREADS
+
+	return PyInt_FromLong(next);
+}
+
+PyDoc_STRVAR(
+	set_native_codec_doc,
+	"set_native_codec(enabled)\n"
+	"\n"
+	"Switches between the native blobmsg codec and the json module.\n"
+	"The json module is used to convert the messages to and from ubus when disabled.\n"
+	"\n"
+	":param enabled: True to use the native codec, False to use json module \n"
+	":type enabled: bool\n"
+);
+
+static PyObject *ubus_python_set_native_codec(PyObject *module, PyObject *args, PyObject *kwargs)
+{
+	PyObject *enabled = NULL;
+	static char *kwlist[] = {"enabled", NULL};
+	if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O!", kwlist, &PyBool_Type, &enabled)){
+		return NULL;
+	}
+
+	native_codec = PyObject_IsTrue(enabled);
+
+	Py_INCREF(Py_None);
+	return Py_None;
+}
+
+PyDoc_STRVAR(
+	get_native_codec_doc,
+	"get_native_codec()\n"
+	"\n"
+	"Determines whether the native blobmsg codec is used.\n"
+	":return: True if native codec is used, False if json module is used.\n"
+	":rtype: bool \n"
+);
+
+static PyObject *ubus_python_get_native_codec(PyObject *module, PyObject *args, PyObject *kwargs)
+{
+	return prepare_bool(native_codec);
+}
+
+PyDoc_STRVAR(
+	set_codec_doc,
+	"set_codec(loads=None, dumps=None)\n"
+	"\n"
+	"Sets the functions which convert the messages when the native codec is disabled.\n"
+	"Functions of the json module are used when called without arguments.\n"
+	"\n"
+	":param loads: function which converts a json string to python object (e.g. orjson.loads) \n"
+	":type loads: callable\n"
+	":param dumps: function which converts python object to a json string or bytes \n"
+	":type dumps: callable\n"
+);
+
+static PyObject *ubus_python_set_codec(PyObject *module, PyObject *args, PyObject *kwargs)
+{
+	PyObject *loads = Py_None, *dumps = Py_None;
+	static char *kwlist[] = {"loads", "dumps", NULL};
+	if (!PyArg_ParseTupleAndKeywords(args, kwargs, "|OO", kwlist, &loads, &dumps)){
+		return NULL;
+	}
+
+	if ((loads == Py_None) != (dumps == Py_None)) {
+		PyErr_Format(PyExc_TypeError, "Both loads and dumps need to be set.");
+		return NULL;
+	}
+
+	if (loads != Py_None && (!PyCallable_Check(loads) || !PyCallable_Check(dumps))) {
+		PyErr_Format(PyExc_TypeError, "loads and dumps must be callable.");
+		return NULL;
+	}
+
+	if (loads == Py_None) {
+		loads = dumps = NULL;  // use json module
+	}
+	if (!set_json_functions(loads, dumps)) {
+		return NULL;
+	}
+
+	Py_INCREF(Py_None);
+	return Py_None;
+}
+
+PyDoc_STRVAR(
+	get_codec_doc,
+	"get_codec()\n"
+	"\n"
+	"Returns the functions which convert the messages when the native codec is disabled.\n"
+	":return: (loads, dumps) \n"
+	":rtype: tuple \n"
+);
+
+static PyObject *ubus_python_get_codec(PyObject *module, PyObject *args, PyObject *kwargs)
+{
+	return Py_BuildValue("(OO)", json_functions[LOADS], json_functions[DUMPS]);
+}
+
+PyDoc_STRVAR(
+	encode_doc,
+	"encode(data)\n"
+	"\n"
+	"Serializes data to a blobmsg message using the current codec.\n"
+	"\n"
+	":param data: python object which can be serialized to json \n"
+	":type data: dict\n"
+	":return: serialized message \n"
+	":rtype: bytes \n"
+);
+
+static PyObject *ubus_python_encode(PyObject *module, PyObject *args, PyObject *kwargs)
+{
+	PyObject *data = NULL;
+	static char *kwlist[] = {"data", NULL};
+	if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O", kwlist, &data)){
+		return NULL;
+	}
+
+	struct blob_buf buf;
+	memset(&buf, 0, sizeof(buf));
+	PyObject *res = NULL;
+	if (encode_message(&buf, data)) {
+		res = decode_raw_message(buf.head);
+	}
+	blob_buf_free(&buf);
+
+	return res;
+}
+
+PyDoc_STRVAR(
+	decode_doc,
+	"decode(data, lazy=False)\n"
+	"\n"
+	"Deserializes a blobmsg message using the current codec.\n"
+	"\n"
+	":param data: serialized message \n"
+	":type data: bytes\n"
+	":param lazy: return MessageView which decodes fields on access \n"
+	":type lazy: bool\n"
+	":return: deserialized message \n"
+	":rtype: dict or MessageView \n"
+);
+
+static PyObject *ubus_python_decode(PyObject *module, PyObject *args, PyObject *kwargs)
+{
+	PyObject *data = NULL, *lazy = Py_False;
+	static char *kwlist[] = {"data", "lazy", NULL};
+	if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O|O!", kwlist, &data, &PyBool_Type, &lazy)){
+		return NULL;
+	}
+
+	Py_buffer view;
+	if (PyObject_GetBuffer(data, &view, PyBUF_SIMPLE)) {
+		return NULL;
+	}
+
+	PyObject *res = NULL;
+	struct blob_attr *msg = (struct blob_attr *)view.buf;
+	if (check_raw_message(msg, view.len)) {
+		res = decode_message_format(msg, lazy == Py_True ? FORMAT_LAZY : FORMAT_DECODED);
+	}
+	PyBuffer_Release(&view);
+
+	return res;
+}
+
+PyDoc_STRVAR(
+	connect_send_doc,
+	"send(event, data)\n"
+	"\n"
+	"Send an event via ubus.\n"
+	"\n"
+	":param event: ubus event which will be used \n"
+	":type event: str\n"
+	":param data: python object which can be serialized to json \n"
+	":type data: dict or list \n"
+	":return: True on success, False otherwise \n"
+	":rtype: bool \n"
+);
+
+static PyObject *ubus_Connection_send(ubus_Connection *self, PyObject *args, PyObject *kwargs)
+{
+	if (!CONNECTED(self)) {
+		PyErr_Format(PyExc_RuntimeError, MSG_NOT_CONNECTED);
+		return NULL;
+	}
+
+	char *event = NULL;
+	PyObject *data = NULL;
+	static char *kwlist[] = {"event", "data",  NULL};
+	if (!PyArg_ParseTupleAndKeywords(args, kwargs, "sO", kwlist, &event, &data)){
+		return NULL;
+	}
+
+	// put data into buffer
+	if (!encode_message(&self->buf, data)) {
+		return NULL;
+	}
+
+	int retval = ubus_send_event(self->ctx, event, self->buf.head);
+	return prepare_bool(!retval);
+}
+
+static bool filter_rule_matches(const struct filter_rule *rule, struct blob_attr *attr)
+{
+	if (rule->kind == FILTER_PRESENT) {
+		return true;
+	}
+
+	if (rule->type == BLOBMSG_TYPE_STRING) {
+		if (blobmsg_type(attr) != BLOBMSG_TYPE_STRING) {
+			return false;
+		}
+		size_t len = strlen(blobmsg_get_string(attr));
+		if (rule->kind == FILTER_EQUAL ? len != rule->value.string.len : len < rule->value.string.len) {
+			return false;
+		}
+		return !memcmp(blobmsg_get_string(attr), rule->value.string.data, rule->value.string.len);
+	}
+
+	int64_t integer;
+	switch (blobmsg_type(attr)) {
+		case BLOBMSG_TYPE_INT64:
+			integer = (int64_t) blobmsg_get_u64(attr);
+			break;
+		case BLOBMSG_TYPE_INT32:
+			integer = (int32_t) blobmsg_get_u32(attr);
+			break;
+		case BLOBMSG_TYPE_INT16:
+			integer = (int16_t) blobmsg_get_u16(attr);
+			break;
+		case BLOBMSG_TYPE_BOOL:
+			integer = blobmsg_get_bool(attr);
+			break;
+		case BLOBMSG_TYPE_DOUBLE:
+			if (rule->type == BLOBMSG_TYPE_DOUBLE) {
+				return blobmsg_get_double(attr) == rule->value.number;
+			}
+			return blobmsg_get_double(attr) == (double) rule->value.integer;
+		default:
+			return false;
+	}
+	if (rule->type == BLOBMSG_TYPE_DOUBLE) {
+		return (double) integer == rule->value.number;
+	}
+	return integer == rule->value.integer;
+}
+
+/* checks the fields of the message without decoding it */
+static bool filter_matches(const struct event_filter *filter, struct blob_attr *msg)
+{
+	for (int i = 0; i < filter->n_rules; i++) {
+		const struct filter_rule *rule = &filter->rules[i];
+		struct blob_attr *cur;
+		int rem;
+		bool matched = false;
+		blob_for_each_attr(cur, msg, rem) {
+			// the name and the value of an invalid attribute can't be read safely
+			if (!blobmsg_check_attr(cur, true)) {
+				break;
+			}
+			if (!strcmp(blobmsg_name(cur), rule->name)) {
+				matched = filter_rule_matches(rule, cur);
+				break;
+			}
+		}
+		if (!matched) {
+			return false;
+		}
+	}
+	return true;
+}
+
+static struct pattern_node *pattern_node_new(char key)
+{
+	struct pattern_node *node = calloc(1, sizeof(struct pattern_node));
+	if (node) {
+		node->key = key;
+		INIT_LIST_HEAD(&node->exact);
+		INIT_LIST_HEAD(&node->prefix);
+	}
+	return node;
+}
+
+static struct pattern_node *pattern_node_child(struct pattern_node *node, char key, bool create)
+{
+	struct pattern_node *child;
+	for (child = node->children; child; child = child->next) {
+		if (child->key == key) {
+			return child;
+		}
+	}
+	if (!create) {
+		return NULL;
+	}
+
+	child = pattern_node_new(key);
+	if (child) {
+		child->next = node->children;
+		node->children = child;
+	}
+	return child;
+}
+
+void free_pattern_nodes(struct pattern_node *node)
+{
+	while (node) {
+		struct pattern_node *next = node->next;
+		free_pattern_nodes(node->children);
+		free(node);
+		node = next;
+	}
+}
+
+/* returns the node of the pattern (NULL if it isn't listened) and whether it is a wildcard */
+static struct pattern_node *find_pattern(ubus_Connection *connection, const char *pattern, bool *wildcard)
+{
+	size_t len = strlen(pattern);
+	*wildcard = len && pattern[len - 1] == '*';
+	if (*wildcard) {
+		len--;
+	}
+
+	struct pattern_node *node = connection->patterns;
+	for (size_t i = 0; node && i < len; i++) {
+		node = pattern_node_child(node, pattern[i], false);
+	}
+	return node;
+}
+
+void free_listener(ubus_Listener *listener)
+{
+	list_del(&listener->list);
+	list_del(&listener->pattern_list);
+	uloop_timeout_cancel(&listener->batch_timer);
+	blob_buf_free(&listener->batch);
+	free(listener->filter);
+	Py_XDECREF(listener->event);
+	Py_XDECREF(listener->callback);
+	Py_XDECREF(listener->filter_refs);
+	free(listener);
+}
+
+/* listeners stay allocated while they are held (i.e. events are being dispatched) */
+static void hold_listeners(ubus_Connection *connection)
+{
+	connection->dispatch_depth++;
+}
+
+static void release_listeners(ubus_Connection *connection)
+{
+	if (--connection->dispatch_depth || !connection->listeners_removed || !CONNECTED(connection)) {
+		return;
+	}
+	connection->listeners_removed = false;
+
+	PyGILState_STATE gstate = PyGILState_Ensure();
+	ubus_Listener *listener, *tmp;
+	list_for_each_entry_safe(listener, tmp, &connection->listeners, list) {
+		if (listener->removed) {
+			free_listener(listener);
+		}
+	}
+	PyGILState_Release(gstate);
+
+	// ubus can't unregister a single pattern so they are removed once nothing is listened
+	if (list_empty(&connection->listeners)) {
+		if (connection->event_handler.obj.id) {
+			ubus_unregister_event_handler(connection->ctx, &connection->event_handler);
+		}
+		free_pattern_nodes(connection->patterns);
+		connection->patterns = NULL;
+	}
+}
+
+/*
+ * Passes the queued events to the callback at once (the GIL is acquired only once).
+ * It is called with the connection lock held and without the GIL.
+ */
+void flush_event_batch(ubus_Listener *listener)
+{
+	if (!listener->batch_count) {
+		return;
+	}
+	uloop_timeout_cancel(&listener->batch_timer);
+	struct stats *stats = listener->connection->stats_enabled ? &listener->stats : NULL;
+	uint64_t start = stats ? stats_now() : 0;
+
+	PyGILState_STATE gstate = PyGILState_Ensure();
+
+	PyObject *events = PyList_New(listener->batch_count);
+	if (events) {
+		struct blob_attr *cur;
+		int rem, i = 0;
+		blob_for_each_attr(cur, listener->batch.head, rem) {
+			PyObject *type = PyUnicode_FromString(blobmsg_name(cur));
+			PyObject *data = type ? decode_message_format(
+					(struct blob_attr *)blobmsg_data(cur), listener->format) : NULL;
+			PyObject *event = data ? PyTuple_Pack(2, type, data) : NULL;
+			Py_XDECREF(type);
+			Py_XDECREF(data);
+			if (!event) {
+				Py_CLEAR(events);
+				break;
+			}
+			PyList_SET_ITEM(events, i++, event);
+		}
+	}
+	// events queued within the callback will form a new batch
+	listener->batch_count = 0;
+	if (!events) {
+		if (stats) {
+			stats_record_status(stats, UBUS_STATUS_UNKNOWN_ERROR);
+		}
+		PyErr_Print();
+		goto flush_event_batch_exit;
+	}
+	uint64_t callback_start = stats ? stats_now() : 0;
+	if (stats) {
+		stats_record_latency(&stats->decode, callback_start - start);
+	}
+
+	// the listener (and its counters) is freed when disconnect() is called within the callback
+	ubus_Connection *connection = listener->connection;
+	Py_INCREF(connection);
+	PyObject *result = PyObject_CallFunctionObjArgs(listener->callback, events, NULL);
+	if (!CONNECTED(connection)) {
+		stats = NULL;
+	}
+	Py_DECREF(connection);
+	if (stats) {
+		stats_record_latency(&stats->callback, stats_now() - callback_start);
+	}
+	if (result) {
+		Py_DECREF(result);
+	} else {
+		if (stats) {
+			stats_record_status(stats, UBUS_STATUS_UNKNOWN_ERROR);
+		}
+		PyErr_Print();
+	}
+	Py_DECREF(events);
+
+flush_event_batch_exit:
+	PyErr_Clear();
+	PyGILState_Release(gstate);
+}
+
+static void ubus_python_batch_timeout_handler(struct uloop_timeout *timeout)
+{
+	ubus_Listener *listener = container_of(timeout, ubus_Listener, batch_timer);
+	ubus_Connection *connection = listener->connection;
+
+	connection_lock(connection, false);
+	if (CONNECTED(connection) && !listener->removed) {
+		hold_listeners(connection);
+		flush_event_batch(listener);
+		release_listeners(connection);
+	}
+	connection_unlock(connection);
+}
+
+/* passes the batches which wait for the socket to be drained */
+void flush_drained_batches(ubus_Connection *connection)
+{
+	if (!connection->batches_pending) {
+		return;
+	}
+	// more messages are going to be read within this loop iteration
+	struct pollfd pfd = {.fd = connection->ctx->sock.fd, .events = POLLIN};
+	if (poll(&pfd, 1, 0) > 0 && (pfd.revents & POLLIN)) {
+		return;
+	}
+	connection->batches_pending = false;
+
+	hold_listeners(connection);
+	ubus_Listener *listener;
+	list_for_each_entry(listener, &connection->listeners, list) {
+		if (!listener->removed && !listener->batch_timeout) {
+			flush_event_batch(listener);
+			if (!CONNECTED(connection)) {
+				break;  // the listeners were freed by disconnect()
+			}
+		}
+	}
+	release_listeners(connection);
+}
+
+/* passes the batches which waited for batch_timeout (outside of loop() the timers are not run) */
+void flush_expired_batches(ubus_Connection *connection)
+{
+	hold_listeners(connection);
+	ubus_Listener *listener;
+	list_for_each_entry(listener, &connection->listeners, list) {
+		if (!listener->removed && listener->batch_timer.pending
+				&& uloop_timeout_remaining(&listener->batch_timer) <= 0) {
+			flush_event_batch(listener);
+			if (!CONNECTED(connection)) {
+				break;  // the listeners were freed by disconnect()
+			}
+		}
+	}
+	release_listeners(connection);
+}
+
+/* ms until the first batch_timeout expires (-1 = no batch is waiting) */
+int next_batch_timeout(ubus_Connection *connection)
+{
+	int next = -1;
+	ubus_Listener *listener;
+	list_for_each_entry(listener, &connection->listeners, list) {
+		if (!listener->removed && listener->batch_timer.pending) {
+			int remaining = uloop_timeout_remaining(&listener->batch_timer);
+			remaining = remaining < 0 ? 0 : remaining;
+			if (next < 0 || remaining < next) {
+				next = remaining;
+			}
+		}
+	}
+	return next;
+}
+
+/* queues the event without acquiring the GIL */
+static void queue_event(ubus_Listener *listener, const char *type, struct blob_attr *msg)
+{
+	if (listener->connection->stats_enabled) {
+		listener->stats.invocations++;
+		listener->stats.bytes_in += blob_len(msg);
+	}
+
+	if (!listener->batch_count) {
+		blob_buf_init(&listener->batch, 0);
+	}
+	if (blobmsg_add_field(&listener->batch, BLOBMSG_TYPE_UNSPEC, type, msg, blob_pad_len(msg))) {
+		if (listener->connection->stats_enabled) {
+			stats_record_status(&listener->stats, UBUS_STATUS_UNKNOWN_ERROR);
+		}
+		return;  // the event is dropped
+	}
+	listener->batch_count++;
+
+	if (listener->batch_count >= listener->batch_size) {
+		flush_event_batch(listener);
+	} else if (listener->batch_timeout) {
+		if (!listener->batch_timer.pending) {
+			uloop_timeout_set(&listener->batch_timer, listener->batch_timeout);
+		}
+	} else {
+		listener->connection->batches_pending = true;
+	}
+}
+
+/* passes the event to a single listener */
+static void deliver_event(ubus_Listener *listener, const char *type, struct blob_attr *msg)
+{
+	if (listener->filter && !filter_matches(listener->filter, msg)) {
+		return;  // rejected without acquiring the GIL
+	}
+	if (listener->batch_size) {
+		queue_event(listener, type, msg);
+		return;
+	}
+
+	PyGILState_STATE gstate = PyGILState_Ensure();
+
+	// Prepare event
+	PyObject *event = PyUnicode_FromString(type);
+	if (!event) {
+		goto event_handler_cleanup0;
+	}
+
+	// Get PyObject callback
+	struct stats *stats = listener->connection->stats_enabled ? &listener->stats : NULL;
+	uint64_t start = stats ? stats_now() : 0;
+	if (stats) {
+		stats->invocations++;
+		stats->bytes_in += blob_len(msg);
+	}
+
+	// Prepare data
+	PyObject *data_object = decode_message_format(msg, listener->format);
+	if (!data_object) {
+		if (stats) {
+			stats_record_status(stats, UBUS_STATUS_UNKNOWN_ERROR);
+		}
+		goto event_handler_cleanup1;
+	}
+	uint64_t callback_start = stats ? stats_now() : 0;
+	if (stats) {
+		stats_record_latency(&stats->decode, callback_start - start);
+	}
+
+	// Trigger callback
+	PyObject *callback_arglist = Py_BuildValue("(O, O)", event, data_object);
+	if (!callback_arglist) {
+		goto event_handler_cleanup2;
+	}
+
+	// the listener (and its counters) is freed when disconnect() is called within the callback
+	ubus_Connection *connection = listener->connection;
+	Py_INCREF(connection);
+	PyObject *result = PyObject_CallObject(listener->callback, callback_arglist);
+	if (!CONNECTED(connection)) {
+		stats = NULL;
+	}
+	Py_DECREF(connection);
+	if (stats) {
+		stats_record_latency(&stats->callback, stats_now() - callback_start);
+	}
+	if (result) {
+		Py_DECREF(result);  // result of the callback is quite useless
+	} else {
+		if (stats) {
+			stats_record_status(stats, UBUS_STATUS_UNKNOWN_ERROR);
+		}
+		PyErr_Print();
+	}
+	Py_DECREF(callback_arglist);
+
+event_handler_cleanup2:
+	Py_DECREF(data_object);
+event_handler_cleanup1:
+	Py_DECREF(event);
+
+event_handler_cleanup0:
+	// Clear python exceptions
+	PyErr_Clear();
+
+	PyGILState_Release(gstate);
+}
+
+/* returns false when the connection was closed by a callback */
+static bool deliver_to_listeners(ubus_Connection *connection, struct list_head *listeners,
+		const char *type, struct blob_attr *msg)
+{
+	ubus_Listener *listener;
+	list_for_each_entry(listener, listeners, pattern_list) {
+		if (listener->removed) {
+			continue;
+		}
+		deliver_event(listener, type, msg);
+		if (!CONNECTED(connection)) {
+			return false;
+		}
+	}
+	return true;
+}
+
+/* all the patterns are registered through a single handler and the events are routed by the trie */
+static void ubus_python_event_handler(struct ubus_context *ctx, struct ubus_event_handler *ev,
+			const char *type, struct blob_attr *msg)
+{
+	ubus_Connection *connection = container_of(ev, ubus_Connection, event_handler);
+
+	hold_listeners(connection);
+	// wildcard patterns which are prefixes of the type and then the type itself
+	struct pattern_node *node = connection->patterns;
+	for (const char *c = type; node; c++) {
+		if (!deliver_to_listeners(connection, &node->prefix, type, msg)) {
+			break;
+		}
+		if (!*c) {
+			deliver_to_listeners(connection, &node->exact, type, msg);
+			break;
+		}
+		node = pattern_node_child(node, *c, false);
+	}
+	release_listeners(connection);
+}
+
+/*
+ * Adds the listener to the trie and registers its pattern unless it is already covered
+ * by a registered one (ubusd sends each event to the handler only once).
+ * UBUS status is returned when the registration fails, -1 when an exception is set.
+ */
+static int add_listener(ubus_Connection *connection, ubus_Listener *listener)
+{
+	if (!connection->patterns) {
+		connection->patterns = pattern_node_new(0);
+		if (!connection->patterns) {
+			PyErr_Format(PyExc_MemoryError, MSG_ALLOCATION_FAILS);
+			return -1;
+		}
+	}
+
+	size_t len = strlen(listener->pattern);
+	bool wildcard = len && listener->pattern[len - 1] == '*';
+	if (wildcard) {
+		len--;
+	}
+
+	struct pattern_node *node = connection->patterns;
+	bool covered = false;
+	for (size_t i = 0; i < len; i++) {
+		covered |= node->prefix_registered;
+		node = pattern_node_child(node, listener->pattern[i], true);
+		if (!node) {
+			PyErr_Format(PyExc_MemoryError, MSG_ALLOCATION_FAILS);
+			return -1;
+		}
+	}
+	covered |= node->prefix_registered || (!wildcard && node->registered);
+
+	if (!covered) {
+		connection->event_handler.cb = ubus_python_event_handler;
+		int retval = ubus_register_event_handler(connection->ctx, &connection->event_handler, listener->pattern);
+		if (retval != UBUS_STATUS_OK) {
+			return retval;
+		}
+		if (wildcard) {
+			node->prefix_registered = true;
+		} else {
+			node->registered = true;
+		}
+	}
+
+	list_add_tail(&listener->pattern_list, wildcard ? &node->prefix : &node->exact);
+	list_add_tail(&listener->list, &connection->listeners);
+	return UBUS_STATUS_OK;
+}
+
+/* keeps the string alive by the refs list and returns its utf-8 representation */
+static const char *filter_string(PyObject *refs, PyObject *string)
+{
+	if (!PyStr_Check(string)) {
+		PyErr_Format(PyExc_TypeError, "Filter field names and prefixes need to be strings.");
+		return NULL;
+	}
+	if (PyList_Append(refs, string)) {
+		return NULL;
+	}
+	return PyUnicode_AsUTF8(string);
+}
+
+static bool compile_filter_rule(PyObject *refs, struct filter_rule *rule, enum filter_kind kind,
+		PyObject *name, PyObject *value)
+{
+	rule->kind = kind;
+	rule->name = filter_string(refs, name);
+	if (!rule->name) {
+		return false;
+	}
+
+	switch (kind) {
+		case FILTER_PRESENT:
+			rule->type = BLOBMSG_TYPE_UNSPEC;
+			return true;
+		case FILTER_PREFIX:
+			if (!PyStr_Check(value)) {
+				break;
+			}
+			// fall through
+		case FILTER_EQUAL:
+			if (PyStr_Check(value)) {
+				rule->type = BLOBMSG_TYPE_STRING;
+				rule->value.string.data = filter_string(refs, value);
+				if (!rule->value.string.data) {
+					return false;
+				}
+				rule->value.string.len = strlen(rule->value.string.data);
+				return true;
+			}
+			if (PyFloat_Check(value)) {
+				rule->type = BLOBMSG_TYPE_DOUBLE;
+				rule->value.number = PyFloat_AsDouble(value);
+				return true;
+			}
+			if (PyInt_Check(value) || PyLong_Check(value)) {  // bool as well
+				rule->type = BLOBMSG_TYPE_INT64;
+				rule->value.integer = PyLong_AsLongLong(value);
+				return !PyErr_Occurred();
+			}
+			break;
+	}
+
+	PyErr_Format(PyExc_TypeError, "Unsupported filter value of '%s'.", rule->name);
+	return false;
+}
+
+/*
+ * Compiles {"equal": {field: value}, "present": [field, ...], "prefix": {field: prefix}}
+ * The strings used by the filter are appended to refs.
+ * NULL is returned and an exception is set when the filter is invalid.
+ */
+static struct event_filter *compile_filter(PyObject *refs, PyObject *filter, size_t *size)
+{
+	if (!PyDict_Check(filter)) {
+		PyErr_Format(PyExc_TypeError, "Filter needs to be a dict.");
+		return NULL;
+	}
+
+	// count the rules and check the keys
+	Py_ssize_t n_rules = 0, pos = 0;
+	PyObject *key, *value;
+	while (PyDict_Next(filter, &pos, &key, &value)) {
+		const char *kind = PyStr_Check(key) ? PyUnicode_AsUTF8(key) : "";
+		if (!kind) {
+			return NULL;
+		}
+		bool valid = !strcmp(kind, "present") ? PySequence_Check(value) && !PyStr_Check(value)
+			: (!strcmp(kind, "equal") || !strcmp(kind, "prefix")) && PyDict_Check(value);
+		if (!valid) {
+			PyErr_Format(PyExc_ValueError,
+					"Filter expects 'equal' and 'prefix' dicts and 'present' list of fields.");
+			return NULL;
+		}
+		Py_ssize_t len = PyObject_Size(value);
+		if (len < 0) {
+			return NULL;
+		}
+		n_rules += len;
+	}
+
+	*size = sizeof(struct event_filter) + n_rules * sizeof(struct filter_rule);
+	struct event_filter *res = calloc(1, *size);
+	if (!res) {
+		PyErr_Format(PyExc_MemoryError, MSG_ALLOCATION_FAILS);
+		return NULL;
+	}
+
+	pos = 0;
+	while (PyDict_Next(filter, &pos, &key, &value)) {
+		const char *kind = PyUnicode_AsUTF8(key);
+		if (!strcmp(kind, "present")) {
+			PyObject *fields = PySequence_Fast(value, "expected a sequence");
+			if (!fields) {
+				goto compile_filter_error;
+			}
+			// a custom sequence doesn't need to have the size it reported
+			for (int i = 0; i < PySequence_Fast_GET_SIZE(fields) && res->n_rules < n_rules; i++) {
+				if (!compile_filter_rule(refs, &res->rules[res->n_rules++], FILTER_PRESENT,
+							PySequence_Fast_GET_ITEM(fields, i), NULL)) {
+					Py_DECREF(fields);
+					goto compile_filter_error;
+				}
+			}
+			Py_DECREF(fields);
+		} else {
+			enum filter_kind rule_kind = strcmp(kind, "equal") ? FILTER_PREFIX : FILTER_EQUAL;
+			Py_ssize_t field_pos = 0;
+			PyObject *field, *field_value;
+			while (PyDict_Next(value, &field_pos, &field, &field_value)) {
+				if (!compile_filter_rule(refs, &res->rules[res->n_rules++], rule_kind, field, field_value)) {
+					goto compile_filter_error;
+				}
+			}
+		}
+	}
+
+	return res;
+
+compile_filter_error:
+	free(res);
+	return NULL;
+}
+
+PyDoc_STRVAR(
+	connect_listen_doc,
+	"listen(event, ..., raw=False, lazy=False, batch=0, batch_timeout=0, filter=None)\n"
+	"\n"
+	"Adds a listener on ubus events.\n"
+	"\n"
+	":param event: tuple contaning event string and a callback (str, callable) \n"
+	":type event: tuple\n"
+	":param raw: pass the data to the callbacks as serialized blobmsg messages (bytes) \n"
+	":type raw: bool\n"
+	":param lazy: pass the data to the callbacks as MessageView which decodes fields on access \n"
+	":type lazy: bool\n"
+	":param batch: pass lists of at most batch (event, data) tuples to the callbacks (0 = one by one) \n"
+	":type batch: int\n"
+	":param batch_timeout: ms the events wait for the batch to be filled, it is handled by loop(), poll() \n"
+	"    and process_events() (0 = the events are passed once all the pending messages are read) \n"
+	":type batch_timeout: int\n"
+	":param filter: pass only the events which data match all the rules (the rest is dropped in C) \n"
+	"    {'equal': {field: value}, 'present': [field, ...], 'prefix': {field: string}} \n"
+	":type filter: dict\n"
+);
+
+static PyObject *ubus_Connection_listen(ubus_Connection *self, PyObject *args, PyObject *kwargs)
+{
+	if (!CONNECTED(self)) {
+		PyErr_Format(PyExc_RuntimeError, MSG_NOT_CONNECTED);
+		return NULL;
+	}
+
+	// events are passed as positional arguments
+	PyObject *raw = Py_False, *lazy = Py_False, *filter = Py_None;
+	int batch = 0, batch_timeout = 0;
+	static char *kwlist[] = {"raw", "lazy", "batch", "batch_timeout", "filter", NULL};
+	PyObject *no_args = PyTuple_New(0);
+	if (!no_args) {
+		return NULL;
+	}
+	int parsed = PyArg_ParseTupleAndKeywords(no_args, kwargs, "|O!O!iiO", kwlist,
+			&PyBool_Type, &raw, &PyBool_Type, &lazy, &batch, &batch_timeout, &filter);
+	Py_DECREF(no_args);
+	enum message_format format;
+	if (!parsed || !parse_message_format(raw, lazy, &format)) {
+		return NULL;
+	}
+	if (batch < 0 || batch_timeout < 0) {
+		PyErr_Format(PyExc_ValueError, "batch and batch_timeout can't be negative.");
+		return NULL;
+	}
+	if (batch_timeout && !batch) {
+		PyErr_Format(PyExc_ValueError, "batch_timeout can be used only with batch.");
+		return NULL;
+	}
+	struct event_filter *compiled_filter = NULL;
+	size_t filter_size = 0;
+	PyObject *filter_refs = NULL;
+	if (filter != Py_None) {
+		filter_refs = PyList_New(0);
+		if (!filter_refs) {
+			return NULL;
+		}
+		compiled_filter = compile_filter(filter_refs, filter, &filter_size);
+		if (!compiled_filter) {
+			Py_DECREF(filter_refs);
+			return NULL;
+		}
+	}
+
+	args = PySequence_Fast(args, "expected a sequence");
+	int len = PySequence_Size(args);
+	if (!len) {
+		PyErr_Format(PyExc_TypeError, "You need to set at least one event.");
+		goto listen_error1;
 	}
 
 	if (!PyTuple_Check(args)) {
@@ -620,717 +3191,3406 @@ static PyObject *ubus_python_listen(PyObject *module, PyObject *args, PyObject *
 		goto listen_error1;
 	}
 
-	// Test whether the arguments are valid
-	for (int i = 0; i < len; i++) {
-		PyObject *item = PySequence_Fast_GET_ITEM(args, i);
-		// Test tuple
+	// Test whether the arguments are valid
+	for (int i = 0; i < len; i++) {
+		PyObject *item = PySequence_Fast_GET_ITEM(args, i);
+		// Test tuple
+		if (!PyTuple_Check(item)) {
+			PyErr_Format(PyExc_TypeError, MSG_LISTEN_TUPLE_EXPECTED);
+			goto listen_error1;
+		}
+		PyObject *item_tuple = PySequence_Fast(item, MSG_LISTEN_TUPLE_EXPECTED);
+		if (!item_tuple) {
+			PyErr_Format(PyExc_MemoryError, "Failed to obtain tuple item");
+			goto listen_error1;
+		}
+		if (!PyTuple_Check(item_tuple) || PySequence_Size(item_tuple) != 2) {
+			PyErr_Format(PyExc_TypeError, MSG_LISTEN_TUPLE_EXPECTED);
+			Py_DECREF(item_tuple);
+			Py_DECREF(args);
+			goto listen_error1;
+		}
+
+		// Test types
+		if (!PyStr_Check(PyTuple_GET_ITEM(item_tuple, 0))
+					|| !PyCallable_Check(PyTuple_GET_ITEM(item_tuple, 1))) {
+			PyErr_Format(PyExc_TypeError, MSG_LISTEN_TUPLE_EXPECTED);
+			Py_DECREF(item_tuple);
+			goto listen_error1;
+		}
+		Py_DECREF(item_tuple);
+	}
+
+	// add callbacks
+	for (int i = 0; i < len; i++) {
+		PyObject *item = PySequence_Fast_GET_ITEM(args, i);
+		PyObject *item_tuple = PySequence_Fast(item, MSG_LISTEN_TUPLE_EXPECTED);
+		if (!item_tuple) {
+			PyErr_Format(PyExc_MemoryError, "Failed to obtain tuple item");
+			goto listen_error1;
+		}
+
+		// prepare event listener
+		ubus_Listener *listener = calloc(1, sizeof(ubus_Listener));
+		if (!listener) {
+			PyErr_Format(PyExc_MemoryError, MSG_ALLOCATION_FAILS);
+			Py_DECREF(item_tuple);
+			goto listen_error1;
+		}
+		INIT_LIST_HEAD(&listener->list);
+		INIT_LIST_HEAD(&listener->pattern_list);
+
+		// Keep event and callback references
+		listener->event = PyTuple_GET_ITEM(item_tuple, 0);
+		Py_INCREF(listener->event);
+		listener->callback = PyTuple_GET_ITEM(item_tuple, 1);
+		Py_INCREF(listener->callback);
+		Py_DECREF(item_tuple);
+		listener->filter_refs = filter_refs;
+		Py_XINCREF(listener->filter_refs);
+
+		listener->format = format;
+		listener->connection = self;
+		listener->pattern = PyUnicode_AsUTF8(listener->event);
+		listener->batch_size = batch;
+		listener->batch_timeout = batch_timeout;
+		listener->batch_timer.cb = ubus_python_batch_timeout_handler;
+		if (!listener->pattern) {
+			free_listener(listener);
+			goto listen_error1;
+		}
+		if (compiled_filter) {
+			listener->filter = malloc(filter_size);
+			if (!listener->filter) {
+				PyErr_Format(PyExc_MemoryError, MSG_ALLOCATION_FAILS);
+				free_listener(listener);
+				goto listen_error1;
+			}
+			memcpy(listener->filter, compiled_filter, filter_size);
+		}
+
+		// register the pattern (events which can't be registered are skipped)
+		int retval = add_listener(self, listener);
+		if (retval != UBUS_STATUS_OK) {
+			free_listener(listener);
+			if (retval < 0) {
+				goto listen_error1;
+			}
+		}
+	}
+
+	Py_DECREF(args);
+	free(compiled_filter);
+	Py_XDECREF(filter_refs);
+
+	Py_INCREF(Py_None);
+	return Py_None;
+
+listen_error1:
+	Py_DECREF(args);
+	free(compiled_filter);
+	Py_XDECREF(filter_refs);
+	return NULL;
+}
+
+PyDoc_STRVAR(
+	connect_unlisten_doc,
+	"unlisten(event, ...)\n"
+	"\n"
+	"Removes listeners of ubus events.\n"
+	"Patterns stay registered in ubusd until all the listeners of the connection are removed.\n"
+	"\n"
+	":param event: event pattern (all its listeners are removed) or (event, callback) tuple \n"
+	":type event: str or tuple\n"
+	":return: number of removed listeners\n"
+	":rtype: int\n"
+);
+
+static PyObject *ubus_Connection_unlisten(ubus_Connection *self, PyObject *args, PyObject *kwargs)
+{
+	if (!CONNECTED(self)) {
+		PyErr_Format(PyExc_RuntimeError, MSG_NOT_CONNECTED);
+		return NULL;
+	}
+
+	if (kwargs && PyDict_Size(kwargs)) {
+		PyErr_Format(PyExc_TypeError, "unlisten() takes no keyword arguments.");
+		return NULL;
+	}
+	Py_ssize_t len = PyTuple_Size(args);
+	if (!len) {
+		PyErr_Format(PyExc_TypeError, "You need to set at least one event.");
+		return NULL;
+	}
+
+	long removed = 0;
+	hold_listeners(self);
+	for (Py_ssize_t i = 0; i < len; i++) {
+		PyObject *event = PyTuple_GET_ITEM(args, i), *callback = NULL;
+		if (PyTuple_Check(event)) {
+			if (PyTuple_GET_SIZE(event) != 2) {
+				PyErr_Format(PyExc_TypeError, MSG_LISTEN_TUPLE_EXPECTED);
+				goto unlisten_error;
+			}
+			callback = PyTuple_GET_ITEM(event, 1);
+			event = PyTuple_GET_ITEM(event, 0);
+		}
+		if (!PyStr_Check(event)) {
+			PyErr_Format(PyExc_TypeError, "Event needs to be a string.");
+			goto unlisten_error;
+		}
+		const char *pattern = PyUnicode_AsUTF8(event);
+		if (!pattern) {
+			goto unlisten_error;
+		}
+
+		bool wildcard;
+		struct pattern_node *node = find_pattern(self, pattern, &wildcard);
+		if (!node) {
+			continue;
+		}
+		ubus_Listener *listener;
+		list_for_each_entry(listener, wildcard ? &node->prefix : &node->exact, pattern_list) {
+			if (listener->removed) {
+				continue;
+			}
+			if (callback) {
+				// bound methods are created each time so they are compared by their value
+				int equal = PyObject_RichCompareBool(listener->callback, callback, Py_EQ);
+				if (equal < 0) {
+					goto unlisten_error;
+				}
+				if (!equal) {
+					continue;
+				}
+			}
+			listener->removed = true;
+			self->listeners_removed = true;
+			removed++;
+		}
+	}
+	release_listeners(self);
+
+	return PyInt_FromLong(removed);
+
+unlisten_error:
+	release_listeners(self);
+	return NULL;
+}
+
+PyDoc_STRVAR(
+	connect_loop_doc,
+	"loop(timeout=-1)\n"
+	"\n"
+	"Enters a loop and processes events.\n"
+	"Note that the loop processes events of all the connections.\n"
+	"The loop returns when the timeout expires or when stop() is called.\n"
+	"Python signal handlers are run while the loop is waiting.\n"
+	"\n"
+	":param timeout: loop timeout in ms (if lower than zero then it will run forever) \n"
+	":type timeout: int\n"
+);
+
+static PyObject *ubus_Connection_loop(ubus_Connection *self, PyObject *args, PyObject *kwargs)
+{
+	if (!CONNECTED(self)) {
+		PyErr_Format(PyExc_RuntimeError, MSG_NOT_CONNECTED);
+		return NULL;
+	}
+
+	int timeout = -1;
+	static char *kwlist[] = {"timeout", NULL};
+	if (!PyArg_ParseTupleAndKeywords(args, kwargs, "|i", kwlist, &timeout)){
+		return NULL;
+	}
+
+
+	if (timeout == 0) {
+		// process events directly without uloop
+		struct ubus_context *ctx = self->ctx;
+		Py_BEGIN_ALLOW_THREADS
+		ubus_handle_event(ctx);
+		Py_END_ALLOW_THREADS
+
+		Py_INCREF(Py_None);
+		return Py_None;
+	}
+
+	if (!init_uloop()) {
+		return NULL;
+	}
+
+	// signals wake the loop up so that their python handlers are not postponed
+	int wakeup_fd = swap_wakeup_fd(wake_pipe[1]);
+	if (wakeup_fd >= 0) {
+		swap_wakeup_fd(wakeup_fd);  // don't take over the descriptor of somebody else
+	}
+
+	bool interrupted = false;
+	uint64_t end = timeout > 0 ? stats_now() + timeout * 1000000ULL : 0;
+	while (!stop_requested) {
+		if (timeout > 0) {
+			uint64_t now = stats_now();
+			if (now >= end) {
+				break;
+			}
+			uloop_timeout_set(&loop_timeout, (end - now + 999999) / 1000000);
+		}
+
+		loop_woken = false;
+
+		Py_BEGIN_ALLOW_THREADS
+		uloop_run();
+		Py_END_ALLOW_THREADS
+
+		uloop_timeout_cancel(&loop_timeout);
+
+		if (!loop_woken) {
+			// timeout expired or uloop was ended by its own signal handler
+			break;
+		}
+		if (PyErr_CheckSignals()) {
+			interrupted = true;
+			break;
+		}
+	}
+
+	if (wakeup_fd == -1) {
+		// the exception raised by a signal handler is kept
+		PyObject *type, *value, *traceback;
+		PyErr_Fetch(&type, &value, &traceback);
+		swap_wakeup_fd(-1);
+		PyErr_Restore(type, value, traceback);
+	}
+	if (interrupted) {
+		return NULL;
+	}
+	stop_requested = 0;
+
+	Py_INCREF(Py_None);
+	return Py_None;
+}
+
+PyDoc_STRVAR(
+	stop_doc,
+	"stop()\n"
+	"\n"
+	"Makes the running loop() return (or the next one if no loop is running).\n"
+	"It can be called from other threads and from signal handlers.\n"
+);
+
+static PyObject *ubus_python_stop(PyObject *module, PyObject *args)
+{
+	stop_requested = 1;
+	if (wake_pipe[1] != -1 && uloop_pid == getpid()) {
+		char byte = 0;
+		if (write(wake_pipe[1], &byte, 1) < 0) {
+			// the pipe is full -> the loop is being woken up anyway
+		}
+	}
+
+	Py_INCREF(Py_None);
+	return Py_None;
+}
+
+PyDoc_STRVAR(
+	connect_poll_doc,
+	"poll(timeout=0, max_messages=0)\n"
+	"\n"
+	"Waits for a message of the connection and processes all the pending messages\n"
+	"without entering the loop.\n"
+	"\n"
+	":param timeout: how long to wait for the first message in ms (-1 = forever)\n"
+	":type timeout: int\n"
+	":param max_messages: maximal number of dispatched messages (0 = unlimited),\n"
+	"                     messages queued during synchronous calls are dispatched together\n"
+	":type max_messages: int\n"
+	":return: number of dispatched messages\n"
+	":rtype: int\n"
+);
+
+static PyObject *ubus_Connection_poll(ubus_Connection *self, PyObject *args, PyObject *kwargs)
+{
+	if (!CONNECTED(self)) {
+		PyErr_Format(PyExc_RuntimeError, MSG_NOT_CONNECTED);
+		return NULL;
+	}
+
+	int timeout = 0, max_messages = 0;
+	static char *kwlist[] = {"timeout", "max_messages", NULL};
+	if (!PyArg_ParseTupleAndKeywords(args, kwargs, "|ii", kwlist, &timeout, &max_messages)){
+		return NULL;
+	}
+	if (max_messages < 0) {
+		PyErr_Format(PyExc_ValueError, "max_messages can't be lower than 0");
+		return NULL;
+	}
+
+	struct ubus_context *ctx = self->ctx;
+	int processed = 0;
+	bool cancel_poll = ctx->cancel_poll;
+	Py_BEGIN_ALLOW_THREADS
+	while (!max_messages || processed < max_messages) {
+		// messages queued during synchronous calls are normally dispatched by uloop
+		if (ctx->pending_timer.pending) {
+			struct list_head *queued;
+			list_for_each(queued, &ctx->pending) {
+				processed++;
+			}
+			uloop_timeout_cancel(&ctx->pending_timer);
+			ctx->pending_timer.cb(&ctx->pending_timer);
+			continue;
+		}
+
+		// the batches waiting for batch_timeout are passed once it expires
+		int wait = processed ? 0 : timeout;
+		int batch_wait = next_batch_timeout(self);
+		if (batch_wait >= 0 && (wait < 0 || batch_wait < wait)) {
+			wait = batch_wait;
+		}
+
+		struct pollfd pfd = { .fd = ctx->sock.fd, .events = POLLIN };
+		if (poll(&pfd, 1, wait) <= 0) {
+			break;
+		}
+		// libubus reads the messages until the socket is drained unless the polling is cancelled
+		ctx->cancel_poll = true;
+		ubus_handle_event(ctx);
+		ctx->cancel_poll = cancel_poll;
+		processed++;
+		if (pfd.revents & (POLLERR | POLLHUP | POLLNVAL) || ctx->sock.eof) {
+			break;
+		}
+	}
+	if (CONNECTED(self)) {
+		flush_expired_batches(self);
+	}
+	Py_END_ALLOW_THREADS
+
+	if (PyErr_CheckSignals()) {
+		return NULL;
+	}
+
+	return PyInt_FromLong(processed);
+}
+
+bool test_policies(const struct blobmsg_policy *policies, const struct name_index *index,
+		int n_policies, struct blob_attr *args)
+{
+	struct blob_attr *cur;
+	int idx = 0, passed_count = 0;
+
+	blob_for_each_attr(cur, args, idx) {
+		int pol_idx = name_index_find(index, blobmsg_name(cur));
+
+		// Policy was not found
+		if (pol_idx < 0) {
+			return false;
+		}
+
+		passed_count += 1;
+		int pol_type = policies[pol_idx].type;
+		if (pol_type != BLOBMSG_TYPE_UNSPEC && pol_type != blobmsg_type(cur)) {
+			return false;
+		}
+	}
+
+	// All attributes are present and checked
+	return passed_count == n_policies;
+}
+
+#define KEYWORDS_STACK_SIZE 16  // arguments which don't need to be allocated
+
+/*
+ * Decodes the arguments and calls the method with them as keyword arguments.
+ * The arguments are checked against the policies in the same pass.
+ * NULL is returned and retval is set to UBUS_STATUS_INVALID_ARGUMENT when the check fails.
+ */
+PyObject *call_with_keywords(ubus_Method *method, const struct ubus_method *ubus_method,
+		PyObject *handler, struct blob_attr *msg, int *retval)
+{
+	PyObject *stack[KEYWORDS_STACK_SIZE + 1];
+	PyObject **args = stack;
+	int n_policies = ubus_method->n_policy;
+	if (n_policies > KEYWORDS_STACK_SIZE) {
+		args = calloc(n_policies + 1, sizeof(PyObject *));
+		if (!args) {
+			PyErr_Format(PyExc_MemoryError, MSG_ALLOCATION_FAILS);
+			return NULL;
+		}
+	} else {
+		memset(stack, 0, sizeof(stack));
+	}
+	args[0] = handler;
+
+	PyObject *result = NULL;
+	struct blob_attr *cur;
+	int rem = 0, passed_count = 0;
+	blob_for_each_attr(cur, msg, rem) {
+		int pol_idx = name_index_find(&method->policy_index, blobmsg_name(cur));
+		if (pol_idx < 0 || args[pol_idx + 1]) {
+			// unknown or duplicate argument
+			*retval = UBUS_STATUS_INVALID_ARGUMENT;
+			goto keywords_cleanup;
+		}
+		int pol_type = ubus_method->policy[pol_idx].type;
+		if (pol_type != BLOBMSG_TYPE_UNSPEC && pol_type != blobmsg_type(cur)) {
+			*retval = UBUS_STATUS_INVALID_ARGUMENT;
+			goto keywords_cleanup;
+		}
+		args[pol_idx + 1] = decode_attr(cur);
+		if (!args[pol_idx + 1]) {
+			goto keywords_cleanup;
+		}
+		passed_count++;
+	}
+
+	// All attributes are required
+	if (passed_count != n_policies) {
+		*retval = UBUS_STATUS_INVALID_ARGUMENT;
+		goto keywords_cleanup;
+	}
+
+#if PY_VERSION_HEX >= 0x03090000
+	result = PyObject_Vectorcall(method->callable, args, 1, method->names);
+#else
+	{
+		PyObject *arglist = PyTuple_Pack(1, handler);
+		PyObject *kwargs = PyDict_New();
+		if (arglist && kwargs) {
+			int i;
+			for (i = 0; i < n_policies; i++) {
+				if (PyDict_SetItem(kwargs, PyTuple_GET_ITEM(method->names, i), args[i + 1])) {
+					break;
+				}
+			}
+			if (i == n_policies) {
+				result = PyObject_Call(method->callable, arglist, kwargs);
+			}
+		}
+		Py_XDECREF(arglist);
+		Py_XDECREF(kwargs);
+	}
+#endif
+
+keywords_cleanup:
+	for (int i = 1; i <= n_policies; i++) {
+		Py_XDECREF(args[i]);
+	}
+	if (args != stack) {
+		free(args);
+	}
+
+	return result;
+}
+
+/*
+ * Prints the exception raised by a method callback.
+ * Unlike PyErr_Print() it doesn't store it in sys.last_* which would keep the frames alive.
+ */
+static void print_method_error(void)
+{
+	PyObject *type, *value, *traceback;
+	PyErr_Fetch(&type, &value, &traceback);
+	PyErr_NormalizeException(&type, &value, &traceback);
+	PyErr_Display(type, value, traceback);
+	Py_XDECREF(type);
+	Py_XDECREF(value);
+	Py_XDECREF(traceback);
+}
+
+static int ubus_python_method_handler(struct ubus_context *ctx, struct ubus_object *obj,
+		struct ubus_request_data *req, const char *method,
+		struct blob_attr *msg)
+{
+	ubus_Object *object = container_of(obj, ubus_Object, object);
+	uint64_t start = object->connection->stats_enabled ? stats_now() : 0;
+
+	// Check whether method signature matches
+	int method_idx = name_index_find(&object->method_index, method);
+	if (method_idx < 0) {
+		// Can't find method
+		return UBUS_STATUS_UNKNOWN_ERROR;
+	}
+	ubus_Method *python_method = &object->dispatch[method_idx];
+	const struct ubus_method *ubus_method = &obj->methods[method_idx];
+	struct stats *stats = object->connection->stats_enabled ? &python_method->stats : NULL;
+	if (stats) {
+		stats->invocations++;
+		stats->bytes_in += blob_len(msg);
+	}
+	// keyword arguments are checked while they are decoded
+	if (!object->keywords && !test_policies(ubus_method->policy, &python_method->policy_index,
+				ubus_method->n_policy, msg)) {
+		if (stats) {
+			stats_record_status(stats, UBUS_STATUS_INVALID_ARGUMENT);
+		}
+		return UBUS_STATUS_INVALID_ARGUMENT;
+	}
+
+	PyGILState_STATE gstate = PyGILState_Ensure();
+
+	// the object can be removed (or the connection closed) within the callback
+	ubus_Connection *connection = object->connection;
+	Py_INCREF(connection);
+	object->busy++;
+
+	int retval = UBUS_STATUS_OK;
+	bool deferred = false;
+
+	// prepare data
+	PyObject *data_object = NULL;
+	if (!object->keywords) {
+		data_object = decode_message_format(msg, object->format);
+		if (!data_object) {
+			retval = UBUS_STATUS_UNKNOWN_ERROR;
+			goto method_handler_exit;
+		}
+	}
+	if (stats) {
+		// keyword arguments are decoded within the callback time
+		stats_record_latency(&stats->decode, stats_now() - start);
+	}
+
+	PyObject *handler = PyObject_CallObject((PyObject *)&ubus_ResponseHandlerType, NULL);
+	if (!handler) {
+		PyErr_Print();
+		retval = UBUS_STATUS_UNKNOWN_ERROR;
+		goto method_handler_cleanup1;
+	}
+	((ubus_ResponseHandler *)handler)->connection = object->connection;
+	Py_INCREF(((ubus_ResponseHandler *)handler)->connection);
+	((ubus_ResponseHandler *)handler)->req = req;
+	((ubus_ResponseHandler *)handler)->ctx = ctx;
+	((ubus_ResponseHandler *)handler)->stats = stats;
+
+	// Trigger method
+	uint64_t callback_start = stats ? stats_now() : 0;
+	PyObject *result = NULL;
+	if (object->keywords) {
+		result = call_with_keywords(python_method, ubus_method, handler, msg, &retval);
+	} else {
+		PyObject *callback_arglist = Py_BuildValue("(O, O)", handler, data_object);
+		if (!callback_arglist) {
+			retval = UBUS_STATUS_UNKNOWN_ERROR;
+			goto method_handler_cleanup2;
+		}
+		result = PyObject_CallObject(python_method->callable, callback_arglist);
+		Py_DECREF(callback_arglist);
+	}
+	if (!CONNECTED(((ubus_ResponseHandler *)handler)->connection)) {
+		// the object (and its counters) was freed by disconnect() within the callback
+		stats = NULL;
+		((ubus_ResponseHandler *)handler)->stats = NULL;
+	}
+	if (stats) {
+		uint64_t elapsed = stats_now() - callback_start;
+		uint64_t reply_ns = ((ubus_ResponseHandler *)handler)->reply_ns;
+		stats_record_latency(&stats->callback, elapsed > reply_ns ? elapsed - reply_ns : 0);
+	}
+	// status of a deferred response is recorded when it is completed
+	deferred = ((ubus_ResponseHandler *)handler)->deferred;
+	if (!result) {
+		if (retval == UBUS_STATUS_OK) {
+			print_method_error();
+			retval = UBUS_STATUS_UNKNOWN_ERROR;
+		}
+		// deferred response won't be completed by the failed callback
+		ubus_ResponseHandler_complete_deferred((ubus_ResponseHandler *)handler, retval);
+	} else {
+		Py_DECREF(result);  // we don't care about the result
+	}
+
+method_handler_cleanup2:
+	// NULLify the structures so that using this structure will we useless if a reference
+	// is left outside the callback code (deferred responses stay linked until completed)
+	if (!((ubus_ResponseHandler *)handler)->deferred) {
+		Py_CLEAR(((ubus_ResponseHandler *)handler)->connection);
+		((ubus_ResponseHandler *)handler)->req = NULL;
+		((ubus_ResponseHandler *)handler)->ctx = NULL;
+		((ubus_ResponseHandler *)handler)->stats = NULL;
+	}
+	Py_DECREF(handler);
+method_handler_cleanup1:
+	Py_XDECREF(data_object);
+method_handler_exit:
+	if (stats && !deferred) {
+		stats_record_status(stats, retval);
+	}
+
+	if (--object->busy == 0 && object->removed) {
+		release_object(connection, object);
+	}
+	Py_DECREF(connection);
+
+	// Clear python exceptions
+	PyErr_Clear();
+
+	PyGILState_Release(gstate);
+
+	return retval;
+}
+
+static bool test_methods_argument(PyObject *methods)
+{
+	if (!methods) {
+		return false;
+	}
+
+	PyObject *method_name = NULL, *value = NULL;
+	Py_ssize_t pos = 0;
+	// Iterate through methods
+	while(PyDict_Next(methods, &pos, &method_name, &value)) {
+		// Test name
+		if (!PyStr_Check(method_name)) {
+			return false;
+		}
+		if (!PyDict_Check(value)) {
+			return false;
+		}
+
+		// Dict should contain only two elemnts - 'signature' and 'method'
+		if (PyDict_Size(value) != 2) {
+				return false;
+		}
+
+		// Test signature
+		PyObject *signature = PyDict_GetItemString(value, "signature");
+		if (!signature || !PyDict_Check(signature)) {
+			return false;
+		}
+		Py_ssize_t sig_pos = 0;
+		PyObject *signature_name = NULL, *signature_type = NULL;
+		while (PyDict_Next(signature, &sig_pos, &signature_name, &signature_type)) {
+			if (!PyStr_Check(signature_name)) {
+				return false;
+			}
+			if (!PyInt_Check(signature_type)) {
+				return false;
+			}
+			int type = PyLong_AsLong(signature_type);
+			if (type < 0 || type > BLOBMSG_TYPE_LAST) {  // indexed from 0
+				return false;
+			}
+		}
+
+		// Test callable
+		PyObject *method = PyDict_GetItemString(value, "method");
+		if (!method || !PyCallable_Check(method)) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+/* objects are kept in an array which is indexed by their names */
+
+static ubus_Object *find_object(ubus_Connection *connection, const char *name)
+{
+	int idx = name_index_find(&connection->object_index, name);
+	return idx < 0 ? NULL : connection->objects[idx];
+}
+
+/* makes room for count more objects so that inserting them can't fail */
+static bool reserve_objects(ubus_Connection *connection, size_t count)
+{
+	size_t needed = connection->objects_size + count;
+	if (needed > connection->objects_capacity) {
+		size_t capacity = connection->objects_capacity ? connection->objects_capacity : 8;
+		while (capacity < needed) {
+			capacity *= 2;
+		}
+		ubus_Object **objects = realloc(connection->objects, capacity * sizeof(*connection->objects));
+		if (!objects) {
+			PyErr_Format(PyExc_MemoryError, MSG_ALLOCATION_FAILS);
+			return false;
+		}
+		connection->objects = objects;
+		connection->objects_capacity = capacity;
+	}
+	if (!name_index_reserve(&connection->object_index, needed)) {
+		PyErr_Format(PyExc_MemoryError, MSG_ALLOCATION_FAILS);
+		return false;
+	}
+	return true;
+}
+
+static void insert_object(ubus_Connection *connection, ubus_Object *object)
+{
+	name_index_insert(&connection->object_index, object->object.name, connection->objects_size);
+	connection->objects[connection->objects_size++] = object;
+}
+
+/* the last object takes the place of the removed one */
+static void remove_object(ubus_Connection *connection, ubus_Object *object)
+{
+	int idx = name_index_find(&connection->object_index, object->object.name);
+	if (idx < 0) {
+		return;
+	}
+	name_index_remove(&connection->object_index, object->object.name);
+	ubus_Object *last = connection->objects[--connection->objects_size];
+	if (last != object) {
+		connection->objects[idx] = last;
+		name_index_update(&connection->object_index, last->object.name, idx);
+	}
+}
+
+/* frees the object unless its methods are being called (the method handler frees it then) */
+void release_object(ubus_Connection *connection, ubus_Object *object)
+{
+	if (object->busy) {
+		object->removed = true;
+		return;
+	}
+
+	// deferred responses can't record the stats of the object anymore
+	ubus_ResponseHandler *handler;
+	list_for_each_entry(handler, &connection->deferred_handlers, list) {
+		if ((char *)handler->stats >= (char *)object->dispatch
+				&& (char *)handler->stats < (char *)(object->dispatch + object->object.n_methods)) {
+			handler->stats = NULL;
+		}
+	}
+	free_ubus_object(object);
+}
+
+/* creates an object which is not added yet (NULL is returned when the arguments are invalid) */
+static ubus_Object *create_object(ubus_Connection *self, PyObject *object_name, PyObject *methods,
+		bool keywords, enum message_format format)
+{
+	// test arguments
+	if (!PyStr_Check(object_name)) {
+		PyErr_Format(PyExc_TypeError, MSG_ADD_SIGNATURE_INVALID);
+		return NULL;
+	}
+
+	if (!test_methods_argument(methods)) {
+		PyErr_Format(PyExc_TypeError, MSG_ADD_SIGNATURE_INVALID);
+		return NULL;
+	}
+
+	// allocate the object
+	ubus_Object *object = calloc(1, sizeof(ubus_Object));
+	if (!object) {
+		PyErr_Format(PyExc_MemoryError, MSG_ALLOCATION_FAILS);
+		return NULL;
+	}
+	Py_INCREF(object_name);
+	object->name = object_name;
+	Py_INCREF(methods);
+	object->methods = methods;
+	object->connection = self;
+	object->keywords = keywords;
+	object->format = format;
+
+	// set the object
+	object->object.name = PyUnicode_AsUTF8(object_name);
+	object->object.n_methods = PyDict_Size(methods);
+	if (!object->object.name) {
+		free_ubus_object(object);
+		return NULL;
+	}
+
+	// dispatch table is built here so that the handler doesn't need to search for the method
+	if (!name_index_init(&object->method_index, object->object.n_methods)) {
+		free_ubus_object(object);
+		PyErr_Format(PyExc_MemoryError, MSG_ALLOCATION_FAILS);
+		return NULL;
+	}
+
+	if (object->object.n_methods > 0) {
+		struct ubus_method *ubus_methods = calloc(object->object.n_methods, sizeof(struct ubus_method));
+		object->dispatch = calloc(object->object.n_methods, sizeof(ubus_Method));
+		if (!ubus_methods || !object->dispatch) {
+			free(ubus_methods);
+			free_ubus_object(object);
+			PyErr_Format(PyExc_MemoryError, MSG_ALLOCATION_FAILS);
+			return NULL;
+		}
+		// assign methods
+		object->object.methods = ubus_methods;
+
+		PyObject *method_name = NULL, *value = NULL;
+		Py_ssize_t pos = 0;
+		// Iterate through methods
+		for (int i = 0; PyDict_Next(methods, &pos, &method_name, &value); i++) {
+			ubus_methods[i].name = PyUnicode_AsUTF8(method_name);
+			ubus_methods[i].handler = ubus_python_method_handler;
+			name_index_insert(&object->method_index, ubus_methods[i].name, i);
+
+			object->dispatch[i].callable = PyDict_GetItemString(value, "method");
+			Py_INCREF(object->dispatch[i].callable);
+
+			// alocate and set policy objects
+			PyObject *signature = PyDict_GetItemString(value, "signature");
+			Py_ssize_t signature_size = PyDict_Size(signature);
+			struct blobmsg_policy *policy = calloc(signature_size, sizeof(struct blobmsg_policy));
+			if (object->keywords) {
+				object->dispatch[i].names = PyTuple_New(signature_size);
+			}
+			if (!policy || !name_index_init(&object->dispatch[i].policy_index, signature_size)
+					|| (object->keywords && !object->dispatch[i].names)) {
+				// dealloc allocated data
+				free(policy);
+				free_ubus_object(object);
+				PyErr_Format(PyExc_MemoryError, MSG_ALLOCATION_FAILS);
+				return NULL;
+			}
+			Py_ssize_t sig_pos = 0;
+			PyObject *signature_name = NULL, *signature_type = NULL;
+			for (int j = 0; PyDict_Next(signature, &sig_pos, &signature_name, &signature_type); j++) {
+				policy[j].name = PyUnicode_AsUTF8(signature_name);
+				policy[j].type = PyLong_AsLong(signature_type);
+				name_index_insert(&object->dispatch[i].policy_index, policy[j].name, j);
+				if (object->keywords) {
+					Py_INCREF(signature_name);
+					PyTuple_SET_ITEM(object->dispatch[i].names, j, signature_name);
+				}
+			}
+			ubus_methods[i].policy = policy;
+			ubus_methods[i].n_policy = signature_size;
+		}
+	}
+
+	object->object.type = calloc(1, sizeof(struct ubus_object_type));
+	if (!object->object.type) {
+		free_ubus_object(object);
+		PyErr_Format(PyExc_MemoryError, MSG_ALLOCATION_FAILS);
+		return NULL;
+	}
+	object->object.type->name = object->object.name;
+	object->object.type->methods = object->object.methods;
+	object->object.type->n_methods = object->object.n_methods;
+
+	return object;
+}
+
+/*
+ * Adds the objects to ubus. Either all of them are added or none of them (the added ones
+ * are removed again when adding some of them fails). The objects are freed on failure.
+ */
+static bool register_objects(ubus_Connection *self, ubus_Object **objects, size_t count)
+{
+	size_t added = 0;
+	int ret = UBUS_STATUS_OK;
+
+	for (size_t i = 0; i < count; i++) {
+		if (find_object(self, objects[i]->object.name)) {
+			ret = UBUS_STATUS_INVALID_ARGUMENT;  // ubusd would refuse it as well
+			goto register_objects_error;
+		}
+	}
+	if (!reserve_objects(self, count)) {
+		goto register_objects_error;
+	}
+
+	for (; added < count; added++) {
+		ret = ubus_add_object(self->ctx, &objects[added]->object);
+		if (ret) {
+			goto register_objects_error;
+		}
+		insert_object(self, objects[added]);
+	}
+
+	return true;
+
+register_objects_error:
+	if (ret) {
+		PyErr_Format(
+				PyExc_RuntimeError,
+				"ubus error occured: %s", ubus_strerror(ret)
+		);
+	}
+	for (size_t i = 0; i < added; i++) {
+		ubus_remove_object(self->ctx, &objects[i]->object);
+		remove_object(self, objects[i]);
+	}
+	for (size_t i = 0; i < count; i++) {
+		free_ubus_object(objects[i]);
+	}
+	return false;
+}
+
+PyDoc_STRVAR(
+	connect_add_doc,
+	"add(object_name, methods, keywords=False, raw=False, lazy=False)\n"
+	"\n"
+	"Adds an object to ubus.\n"
+	"methods should look like this: \n"
+	"{ \n"
+	"	<method_name>: {'signature': <method_signature>, 'method': <callable>} \n"
+	"} \n"
+	"\n"
+	"{ \n"
+	"	test: {'signature': {'argument1': BLOBMSG_TYPE_STRING}, 'method': my_callback} \n"
+	"} \n"
+	"\n"
+	":param object_name: the name of the object which will be present on ubus \n"
+	":type object_name: str\n"
+	":param methods: {<method_name>: callable} where callable signature is (request, msg) \n"
+	":type methods: dict\n"
+	":param keywords: callables are called as (request, **msg) and the arguments are decoded \n"
+	"                 directly according to the signature \n"
+	":type keywords: bool\n"
+	":param raw: msg is passed to the callables as serialized blobmsg message (bytes) \n"
+	":type raw: bool\n"
+	":param lazy: msg is passed to the callables as MessageView which decodes fields on access \n"
+	":type lazy: bool\n"
+);
+
+static PyObject *ubus_Connection_add(ubus_Connection *self, PyObject *args, PyObject *kwargs)
+{
+	if (!CONNECTED(self)) {
+		PyErr_Format(PyExc_RuntimeError, MSG_NOT_CONNECTED);
+		return NULL;
+	}
+
+	// arguments
+	PyObject *object_name = NULL;
+	PyObject *methods= NULL;
+	PyObject *keywords = Py_False, *raw = Py_False, *lazy = Py_False;
+	static char *kwlist[] = {"object_name", "methods", "keywords", "raw", "lazy", NULL};
+	// the options can be passed only as keywords
+	if (PyTuple_Size(args) > 2) {
+		PyErr_Format(PyExc_TypeError, MSG_ADD_SIGNATURE_INVALID);
+		return NULL;
+	}
+	if (!PyArg_ParseTupleAndKeywords(args, kwargs, "OO|O!O!O!", kwlist, &object_name, &methods,
+				&PyBool_Type, &keywords, &PyBool_Type, &raw, &PyBool_Type, &lazy)){
+		return NULL;
+	}
+	enum message_format format;
+	if (!parse_message_format(raw, lazy, &format)) {
+		return NULL;
+	}
+	if (keywords == Py_True && format != FORMAT_DECODED) {
+		PyErr_Format(PyExc_TypeError, "keywords can't be combined with raw or lazy.");
+		return NULL;
+	}
+
+	ubus_Object *object = create_object(self, object_name, methods, keywords == Py_True, format);
+	if (!object || !register_objects(self, &object, 1)) {
+		return NULL;
+	}
+
+	Py_INCREF(Py_None);
+	return Py_None;
+}
+
+PyDoc_STRVAR(
+	connect_add_many_doc,
+	"add_many(objects, keywords=False, raw=False, lazy=False)\n"
+	"\n"
+	"Adds several objects to ubus. All of them are checked before any of them is added\n"
+	"and the added ones are removed again when adding some of them fails.\n"
+	"\n"
+	":param objects: {<object_name>: <methods>} where methods are the same as in add() \n"
+	":type objects: dict\n"
+	":param keywords: the same as in add() \n"
+	":type keywords: bool\n"
+	":param raw: the same as in add() \n"
+	":type raw: bool\n"
+	":param lazy: the same as in add() \n"
+	":type lazy: bool\n"
+);
+
+static PyObject *ubus_Connection_add_many(ubus_Connection *self, PyObject *args, PyObject *kwargs)
+{
+	if (!CONNECTED(self)) {
+		PyErr_Format(PyExc_RuntimeError, MSG_NOT_CONNECTED);
+		return NULL;
+	}
+
+	PyObject *objects = NULL;
+	PyObject *keywords = Py_False, *raw = Py_False, *lazy = Py_False;
+	static char *kwlist[] = {"objects", "keywords", "raw", "lazy", NULL};
+	if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O!|O!O!O!", kwlist, &PyDict_Type, &objects,
+				&PyBool_Type, &keywords, &PyBool_Type, &raw, &PyBool_Type, &lazy)){
+		return NULL;
+	}
+	enum message_format format;
+	if (!parse_message_format(raw, lazy, &format)) {
+		return NULL;
+	}
+	if (keywords == Py_True && format != FORMAT_DECODED) {
+		PyErr_Format(PyExc_TypeError, "keywords can't be combined with raw or lazy.");
+		return NULL;
+	}
+
+	Py_ssize_t count = PyDict_Size(objects);
+	ubus_Object **created = calloc(count ? count : 1, sizeof(ubus_Object *));
+	if (!created) {
+		PyErr_Format(PyExc_MemoryError, MSG_ALLOCATION_FAILS);
+		return NULL;
+	}
+
+	// validate all the objects first
+	PyObject *object_name = NULL, *methods = NULL;
+	Py_ssize_t pos = 0, i = 0;
+	while (PyDict_Next(objects, &pos, &object_name, &methods)) {
+		created[i] = create_object(self, object_name, methods, keywords == Py_True, format);
+		if (!created[i]) {
+			while (i > 0) {
+				free_ubus_object(created[--i]);
+			}
+			free(created);
+			return NULL;
+		}
+		i++;
+	}
+
+	bool registered = register_objects(self, created, count);
+	free(created);
+	if (!registered) {
+		return NULL;
+	}
+
+	Py_INCREF(Py_None);
+	return Py_None;
+}
+
+PyDoc_STRVAR(
+	connect_remove_doc,
+	"remove(object_name)\n"
+	"\n"
+	"Removes an object which was added to ubus.\n"
+	"Its deferred responses can be still completed.\n"
+	"\n"
+	":param object_name: the name of the object \n"
+	":type object_name: str\n"
+);
+
+static PyObject *ubus_Connection_remove(ubus_Connection *self, PyObject *args, PyObject *kwargs)
+{
+	if (!CONNECTED(self)) {
+		PyErr_Format(PyExc_RuntimeError, MSG_NOT_CONNECTED);
+		return NULL;
+	}
+
+	char *object_name = NULL;
+	static char *kwlist[] = {"object_name", NULL};
+	if (!PyArg_ParseTupleAndKeywords(args, kwargs, "s", kwlist, &object_name)){
+		return NULL;
+	}
+
+	ubus_Object *object = find_object(self, object_name);
+	if (!object) {
+		PyErr_Format(PyExc_RuntimeError, "Object '%s' was not added.", object_name);
+		return NULL;
+	}
+
+	int ret = ubus_remove_object(self->ctx, &object->object);
+	if (ret) {
+		PyErr_Format(
+				PyExc_RuntimeError,
+				"ubus error occured: %s", ubus_strerror(ret)
+		);
+		return NULL;
+	}
+	remove_object(self, object);
+	release_object(self, object);
+
+	Py_INCREF(Py_None);
+	return Py_None;
+}
+
+static void ubus_python_objects_handler(struct ubus_context *c, struct ubus_object_data *o, void *p)
+{
+	// should be a single instance for all the objects
+	PyObject *objects = (PyObject *)p;
+
+	// signature is a table of methods whose values are tables of argument types
+	PyObject *signatures = o->signature ?
+		decode_attrs(blob_data(o->signature), blob_len(o->signature), true) : PyDict_New();
+	if (!signatures) {
+		goto object_handler_cleanup;
+	}
+
+	// Add it to dict object
+	PyObject *path = PyUnicode_FromString(o->path);
+	if (!path) {
+		Py_DECREF(signatures);
+		goto object_handler_cleanup;
+	}
+	PyDict_SetItem(objects, path, signatures);  // we don't care about retval here
+	Py_DECREF(path);
+	Py_DECREF(signatures);
+
+object_handler_cleanup:
+	// Clear python exceptions
+	PyErr_Clear();
+}
+
+/* the same matching as ubusd uses for lookups */
+static bool object_path_matches(const char *pattern, const char *path)
+{
+	size_t len = strlen(pattern);
+	if (len > 0 && pattern[len - 1] == '*') {
+		return !strncmp(pattern, path, len - 1);
+	}
+	return !strcmp(pattern, path);
+}
+
+/* looks up the objects which were added since the catalogue was used */
+static int update_catalogue(ubus_Connection *connection)
+{
+	PyObject *catalogue = connection->catalogue;
+
+	if (!catalogue) {
+		catalogue = PyDict_New();
+		if (!catalogue) {
+			return -1;
+		}
+		int retval = ubus_lookup(connection->ctx, "*", ubus_python_objects_handler, catalogue);
+		if (retval != UBUS_STATUS_OK && retval != UBUS_STATUS_NOT_FOUND) {
+			Py_DECREF(catalogue);
+			return retval;
+		}
+		// objects added meanwhile are marked by the object events
+		connection->catalogue = catalogue;
+		return UBUS_STATUS_OK;
+	}
+
+	PyObject *added = PyList_New(0);
+	if (!added) {
+		return -1;
+	}
+	PyObject *path = NULL, *signatures = NULL;
+	Py_ssize_t pos = 0;
+	while (PyDict_Next(catalogue, &pos, &path, &signatures)) {
+		if (signatures == Py_None && PyList_Append(added, path)) {
+			Py_DECREF(added);
+			return -1;
+		}
+	}
+
+	int retval = UBUS_STATUS_OK;
+	Py_INCREF(catalogue);  // an object event can't drop it during the lookup
+	for (Py_ssize_t i = 0; i < PyList_GET_SIZE(added); i++) {
+		path = PyList_GET_ITEM(added, i);
+		if (PyDict_DelItem(catalogue, path)) {
+			PyErr_Clear();  // removed meanwhile
+			continue;
+		}
+		retval = ubus_lookup(connection->ctx, PyUnicode_AsUTF8(path), ubus_python_objects_handler, catalogue);
+		if (retval == UBUS_STATUS_NOT_FOUND) {
+			retval = UBUS_STATUS_OK;  // removed meanwhile
+		} else if (retval != UBUS_STATUS_OK) {
+			// try it the next time
+			if (PyDict_SetItem(catalogue, path, Py_None)) {
+				PyErr_Clear();
+			}
+			break;
+		}
+	}
+	Py_DECREF(catalogue);
+	Py_DECREF(added);
+
+	if (retval == UBUS_STATUS_OK && !connection->catalogue) {
+		// the catalogue was dropped meanwhile -> fill it again
+		return update_catalogue(connection);
+	}
+
+	return retval;
+}
+
+/* the signatures are copied so that the catalogue can't be changed by the caller */
+static PyObject *list_catalogue(PyObject *catalogue, const char *ubus_path)
+{
+	PyObject *res = PyDict_New();
+	if (!res) {
+		return NULL;
+	}
+
+	PyObject *path = NULL, *signatures = NULL;
+	Py_ssize_t pos = 0;
+	while (PyDict_Next(catalogue, &pos, &path, &signatures)) {
+		if (signatures == Py_None || !object_path_matches(ubus_path, PyUnicode_AsUTF8(path))) {
+			continue;
+		}
+		PyObject *copy = PyDict_New();
+		if (!copy || PyDict_SetItem(res, path, copy)) {
+			Py_XDECREF(copy);
+			goto list_catalogue_error;
+		}
+		Py_DECREF(copy);
+
+		PyObject *method = NULL, *signature = NULL;
+		Py_ssize_t method_pos = 0;
+		while (PyDict_Next(signatures, &method_pos, &method, &signature)) {
+			PyObject *signature_copy = PyDict_Copy(signature);
+			if (!signature_copy || PyDict_SetItem(copy, method, signature_copy)) {
+				Py_XDECREF(signature_copy);
+				goto list_catalogue_error;
+			}
+			Py_DECREF(signature_copy);
+		}
+	}
+
+	return res;
+
+list_catalogue_error:
+	Py_DECREF(res);
+	return NULL;
+}
+
+PyDoc_STRVAR(
+	connect_objects_doc,
+	"objects(path='*', cached=False)\n"
+	"\n"
+	"Prints all objects present on ubus\n"
+	"\n"
+	":param path: only object which match the given path \n"
+	":type path: str\n"
+	":param cached: the objects are looked up only once and then kept current according to \n"
+	"               ubus.object.add and ubus.object.remove events (processed within loop()) \n"
+	":type cached: bool\n"
+	":return: {<object_path>: {{<function_name>: <function_signature>}, ...}, ...} \n"
+	":rtype: dict\n"
+);
+
+static PyObject *ubus_Connection_objects(ubus_Connection *self, PyObject *args, PyObject *kwargs)
+{
+	if (!CONNECTED(self)) {
+		PyErr_Format(PyExc_RuntimeError, MSG_NOT_CONNECTED);
+		return NULL;
+	}
+
+	char *ubus_path = NULL;
+	PyObject *cached = Py_False;
+	static char *kwlist[] = {"path", "cached", NULL};
+	if (!PyArg_ParseTupleAndKeywords(args, kwargs, "|sO!", kwlist, &ubus_path, &PyBool_Type, &cached)){
+		return NULL;
+	}
+
+	ubus_path = ubus_path ? ubus_path : "*";
+
+	int retval = UBUS_STATUS_OK;
+	if (cached == Py_True) {
+		// the catalogue can be kept current only when the object events are received
+		retval = init_object_events(self);
+		if (retval == UBUS_STATUS_OK) {
+			retval = update_catalogue(self);
+		}
+		if (retval < 0) {
+			return NULL;
+		}
+		if (retval == UBUS_STATUS_OK) {
+			return list_catalogue(self->catalogue, ubus_path);
+		}
+	} else {
+		PyObject *res = PyDict_New();
+		if (!res) {
+			return NULL;
+		}
+
+		retval = ubus_lookup(self->ctx, ubus_path, ubus_python_objects_handler, res);
+		if (retval == UBUS_STATUS_OK || retval == UBUS_STATUS_NOT_FOUND) {
+			return res;
+		}
+		Py_DECREF(res);
+	}
+
+	PyErr_Format(
+			PyExc_RuntimeError,
+			"ubus error occured: %s", ubus_strerror(retval)
+	);
+	return NULL;
+}
+
+/* subscribers */
+
+void free_ubus_subscriber(ubus_Subscriber *subscriber)
+{
+	list_del(&subscriber->list);
+	Py_XDECREF(subscriber->callback);
+	free(subscriber->object);
+	free(subscriber);
+}
+
+PyDoc_STRVAR(
+	connect_notify_doc,
+	"notify(object, type, data)\n"
+	"\n"
+	"Sends a notification to the subscribers of an object added by this connection.\n"
+	"\n"
+	":param object: path of the object \n"
+	":type object: str\n"
+	":param type: type of the notification \n"
+	":type type: str\n"
+	":param data: python object which can be serialized to json \n"
+	":type data: dict or list \n"
+	":return: True if the notification was sent, False if there are no subscribers \n"
+	":rtype: bool \n"
+);
+
+static PyObject *ubus_Connection_notify(ubus_Connection *self, PyObject *args, PyObject *kwargs)
+{
+	if (!CONNECTED(self)) {
+		PyErr_Format(PyExc_RuntimeError, MSG_NOT_CONNECTED);
+		return NULL;
+	}
+
+	char *object = NULL, *type = NULL;
+	PyObject *data = NULL;
+	static char *kwlist[] = {"object", "type", "data", NULL};
+	if (!PyArg_ParseTupleAndKeywords(args, kwargs, "ssO", kwlist, &object, &type, &data)){
+		return NULL;
+	}
+
+	ubus_Object *obj = find_object(self, object);
+	if (!obj) {
+		PyErr_Format(PyExc_RuntimeError, "Object '%s' was not added.", object);
+		return NULL;
+	}
+
+	if (!obj->object.has_subscribers) {
+		// nobody would receive the message
+		return prepare_bool(false);
+	}
+
+	// the message is encoded once and ubusd passes it to all the subscribers
+	if (!encode_message(&self->buf, data)) {
+		return NULL;
+	}
+
+	int retval = ubus_notify(self->ctx, &obj->object, type, self->buf.head, -1);
+	if (retval != UBUS_STATUS_OK) {
+		PyErr_Format(
+				PyExc_RuntimeError,
+				"ubus error occured: %s", ubus_strerror(retval)
+		);
+		return NULL;
+	}
+
+	return prepare_bool(true);
+}
+
+static int ubus_python_notification_handler(struct ubus_context *ctx, struct ubus_object *obj,
+			struct ubus_request_data *req, const char *method, struct blob_attr *msg)
+{
+	struct ubus_subscriber *s = container_of(obj, struct ubus_subscriber, obj);
+	ubus_Subscriber *subscriber = container_of(s, ubus_Subscriber, subscriber);
+
+	PyGILState_STATE gstate = PyGILState_Ensure();
+
+	// callback may unsubscribe and release the subscriber
+	PyObject *callback = subscriber->callback;
+	Py_INCREF(callback);
+
+	PyObject *data_object = decode_message_format(msg, subscriber->format);
+	if (!data_object) {
+		goto notification_handler_cleanup;
+	}
+
+	PyObject *result = PyObject_CallFunction(callback, "sO", method, data_object);
+	if (result) {
+		Py_DECREF(result);  // result of the callback is quite useless
+	} else {
+		PyErr_Print();
+	}
+	Py_DECREF(data_object);
+
+notification_handler_cleanup:
+	Py_DECREF(callback);
+
+	// Clear python exceptions
+	PyErr_Clear();
+
+	PyGILState_Release(gstate);
+
+	return UBUS_STATUS_OK;
+}
+
+PyDoc_STRVAR(
+	connect_subscribe_doc,
+	"subscribe(object, callback, raw=False, lazy=False)\n"
+	"\n"
+	"Subscribes for the notifications of an object.\n"
+	"\n"
+	":param object: path of the object \n"
+	":type object: str\n"
+	":param callback: function which is called with (type, data) arguments \n"
+	":type callback: callable\n"
+	":param raw: pass the data to the callback as serialized blobmsg messages (bytes) \n"
+	":type raw: bool\n"
+	":param lazy: pass the data to the callback as MessageView which decodes fields on access \n"
+	":type lazy: bool\n"
+);
+
+static PyObject *ubus_Connection_subscribe(ubus_Connection *self, PyObject *args, PyObject *kwargs)
+{
+	if (!CONNECTED(self)) {
+		PyErr_Format(PyExc_RuntimeError, MSG_NOT_CONNECTED);
+		return NULL;
+	}
+
+	char *object = NULL;
+	PyObject *callback = NULL, *raw = Py_False, *lazy = Py_False;
+	static char *kwlist[] = {"object", "callback", "raw", "lazy", NULL};
+	if (!PyArg_ParseTupleAndKeywords(args, kwargs, "sO|O!O!", kwlist, &object, &callback,
+				&PyBool_Type, &raw, &PyBool_Type, &lazy)){
+		return NULL;
+	}
+	enum message_format format;
+	if (!parse_message_format(raw, lazy, &format)) {
+		return NULL;
+	}
+
+	if (!PyCallable_Check(callback)) {
+		PyErr_Format(PyExc_TypeError, "callback must be callable.");
+		return NULL;
+	}
+
+	bool cached = false;
+	uint32_t id = 0;
+	if (lookup_object_id(self, object, &id, &cached) != UBUS_STATUS_OK) {
+		PyErr_Format(PyExc_RuntimeError, "Object '%s' was not found.", object);
+		return NULL;
+	}
+
+	ubus_Subscriber *subscriber = calloc(1, sizeof(ubus_Subscriber));
+	if (!subscriber) {
+		PyErr_Format(PyExc_MemoryError, MSG_ALLOCATION_FAILS);
+		return NULL;
+	}
+	INIT_LIST_HEAD(&subscriber->list);
+	subscriber->object = strdup(object);
+	if (!subscriber->object) {
+		free_ubus_subscriber(subscriber);
+		PyErr_Format(PyExc_MemoryError, MSG_ALLOCATION_FAILS);
+		return NULL;
+	}
+	subscriber->subscriber.cb = ubus_python_notification_handler;
+	subscriber->format = format;
+	subscriber->callback = callback;
+	Py_INCREF(callback);
+
+	int retval = ubus_register_subscriber(self->ctx, &subscriber->subscriber);
+	if (retval != UBUS_STATUS_OK) {
+		goto subscribe_error;
+	}
+
+	retval = ubus_subscribe(self->ctx, &subscriber->subscriber, id);
+	if (retval == UBUS_STATUS_NOT_FOUND && cached) {
+		// object might have been re-registered with a different id
+		invalidate_object_id(self, object);
+		if (lookup_object_id(self, object, &id, &cached) == UBUS_STATUS_OK) {
+			retval = ubus_subscribe(self->ctx, &subscriber->subscriber, id);
+		}
+	}
+	if (retval != UBUS_STATUS_OK) {
+		ubus_unregister_subscriber(self->ctx, &subscriber->subscriber);
+		goto subscribe_error;
+	}
+
+	list_add_tail(&subscriber->list, &self->subscribers);
+
+	Py_INCREF(Py_None);
+	return Py_None;
+
+subscribe_error:
+	free_ubus_subscriber(subscriber);
+	PyErr_Format(
+			PyExc_RuntimeError,
+			"ubus error occured: %s", ubus_strerror(retval)
+	);
+	return NULL;
+}
+
+PyDoc_STRVAR(
+	connect_unsubscribe_doc,
+	"unsubscribe(object)\n"
+	"\n"
+	"Removes all the subscriptions of an object.\n"
+	"\n"
+	":param object: path of the object \n"
+	":type object: str\n"
+	":return: True if a subscription was removed, False otherwise \n"
+	":rtype: bool \n"
+);
+
+static PyObject *ubus_Connection_unsubscribe(ubus_Connection *self, PyObject *args, PyObject *kwargs)
+{
+	if (!CONNECTED(self)) {
+		PyErr_Format(PyExc_RuntimeError, MSG_NOT_CONNECTED);
+		return NULL;
+	}
+
+	char *object = NULL;
+	static char *kwlist[] = {"object", NULL};
+	if (!PyArg_ParseTupleAndKeywords(args, kwargs, "s", kwlist, &object)){
+		return NULL;
+	}
+
+	bool removed = false;
+	ubus_Subscriber *subscriber, *tmp;
+	list_for_each_entry_safe(subscriber, tmp, &self->subscribers, list) {
+		if (strcmp(subscriber->object, object)) {
+			continue;
+		}
+		// the subscription is dropped by ubusd along with the subscriber object
+		ubus_unregister_subscriber(self->ctx, &subscriber->subscriber);
+		free_ubus_subscriber(subscriber);
+		removed = true;
+	}
+
+	return prepare_bool(removed);
+}
+
+struct call_results {
+	PyObject *list;  // NULL when an error occured
+	enum message_format format;
+	struct stats *stats;  // NULL when the statistics are disabled
+};
+
+static void ubus_python_call_handler(struct ubus_request *req, int type, struct blob_attr *msg)
+{
+	assert(type == UBUS_MSG_DATA);
+
+	struct call_results *results = (struct call_results *)req->priv;
+	if (!results->list) {
+		// error has occured in some previous call -> exit
+		return;
+	}
+
+	// call() waits for the replies without the GIL
+	PyGILState_STATE gstate = PyGILState_Ensure();
+
+	if (!msg) {
+		PyErr_Format(PyExc_RuntimeError, "No data in call hander");
+		goto call_handler_cleanup;
+	}
+
+	// convert message to python object
+	uint64_t start = results->stats ? stats_now() : 0;
+	PyObject *data_object = decode_message_format(msg, results->format);
+	if (!data_object) {
+		goto call_handler_cleanup;
+	}
+	if (results->stats) {
+		stats_record_latency(&results->stats->decode, stats_now() - start);
+		results->stats->bytes_in += blob_len(msg);
+	}
+
+	// append to results
+	int failed = PyList_Append(results->list, data_object);
+	Py_DECREF(data_object);
+	if (failed) {
+		goto call_handler_cleanup;
+	}
+
+	PyGILState_Release(gstate);
+	return;
+
+	call_handler_cleanup:
+
+	// clear the result
+	Py_CLEAR(results->list);
+
+	PyGILState_Release(gstate);
+}
+
+PyDoc_STRVAR(
+	connect_call_doc,
+	"call(object, method, arguments, timeout=0, raw=False, lazy=False)\n"
+	"\n"
+	"Calls object's method on ubus.\n"
+	"\n"
+	":param object: name of the object\n"
+	":type object: str\n"
+	":param method: name of the method\n"
+	":type method: str\n"
+	":param arguments: arguments of the method (should be JSON serialisable).\n"
+	":type argument: dict\n"
+	":param timeout: timeout in ms (0 = wait forever)\n"
+	":type timeout: int\n"
+	":param raw: return the replies as serialized blobmsg messages (bytes)\n"
+	":type raw: bool\n"
+	":param lazy: return the replies as MessageView which decodes fields on access\n"
+	":type lazy: bool\n"
+);
+
+static PyObject *ubus_Connection_call(ubus_Connection *self, PyObject *args, PyObject *kwargs)
+{
+	if (!CONNECTED(self)) {
+		PyErr_Format(PyExc_RuntimeError, MSG_NOT_CONNECTED);
+		return NULL;
+	}
+
+	char *object = NULL, *method = NULL;
+	int timeout = 0;
+	PyObject *arguments = NULL;
+	PyObject *raw = Py_False, *lazy = Py_False;
+	static char *kwlist[] = {"object", "method", "arguments", "timeout", "raw", "lazy", NULL};
+	if (!PyArg_ParseTupleAndKeywords(
+				args, kwargs, "ssO|iO!O!", kwlist, &object, &method, &arguments, &timeout,
+				&PyBool_Type, &raw, &PyBool_Type, &lazy)){
+		return NULL;
+	}
+	struct call_results results = {NULL, FORMAT_DECODED, NULL};
+	if (!parse_message_format(raw, lazy, &results.format)) {
+		return NULL;
+	}
+	if (timeout < 0) {
+		PyErr_Format(PyExc_TypeError, "timeout can't be lower than 0");
+		return NULL;
+	}
+
+	uint32_t id = 0;
+	bool cached = false;
+	int retval = lookup_object_id(self, object, &id, &cached);
+	if (retval != UBUS_STATUS_OK) {
+		PyErr_Format(PyExc_RuntimeError, "Object '%s' was not found.", object);
+		return NULL;
+	}
+
+	// put data into buffer (the buffer is used without the GIL)
+	struct blob_buf buf;
+	memset(&buf, 0, sizeof(buf));
+	if (!encode_message(&buf, arguments)) {
+		goto call_exit;
+	}
+
+	results.list = PyList_New(0);
+	if (!results.list) {
+		goto call_exit;
+	}
+
+	results.stats = call_stats_entry(self, object, method);
+	uint64_t start = results.stats ? stats_now() : 0;
+
+	struct ubus_context *ctx = self->ctx;
+	Py_BEGIN_ALLOW_THREADS
+	retval = ubus_invoke(ctx, id, method, buf.head, ubus_python_call_handler, &results, timeout);
+	Py_END_ALLOW_THREADS
+
+	if (retval == UBUS_STATUS_NOT_FOUND && cached) {
+		// cached id might be stale -> retry once if the object was re-registered
+		uint32_t old_id = id;
+		invalidate_object_id(self, object);
+		if (lookup_object_id(self, object, &id, &cached) != UBUS_STATUS_OK) {
+			Py_CLEAR(results.list);
+			PyErr_Format(PyExc_RuntimeError, "Object '%s' was not found.", object);
+			goto call_exit;
+		}
+		if (id != old_id) {
+			Py_XDECREF(results.list);
+			results.list = PyList_New(0);
+			if (!results.list) {
+				goto call_exit;
+			}
+			Py_BEGIN_ALLOW_THREADS
+			retval = ubus_invoke(ctx, id, method, buf.head, ubus_python_call_handler, &results, timeout);
+			Py_END_ALLOW_THREADS
+		}
+	}
+
+	if (results.stats) {
+		// the whole round trip including the decoding of the replies
+		stats_record_latency(&results.stats->reply, stats_now() - start);
+		results.stats->invocations++;
+		results.stats->bytes_out += blob_len(buf.head);
+		stats_record_status(results.stats, retval);
+	}
+
+	if (retval != UBUS_STATUS_OK) {
+		Py_CLEAR(results.list);
+		PyErr_Format(
+				PyExc_RuntimeError,
+				"ubus error occured: %s", ubus_strerror(retval)
+		);
+	}
+
+call_exit:
+	blob_buf_free(&buf);
+
+	// Note that results might be NULL indicating that something went wrong in the handler
+	return results.list;
+}
+
+/* pipelined requests */
+
+int wait_for_requests(ubus_Connection *self, int *remaining, int limit, int timeout)
+{
+	// processes the replies until there are at most 'limit' requests remaining
+	struct ubus_context *ctx = self->ctx;
+	struct timespec start;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	int status = UBUS_STATUS_OK;
+
+	// other messages are queued and processed later (the same way as within ubus_invoke())
+	ctx->stack_depth++;
+	Py_BEGIN_ALLOW_THREADS
+	while (*remaining > limit) {
+		if (ctx->sock.eof || ctx->sock.error) {
+			status = UBUS_STATUS_CONNECTION_FAILED;
+			break;
+		}
+
+		int wait = -1;
+		if (timeout > 0) {
+			struct timespec now;
+			clock_gettime(CLOCK_MONOTONIC, &now);
+			wait = timeout - (now.tv_sec - start.tv_sec) * 1000 - (now.tv_nsec - start.tv_nsec) / 1000000;
+			if (wait <= 0) {
+				status = UBUS_STATUS_TIMEOUT;
+				break;
+			}
+		}
+
+		struct pollfd pfd = { .fd = ctx->sock.fd, .events = POLLIN };
+		if (poll(&pfd, 1, wait) > 0) {
+			ubus_handle_event(ctx);
+		}
+	}
+	Py_END_ALLOW_THREADS
+	ctx->stack_depth--;
+
+	return status;
+}
+
+/* send_many */
+
+#define SEND_MANY_WINDOW 32  // number of events waiting for the confirmation
+
+struct send_many_state {
+	struct ubus_request requests[SEND_MANY_WINDOW];
+	bool pending[SEND_MANY_WINDOW];
+	int remaining;
+	int sent;
+};
+
+static void ubus_python_send_many_complete_handler(struct ubus_request *req, int ret)
+{
+	struct send_many_state *state = (struct send_many_state *)req->priv;
+
+	state->pending[req - state->requests] = false;
+	state->remaining--;
+	if (ret == UBUS_STATUS_OK) {
+		state->sent++;
+	}
+}
+
+PyDoc_STRVAR(
+	connect_send_many_doc,
+	"send_many(events)\n"
+	"\n"
+	"Send several events via ubus.\n"
+	"The events are sent without waiting for the confirmation of the previous ones.\n"
+	"\n"
+	":param events: iterable of (event, data) tuples \n"
+	":type events: iterable\n"
+	":return: number of events which were sent \n"
+	":rtype: int \n"
+	"\n"
+	"All the events are encoded before sending, so nothing is sent when any of them is invalid.\n"
+	"When the sending can't continue, ubus.SendError is raised and its 'sent' attribute\n"
+	"holds the number of events which were sent before the failure.\n"
+);
+
+static void raise_send_error(int sent, const char *reason)
+{
+	PyObject *count = PyInt_FromLong(sent);
+	if (!count) {
+		return;
+	}
+	PyObject *error = PyObject_CallFunction(send_error, "s", reason);
+	if (error) {
+		if (!PyObject_SetAttrString(error, "sent", count)) {
+			PyErr_SetObject(send_error, error);
+		}
+		Py_DECREF(error);
+	}
+	Py_DECREF(count);
+}
+
+static PyObject *ubus_Connection_send_many(ubus_Connection *self, PyObject *args, PyObject *kwargs)
+{
+	if (!CONNECTED(self)) {
+		PyErr_Format(PyExc_RuntimeError, MSG_NOT_CONNECTED);
+		return NULL;
+	}
+
+	PyObject *events = NULL;
+	static char *kwlist[] = {"events", NULL};
+	if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O", kwlist, &events)){
+		return NULL;
+	}
+
+	events = PySequence_Fast(events, "events have to be iterable");
+	if (!events) {
+		return NULL;
+	}
+
+	PyObject *res = NULL;
+	struct send_many_state *state = NULL;
+	Py_ssize_t count = PySequence_Fast_GET_SIZE(events);
+	struct blob_attr **msgs = calloc(count ? count : 1, sizeof(*msgs));
+	if (!msgs) {
+		PyErr_Format(PyExc_MemoryError, MSG_ALLOCATION_FAILS);
+		goto send_many_exit;
+	}
+
+	// nothing is sent when any of the events can't be encoded
+	for (Py_ssize_t i = 0; i < count; i++) {
+		PyObject *item = PySequence_Fast_GET_ITEM(events, i);
+		char *event = NULL;
+		PyObject *data = NULL;
 		if (!PyTuple_Check(item)) {
-			PyErr_Format(PyExc_TypeError, MSG_LISTEN_TUPLE_EXPECTED);
-			goto listen_error1;
+			PyErr_Format(PyExc_TypeError, "Tuple of (event, data) expected.");
+			goto send_many_exit;
 		}
-		PyObject *item_tuple = PySequence_Fast(item, MSG_LISTEN_TUPLE_EXPECTED);
-		if (!item_tuple) {
-			PyErr_Format(PyExc_MemoryError, "Failed to obtain tuple item");
-			goto listen_error1;
+		if (!PyArg_ParseTuple(item, "sO", &event, &data) || !encode_event(&self->buf, event, data)) {
+			goto send_many_exit;
 		}
-		if (!PyTuple_Check(item_tuple) || PySequence_Size(item_tuple) != 2) {
-			PyErr_Format(PyExc_TypeError, MSG_LISTEN_TUPLE_EXPECTED);
-			Py_DECREF(item_tuple);
-			Py_DECREF(args);
-			goto listen_error1;
+		msgs[i] = blob_memdup(self->buf.head);
+		if (!msgs[i]) {
+			PyErr_Format(PyExc_MemoryError, MSG_ALLOCATION_FAILS);
+			goto send_many_exit;
 		}
+	}
 
-		// Test types
-		if (!PyStr_Check(PyTuple_GET_ITEM(item_tuple, 0))
-					|| !PyCallable_Check(PyTuple_GET_ITEM(item_tuple, 1))) {
-			PyErr_Format(PyExc_TypeError, MSG_LISTEN_TUPLE_EXPECTED);
-			Py_DECREF(item_tuple);
-			goto listen_error1;
+	state = calloc(1, sizeof(*state));
+	if (!state) {
+		PyErr_Format(PyExc_MemoryError, MSG_ALLOCATION_FAILS);
+		goto send_many_exit;
+	}
+
+	const char *failure = NULL;
+	int slot = 0;
+	for (Py_ssize_t i = 0; i < count; i++) {
+		// wait for a free slot
+		if (state->remaining >= SEND_MANY_WINDOW) {
+			if (wait_for_requests(self, &state->remaining, SEND_MANY_WINDOW - 1, 0) != UBUS_STATUS_OK) {
+				failure = "Connection failed while sending the events.";
+				break;
+			}
 		}
-		Py_DECREF(item_tuple);
+		while (state->pending[slot]) {
+			slot = (slot + 1) % SEND_MANY_WINDOW;
+		}
+
+		struct ubus_request *req = &state->requests[slot];
+		if (ubus_invoke_async(self->ctx, UBUS_SYSTEM_OBJECT_EVENT, "send", msgs[i], req)) {
+			failure = "Failed to send the event.";
+			break;
+		}
+		req->complete_cb = ubus_python_send_many_complete_handler;
+		req->priv = state;
+		state->pending[slot] = true;
+		state->remaining++;
+		ubus_complete_request_async(self->ctx, req);
 	}
 
-	// add callbacks
-	for (int i = 0; i < len; i++) {
-		PyObject *item = PySequence_Fast_GET_ITEM(args, i);
-		PyObject *item_tuple = PySequence_Fast(item, MSG_LISTEN_TUPLE_EXPECTED);
-		if (!item_tuple) {
-			PyErr_Format(PyExc_MemoryError, "Failed to obtain tuple item");
-			goto listen_error1;
+	// wait for the remaining confirmations
+	if (wait_for_requests(self, &state->remaining, 0, 0) != UBUS_STATUS_OK && !failure) {
+		failure = "Connection failed while sending the events.";
+	}
+	for (slot = 0; slot < SEND_MANY_WINDOW; slot++) {
+		if (state->pending[slot]) {
+			ubus_abort_request(self->ctx, &state->requests[slot]);
 		}
-		PyObject *event = PyTuple_GET_ITEM(item_tuple, 0);
-		PyObject *callback = PyTuple_GET_ITEM(item_tuple, 1);
-		// Keep event and callback references
-		if (PyList_Append(python_alloc_list, event) || PyList_Append(python_alloc_list, callback)) {
-			Py_DECREF(item_tuple);
-			goto listen_error1;
+	}
+
+	if (failure) {
+		raise_send_error(state->sent, failure);
+	} else {
+		res = PyInt_FromLong(state->sent);
+	}
+
+send_many_exit:
+	free(state);
+	if (msgs) {
+		for (Py_ssize_t i = 0; i < count; i++) {
+			free(msgs[i]);
 		}
-		Py_DECREF(item_tuple);
+		free(msgs);
+	}
+	Py_DECREF(events);
+
+	return res;
+}
+
+/* call_many */
+
+struct call_many_item {
+	struct ubus_request req;
+	const char *object;
+	const char *method;
+	PyObject *arguments;
+	struct blob_attr *msg;  // arguments encoded before any call is sent
+	PyObject *results;
+	uint32_t id;
+	int status;
+	bool cached;
+	bool pending;
+};
+
+static void ubus_python_call_many_data_handler(struct ubus_request *req, int type, struct blob_attr *msg)
+{
+	struct call_many_item *item = container_of(req, struct call_many_item, req);
+
+	PyGILState_STATE gstate = PyGILState_Ensure();
+
+	PyObject *data_object = decode_message(msg);
+	if (!data_object || PyList_Append(item->results, data_object)) {
+		PyErr_Print();
+	}
+	Py_XDECREF(data_object);
+
+	// Clear python exceptions
+	PyErr_Clear();
+
+	PyGILState_Release(gstate);
+}
+
+static void ubus_python_call_many_complete_handler(struct ubus_request *req, int ret)
+{
+	struct call_many_item *item = container_of(req, struct call_many_item, req);
+
+	item->status = ret;
+	item->pending = false;
+	(*(int *)req->priv)--;
+}
+
+void call_many_submit(ubus_Connection *self, struct call_many_item *item, int *remaining)
+{
+	item->status = ubus_invoke_async(self->ctx, item->id, item->method, item->msg, &item->req);
+	if (item->status != UBUS_STATUS_OK) {
+		return;
+	}
+	item->req.data_cb = ubus_python_call_many_data_handler;
+	item->req.complete_cb = ubus_python_call_many_complete_handler;
+	item->req.priv = remaining;
+	item->pending = true;
+	(*remaining)++;
+	ubus_complete_request_async(self->ctx, &item->req);
+}
+
+void call_many_abort(ubus_Connection *self, struct call_many_item *items, Py_ssize_t count, int *remaining, int status)
+{
+	for (Py_ssize_t i = 0; i < count && *remaining > 0; i++) {
+		if (items[i].pending) {
+			ubus_abort_request(self->ctx, &items[i].req);
+			items[i].pending = false;
+			items[i].status = status;
+			(*remaining)--;
+		}
+	}
+}
+
+void call_many_wait(ubus_Connection *self, struct call_many_item *items, Py_ssize_t count, int *remaining, int timeout)
+{
+	int status = wait_for_requests(self, remaining, 0, timeout);
+
+	// abort the requests which were not completed in time
+	call_many_abort(self, items, count, remaining, status);
+}
+
+PyDoc_STRVAR(
+	connect_call_many_doc,
+	"call_many(calls, timeout=0)\n"
+	"\n"
+	"Calls several methods on ubus at once.\n"
+	"All the calls are sent before waiting for the replies.\n"
+	"\n"
+	":param calls: sequence of (object, method, arguments) tuples\n"
+	":type calls: list\n"
+	":param timeout: timeout in ms for all the calls (0 = wait forever)\n"
+	":type timeout: int\n"
+	":return: (status, results) tuple for each call in the same order\n"
+	":rtype: list\n"
+);
+
+static PyObject *ubus_Connection_call_many(ubus_Connection *self, PyObject *args, PyObject *kwargs)
+{
+	if (!CONNECTED(self)) {
+		PyErr_Format(PyExc_RuntimeError, MSG_NOT_CONNECTED);
+		return NULL;
+	}
+
+	PyObject *calls = NULL;
+	int timeout = 0;
+	static char *kwlist[] = {"calls", "timeout", NULL};
+	if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O|i", kwlist, &calls, &timeout)){
+		return NULL;
+	}
+	if (timeout < 0) {
+		PyErr_Format(PyExc_TypeError, "timeout can't be lower than 0");
+		return NULL;
+	}
+
+	calls = PySequence_Fast(calls, "calls have to be a sequence");
+	if (!calls) {
+		return NULL;
+	}
+
+	PyObject *res = NULL;
+	Py_ssize_t count = PySequence_Fast_GET_SIZE(calls);
+	struct call_many_item *items = calloc(count ? count : 1, sizeof(*items));
+	if (!items) {
+		PyErr_Format(PyExc_MemoryError, MSG_ALLOCATION_FAILS);
+		goto call_many_exit1;
+	}
+
+	// check the arguments and resolve the object ids
+	for (Py_ssize_t i = 0; i < count; i++) {
+		struct call_many_item *item = &items[i];
+		PyObject *call = PySequence_Fast_GET_ITEM(calls, i);
+		if (!PyTuple_Check(call)) {
+			PyErr_Format(PyExc_TypeError, "Tuple of (object, method, arguments) expected.");
+			goto call_many_exit2;
+		}
+		if (!PyArg_ParseTuple(call, "ssO", &item->object, &item->method, &item->arguments)) {
+			goto call_many_exit2;
+		}
+		item->results = PyList_New(0);
+		if (!item->results) {
+			goto call_many_exit2;
+		}
+		// nothing is sent when any of the arguments can't be encoded
+		if (!encode_message(&self->buf, item->arguments)) {
+			goto call_many_exit2;
+		}
+		item->msg = blob_memdup(self->buf.head);
+		if (!item->msg) {
+			PyErr_Format(PyExc_MemoryError, MSG_ALLOCATION_FAILS);
+			goto call_many_exit2;
+		}
+		if (lookup_object_id(self, item->object, &item->id, &item->cached) != UBUS_STATUS_OK) {
+			item->status = UBUS_STATUS_NOT_FOUND;
+		}
+	}
+
+	// send all the requests
+	uint64_t end = timeout ? stats_now() + timeout * 1000000ULL : 0;
+	int remaining = 0;
+	for (Py_ssize_t i = 0; i < count; i++) {
+		if (items[i].status == UBUS_STATUS_OK) {
+			call_many_submit(self, &items[i], &remaining);
+		}
+	}
+	call_many_wait(self, items, count, &remaining, timeout);
+
+	// cached ids might be stale -> resend the calls if the objects were re-registered
+	for (Py_ssize_t i = 0; i < count; i++) {
+		struct call_many_item *item = &items[i];
+		if (item->status != UBUS_STATUS_NOT_FOUND || !item->cached) {
+			continue;
+		}
+		uint32_t old_id = item->id;
+		invalidate_object_id(self, item->object);
+		if (lookup_object_id(self, item->object, &item->id, &item->cached) != UBUS_STATUS_OK
+				|| item->id == old_id) {
+			continue;
+		}
+		Py_DECREF(item->results);
+		item->results = PyList_New(0);
+		if (!item->results) {
+			call_many_abort(self, items, count, &remaining, UBUS_STATUS_UNKNOWN_ERROR);
+			goto call_many_exit2;
+		}
+		call_many_submit(self, item, &remaining);
+	}
+	if (remaining) {
+		// the resent calls get only the rest of the timeout
+		uint64_t now = stats_now();
+		if (end && now >= end) {
+			call_many_abort(self, items, count, &remaining, UBUS_STATUS_TIMEOUT);
+		} else {
+			call_many_wait(self, items, count, &remaining, end ? (end - now + 999999) / 1000000 : 0);
+		}
+	}
+
+	res = PyList_New(count);
+	if (!res) {
+		goto call_many_exit2;
+	}
+	for (Py_ssize_t i = 0; i < count; i++) {
+		PyObject *item = Py_BuildValue("(iO)", items[i].status, items[i].results);
+		if (!item) {
+			Py_CLEAR(res);
+			goto call_many_exit2;
+		}
+		PyList_SET_ITEM(res, i, item);
+	}
+
+call_many_exit2:
+	for (Py_ssize_t i = 0; i < count; i++) {
+		Py_XDECREF(items[i].results);
+		free(items[i].msg);
+	}
+	free(items);
+call_many_exit1:
+	Py_DECREF(calls);
+
+	return res;
+}
+
+/* Request */
+
+typedef struct {
+	PyObject_HEAD
+	ubus_Connection *connection;
+	struct ubus_request req;
+	struct uloop_timeout timeout;
+	struct list_head list;
+	PyObject *results;
+	PyObject *callback;
+	int status;
+	bool pending;
+	bool cancelled;
+	enum message_format format;
+	bool stream;  // the replies are taken from results by iterating over the request
+	bool limit_reached;  // following replies are dropped
+	size_t max_replies, max_bytes;  // 0 = unlimited
+	size_t replies, bytes;
+} ubus_Request;
+
+static void ubus_Request_finish(ubus_Request *self, int status, bool trigger_callback)
+{
+	if (!self->pending) {
+		return;
+	}
+
+	self->pending = false;
+	self->status = status;
+	uloop_timeout_cancel(&self->timeout);
+	list_del_init(&self->list);
+
+	if (trigger_callback && self->callback && self->callback != Py_None) {
+		PyObject *result = PyObject_CallFunction(self->callback, "(iO)", status, self->results);
+		if (result) {
+			Py_DECREF(result);  // result of the callback is quite useless
+		} else {
+			PyErr_Print();
+		}
+	}
+
+	// drop the reference which was kept while the request was pending
+	Py_DECREF(self);
+}
+
+static void ubus_python_request_data_handler(struct ubus_request *req, int type, struct blob_attr *msg)
+{
+	ubus_Request *self = container_of(req, ubus_Request, req);
+
+	// the request is aborted once the replies are taken (not within the libubus callback)
+	if (self->limit_reached) {
+		return;
+	}
+	if (self->max_bytes && self->bytes + blob_len(msg) > self->max_bytes) {
+		self->limit_reached = true;
+		return;
+	}
+	self->replies++;
+	self->bytes += blob_len(msg);
+	if (self->max_replies && self->replies >= self->max_replies) {
+		self->limit_reached = true;
+	}
+
+	PyGILState_STATE gstate = PyGILState_Ensure();
+
+	PyObject *data_object = decode_message_format(msg, self->format);
+	if (!data_object || PyList_Append(self->results, data_object)) {
+		PyErr_Print();
+	}
+	Py_XDECREF(data_object);
 
-		// prepare event listener
-		ubus_Listener *listener = calloc(1, sizeof(ubus_Listener));
-		if (!listener) {
-			PyErr_Format(PyExc_MemoryError, MSG_ALLOCATION_FAILS);
-			Py_DECREF(item_tuple);
-			goto listen_error1;
-		}
+	// Clear python exceptions
+	PyErr_Clear();
 
-		listener->handler.cb = ubus_python_event_handler;
-		listener->callback = callback;
+	PyGILState_Release(gstate);
+}
 
-		ubus_Listener **new_listeners = realloc(listeners,
-			(listerners_size + 1) * sizeof(*listeners));
-		if (!new_listeners) {
-			free(listener);
-			goto listen_error1;
-		}
-		listeners = new_listeners;
-		listeners[listerners_size++] = listener;
+static void ubus_python_request_complete_handler(struct ubus_request *req, int ret)
+{
+	ubus_Request *self = container_of(req, ubus_Request, req);
 
-		// register event handler
-		int retval = ubus_register_event_handler(ctx, &listener->handler, PyUnicode_AsUTF8(event));
-		if (retval != UBUS_STATUS_OK) {
-			listerners_size--;
-			free(listener);
-		}
+	PyGILState_STATE gstate = PyGILState_Ensure();
+	ubus_Request_finish(self, ret, true);
+	PyGILState_Release(gstate);
+}
+
+static void ubus_python_request_timeout_handler(struct uloop_timeout *timeout)
+{
+	ubus_Request *self = container_of(timeout, ubus_Request, timeout);
+
+	PyGILState_STATE gstate = PyGILState_Ensure();
+	ubus_Connection *connection = self->connection;
+	Py_INCREF(connection);
+	connection_lock(connection, true);
+	if (self->pending) {
+		ubus_abort_request(connection->ctx, &self->req);
+		ubus_Request_finish(self, UBUS_STATUS_TIMEOUT, true);
 	}
+	connection_unlock(connection);
+	Py_DECREF(connection);
+	PyGILState_Release(gstate);
+}
 
-	Py_DECREF(args);
+void abort_requests(ubus_Connection *connection, bool trigger_callbacks)
+{
+	ubus_Request *request, *tmp;
+	list_for_each_entry_safe(request, tmp, &connection->pending_requests, list) {
+		ubus_abort_request(connection->ctx, &request->req);
+		ubus_Request_finish(request, UBUS_STATUS_CONNECTION_FAILED, trigger_callbacks);
+	}
+}
 
-	Py_INCREF(Py_None);
-	return Py_None;
+static void ubus_Request_dealloc(ubus_Request* self)
+{
+	PyObject_GC_UnTrack(self);
+	Py_XDECREF(self->results);
+	Py_XDECREF(self->callback);
+	Py_XDECREF(self->connection);
+	Py_TYPE(self)->tp_free((PyObject*)self);
+}
 
-listen_error1:
-	Py_DECREF(args);
-	return NULL;
+/* processes the messages which arrive within the timeout (-1 = wait until something arrives) */
+static void process_request(ubus_Request *self, int timeout)
+{
+	// request timeout is handled here as well when uloop is not running
+	int request_remaining = uloop_timeout_remaining(&self->timeout);
+	if (self->timeout.pending && request_remaining <= 0) {
+		ubus_python_request_timeout_handler(&self->timeout);
+		return;
+	}
+	if (self->timeout.pending && (timeout < 0 || request_remaining < timeout)) {
+		timeout = request_remaining;
+	}
+
+	struct ubus_context *ctx = self->connection->ctx;
+	struct pollfd pfd = { .fd = ctx->sock.fd, .events = POLLIN };
+	Py_BEGIN_ALLOW_THREADS
+	if (poll(&pfd, 1, timeout) > 0) {
+		ubus_handle_event(ctx);
+	}
+	Py_END_ALLOW_THREADS
 }
 
-static void ubus_python_timeout_handler(struct uloop_timeout *timeout) {
-	uloop_end();
+static int ubus_Request_traverse(ubus_Request *self, visitproc visit, void *arg)
+{
+	Py_VISIT(self->connection);
+	Py_VISIT(self->results);
+	Py_VISIT(self->callback);
+	return 0;
+}
+
+static int ubus_Request_clear(ubus_Request *self)
+{
+	// pending requests keep a reference to themselves so only completed ones are cleared
+	// (results hold only the decoded replies so they can't be part of a cycle)
+	Py_CLEAR(self->callback);
+	return 0;
 }
 
 PyDoc_STRVAR(
-	connect_loop_doc,
-	"loop(timeout=-1)\n"
+	Request_wait_doc,
+	"wait(timeout=-1)\n"
 	"\n"
-	"Enters a loop and processes events.\n"
+	"Processes ubus messages until the request is completed.\n"
 	"\n"
-	":param timeout: loop timeout in ms (if lower than zero then it will run forever) \n"
+	":param timeout: timeout in ms (if lower than zero then it will wait forever) \n"
 	":type timeout: int\n"
+	":return: list of the replies \n"
+	":rtype: list\n"
 );
 
-static PyObject *ubus_python_loop(PyObject *module, PyObject *args, PyObject *kwargs)
+static PyObject *ubus_Request_wait(ubus_Request *self, PyObject *args, PyObject *kwargs)
 {
-	if (!CONNECTED) {
-		PyErr_Format(PyExc_RuntimeError, MSG_NOT_CONNECTED);
-		return NULL;
-	}
-
 	int timeout = -1;
 	static char *kwlist[] = {"timeout", NULL};
 	if (!PyArg_ParseTupleAndKeywords(args, kwargs, "|i", kwlist, &timeout)){
 		return NULL;
 	}
 
-	Py_BEGIN_ALLOW_THREADS
-	if (timeout == 0) {
-		// process events directly without uloop
-		ubus_handle_event(ctx);
-	} else {
-		uloop_init();
-		struct uloop_timeout u_timeout;
-		if (timeout > 0) {
-			// prepare for timeout
-			memset(&u_timeout, 0, sizeof(u_timeout));
-			u_timeout.cb = ubus_python_timeout_handler;
-			uloop_timeout_set(&u_timeout, timeout);  // Timeout to seconds
-		}
-		uloop_run();
-		if (timeout > 0) {
-			uloop_timeout_cancel(&u_timeout);
+	if (self->pending && !CONNECTED(self->connection)) {
+		PyErr_Format(PyExc_RuntimeError, MSG_NOT_CONNECTED);
+		return NULL;
+	}
+
+	struct timespec start;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	while (self->pending) {
+		int remaining = timeout;
+		if (timeout >= 0) {
+			struct timespec now;
+			clock_gettime(CLOCK_MONOTONIC, &now);
+			remaining -= (now.tv_sec - start.tv_sec) * 1000 + (now.tv_nsec - start.tv_nsec) / 1000000;
+			if (remaining <= 0) {
+				PyErr_Format(PyExc_RuntimeError, "ubus error occured: %s", ubus_strerror(UBUS_STATUS_TIMEOUT));
+				return NULL;
+			}
 		}
+
+		process_request(self, remaining);
 	}
-	Py_END_ALLOW_THREADS
 
-	Py_INCREF(Py_None);
-	return Py_None;
+	if (self->cancelled) {
+		PyErr_Format(PyExc_RuntimeError, "Request was cancelled.");
+		return NULL;
+	}
+
+	if (self->status != UBUS_STATUS_OK) {
+		PyErr_Format(PyExc_RuntimeError, "ubus error occured: %s", ubus_strerror(self->status));
+		return NULL;
+	}
+
+	Py_INCREF(self->results);
+	return self->results;
 }
 
-bool test_policies(const struct blobmsg_policy *policies, int n_policies, struct blob_attr *args)
+PyDoc_STRVAR(
+	Request_cancel_doc,
+	"cancel()\n"
+	"\n"
+	"Aborts the pending request. The callback won't be called.\n"
+	":return: True if the request was pending, False otherwise.\n"
+	":rtype: bool\n"
+);
+
+static PyObject *ubus_Request_cancel(ubus_Request *self, PyObject *args, PyObject *kwargs)
 {
-	struct blob_attr *cur;
-	int idx = 0, passed_count = 0;
+	ubus_Connection *connection = self->connection;
+	connection_lock(connection, true);
+	bool pending = self->pending;
+	if (pending) {
+		if (CONNECTED(connection)) {
+			ubus_abort_request(connection->ctx, &self->req);
+		}
+		self->cancelled = true;
+		ubus_Request_finish(self, UBUS_STATUS_UNKNOWN_ERROR, false);
+	}
+	connection_unlock(connection);
 
-	blob_for_each_attr(cur, args, idx) {
-		const char *name = blobmsg_name(cur);
-		int type = blobmsg_type(cur);
-		int pol_idx;
+	return prepare_bool(pending);
+}
 
-		// Iterate through policies
-		for (pol_idx = 0; pol_idx < n_policies; pol_idx++) {
+static PyObject *ubus_Request_iternext(ubus_Request *self)
+{
+	if (!self->stream) {
+		PyErr_Format(PyExc_TypeError, "Only the requests of call_iter() can be iterated.");
+		return NULL;
+	}
 
-			if (!strcmp(name, policies[pol_idx].name)) {
-				passed_count += 1;
-				int pol_type = policies[pol_idx].type;
-				if (pol_type != BLOBMSG_TYPE_UNSPEC && pol_type != type) {
-					return false;
-				}
-				break;
+	// messages are read only when all the received replies were taken
+	while (PyList_GET_SIZE(self->results) == 0) {
+		if (self->pending && self->limit_reached) {
+			ubus_Connection *connection = self->connection;
+			connection_lock(connection, true);
+			if (self->pending) {
+				ubus_abort_request(connection->ctx, &self->req);
+				ubus_Request_finish(self, UBUS_STATUS_OK, true);
 			}
+			connection_unlock(connection);
 		}
-
-		// Policy was not found
-		if (pol_idx >= n_policies) {
-			return false;
+		if (!self->pending) {
+			if (self->cancelled) {
+				PyErr_Format(PyExc_RuntimeError, "Request was cancelled.");
+			} else if (self->status != UBUS_STATUS_OK) {
+				PyErr_Format(PyExc_RuntimeError, "ubus error occured: %s", ubus_strerror(self->status));
+			}
+			return NULL;  // StopIteration when no exception is set
+		}
+		if (!CONNECTED(self->connection)) {
+			PyErr_Format(PyExc_RuntimeError, MSG_NOT_CONNECTED);
+			return NULL;
 		}
+		process_request(self, -1);
 	}
 
-	// All attributes are present and checked
-	return passed_count == n_policies;
+	PyObject *reply = PyList_GET_ITEM(self->results, 0);
+	Py_INCREF(reply);
+	if (PyList_SetSlice(self->results, 0, 1, NULL)) {
+		Py_DECREF(reply);
+		return NULL;
+	}
+	return reply;
 }
 
-static int ubus_python_method_handler(struct ubus_context *ctx, struct ubus_object *obj,
-		struct ubus_request_data *req, const char *method,
-		struct blob_attr *msg)
+static PyObject *ubus_Request_get_done(ubus_Request *self, void *closure)
 {
-	// Check whether method signature matches
-	int method_idx;
-	for (method_idx = 0; method_idx < obj->n_methods; ++method_idx) {
-		if (!strcmp(obj->methods[method_idx].name, method)) {
-			break;
-		}
-	}
-	if (method_idx >= obj->n_methods) {
-		// Can't find method
-		return UBUS_STATUS_UNKNOWN_ERROR;
-	}
-	if (!test_policies(obj->methods[method_idx].policy, obj->methods[method_idx].n_policy, msg)) {
-		return UBUS_STATUS_INVALID_ARGUMENT;
+	return prepare_bool(!self->pending);
+}
+
+static PyObject *ubus_Request_get_status(ubus_Request *self, void *closure)
+{
+	if (self->pending || self->cancelled) {
+		Py_INCREF(Py_None);
+		return Py_None;
 	}
+	return PyInt_FromLong(self->status);
+}
 
-	PyGILState_STATE gstate = PyGILState_Ensure();
+static PyObject *ubus_Request_get_results(ubus_Request *self, void *closure)
+{
+	Py_INCREF(self->results);
+	return self->results;
+}
 
-	int retval = UBUS_STATUS_OK;
-	// Get python method
-	PyObject *methods = container_of(obj, ubus_Object, object)->methods;
-	PyObject *python_method = PyDict_GetItemString(methods, method);
-	if (!python_method) {
-		retval = UBUS_STATUS_METHOD_NOT_FOUND;
-		goto method_handler_exit;
-	}
+PyDoc_STRVAR(
+	Request_doc,
+	"__Request\n"
+	"\n"
+	"Object which represents a pending asynchronous ubus call.\n"
+);
 
-	// prepare json data
-	char *str = blobmsg_format_json(msg, true);
-	if (!str) {
-		retval = UBUS_STATUS_UNKNOWN_ERROR;
-		goto method_handler_exit;
+static PyMethodDef ubus_Request_methods[] = {
+	{"wait", (PyCFunction)ubus_Request_wait, METH_VARARGS|METH_KEYWORDS, Request_wait_doc},
+	{"cancel", (PyCFunction)ubus_Request_cancel, METH_NOARGS, Request_cancel_doc},
+	{NULL},
+};
+
+static PyGetSetDef ubus_Request_getset[] = {
+	{"done", (getter)ubus_Request_get_done, NULL, "True when the request is completed", NULL},
+	{"status", (getter)ubus_Request_get_status, NULL, "ubus status of a completed request", NULL},
+	{"results", (getter)ubus_Request_get_results, NULL, "replies received so far", NULL},
+	{NULL},
+};
+
+static PyTypeObject ubus_RequestType = {
+	PyVarObject_HEAD_INIT(NULL, 0)
+	REQUEST_OBJECT_NAME,						/* tp_name */
+	sizeof(ubus_Request),						/* tp_basicsize */
+	0,											/* tp_itemsize */
+	(destructor)ubus_Request_dealloc,			/* tp_dealloc */
+	0,											/* tp_print */
+	0,											/* tp_getattr */
+	0,											/* tp_setattr */
+	0,											/* tp_compare */
+	0,											/* tp_repr */
+	0,											/* tp_as_number */
+	0,											/* tp_as_sequence */
+	0,											/* tp_as_mapping */
+	0,											/* tp_hash */
+	0,											/* tp_call */
+	0,											/* tp_str */
+	0,											/* tp_getattro */
+	0,											/* tp_setattro */
+	0,											/* tp_as_buffer */
+	Py_TPFLAGS_DEFAULT | Py_TPFLAGS_HAVE_GC,	/* tp_flags */
+	Request_doc,								/* tp_doc */
+	(traverseproc)ubus_Request_traverse,		/* tp_traverse */
+	(inquiry)ubus_Request_clear,				/* tp_clear */
+	0,											/* tp_richcompare */
+	0,											/* tp_weaklistoffset */
+	PyObject_SelfIter,							/* tp_iter */
+	(iternextfunc)ubus_Request_iternext,		/* tp_iternext */
+	ubus_Request_methods,						/* tp_methods */
+	0,											/* tp_members */
+	ubus_Request_getset,						/* tp_getset */
+	0,											/* tp_base */
+	0,											/* tp_dict */
+	0,											/* tp_descr_get */
+	0,											/* tp_descr_set */
+	0,											/* tp_dictoffset */
+	0,											/* tp_init */
+	0,											/* tp_alloc */
+	0,											/* tp_new */
+};
+
+ubus_Request *start_request(ubus_Connection *connection,
+		uint32_t id, const char *method, struct blob_attr *msg, PyObject *callback, int timeout)
+{
+	ubus_Request *request = PyObject_GC_New(ubus_Request, &ubus_RequestType);
+	if (!request) {
+		return NULL;
 	}
-	PyObject *data = PyUnicode_FromString(str);
-	free(str);
-	if (!data) {
-		retval = UBUS_STATUS_UNKNOWN_ERROR;
-		goto method_handler_exit;
+	Py_INCREF(connection);
+	request->connection = connection;
+	memset(&request->timeout, 0, sizeof(request->timeout));
+	INIT_LIST_HEAD(&request->list);
+	request->pending = false;
+	request->cancelled = false;
+	request->status = UBUS_STATUS_OK;
+	request->format = FORMAT_DECODED;
+	request->stream = false;
+	request->limit_reached = false;
+	request->max_replies = request->max_bytes = 0;
+	request->replies = request->bytes = 0;
+	Py_INCREF(callback);
+	request->callback = callback;
+	request->results = PyList_New(0);
+	if (!request->results) {
+		Py_DECREF(request);
+		return NULL;
 	}
+	PyObject_GC_Track(request);
 
-	// Call python function json.loads
-	PyObject *data_object = perform_json_function(LOADS, data);
-	if (!data_object) {
-		retval = UBUS_STATUS_UNKNOWN_ERROR;
-		goto method_handler_cleanup1;
+	int retval = ubus_invoke_async(connection->ctx, id, method, msg, &request->req);
+	if (retval != UBUS_STATUS_OK) {
+		Py_DECREF(request);
+		PyErr_Format(
+				PyExc_RuntimeError,
+				"ubus error occured: %s", ubus_strerror(retval)
+		);
+		return NULL;
+	}
+	request->req.data_cb = ubus_python_request_data_handler;
+	request->req.complete_cb = ubus_python_request_complete_handler;
+
+	// keep the request alive until it is completed
+	Py_INCREF(request);
+	request->pending = true;
+	list_add_tail(&request->list, &connection->pending_requests);
+	if (timeout > 0) {
+		request->timeout.cb = ubus_python_request_timeout_handler;
+		uloop_timeout_set(&request->timeout, timeout);
 	}
+	ubus_complete_request_async(connection->ctx, &request->req);
 
-	PyObject *handler = PyObject_CallObject((PyObject *)&ubus_ResponseHandlerType, NULL);
-	if (!handler) {
-		PyErr_Print();
-		goto method_handler_cleanup2;
+	return request;
+}
+
+PyDoc_STRVAR(
+	connect_call_async_doc,
+	"call_async(object, method, arguments, callback=None, timeout=0)\n"
+	"\n"
+	"Calls object's method on ubus without waiting for the replies.\n"
+	"The request is completed within loop() or request.wait().\n"
+	"\n"
+	":param object: name of the object\n"
+	":type object: str\n"
+	":param method: name of the method\n"
+	":type method: str\n"
+	":param arguments: arguments of the method (should be JSON serialisable).\n"
+	":type argument: dict\n"
+	":param callback: called as callback(status, results) when the request is completed\n"
+	":type callback: callable\n"
+	":param timeout: timeout in ms (0 = wait forever)\n"
+	":type timeout: int\n"
+	":return: request handle\n"
+	":rtype: ubus.__Request\n"
+);
+
+static PyObject *ubus_Connection_call_async(ubus_Connection *self, PyObject *args, PyObject *kwargs)
+{
+	if (!CONNECTED(self)) {
+		PyErr_Format(PyExc_RuntimeError, MSG_NOT_CONNECTED);
+		return NULL;
 	}
-	((ubus_ResponseHandler *)handler)->req = req;
-	((ubus_ResponseHandler *)handler)->ctx = ctx;
 
-	// Trigger method
-	PyObject *callback_arglist = Py_BuildValue("(O, O)", handler, data_object);
-	if (!callback_arglist) {
-		retval = UBUS_STATUS_UNKNOWN_ERROR;
-		goto method_handler_cleanup3;
+	char *object = NULL, *method = NULL;
+	int timeout = 0;
+	PyObject *arguments = NULL, *callback = Py_None;
+	static char *kwlist[] = {"object", "method", "arguments", "callback", "timeout", NULL};
+	if (!PyArg_ParseTupleAndKeywords(
+				args, kwargs, "ssO|Oi", kwlist, &object, &method, &arguments, &callback, &timeout)){
+		return NULL;
 	}
-	PyObject *callable = PyDict_GetItemString(python_method, "method");
-	PyObject *result = PyObject_CallObject(callable, callback_arglist);
-	Py_DECREF(callback_arglist);
-	if (!result) {
-		PyErr_Print();
-		retval = UBUS_STATUS_UNKNOWN_ERROR;
-	} else {
-		Py_DECREF(result);  // we don't care about the result
+	if (timeout < 0) {
+		PyErr_Format(PyExc_TypeError, "timeout can't be lower than 0");
+		return NULL;
+	}
+	if (callback != Py_None && !PyCallable_Check(callback)) {
+		PyErr_Format(PyExc_TypeError, "callback has to be callable");
+		return NULL;
 	}
 
-method_handler_cleanup3:
-	// NULLify the structures so that using this structure will we useless if a reference
-	// is left outside the callback code
-	((ubus_ResponseHandler *)handler)->req = NULL;
-	((ubus_ResponseHandler *)handler)->ctx = NULL;
-	Py_DECREF(handler);
-method_handler_cleanup2:
-	Py_DECREF(data_object);
-method_handler_cleanup1:
-	Py_DECREF(data);
-method_handler_exit:
+	uint32_t id = 0;
+	bool cached = false;
+	int retval = lookup_object_id(self, object, &id, &cached);
+	if (retval != UBUS_STATUS_OK) {
+		PyErr_Format(PyExc_RuntimeError, "Object '%s' was not found.", object);
+		return NULL;
+	}
 
-	// Clear python exceptions
-	PyErr_Clear();
+	// put data into buffer
+	if (!encode_message(&self->buf, arguments)) {
+		return NULL;
+	}
 
-	PyGILState_Release(gstate);
+	ubus_Request *request = start_request(self, id, method, self->buf.head, callback, timeout);
+	if (!request && cached) {
+		invalidate_object_id(self, object);
+	}
 
-	return retval;
+	return (PyObject *)request;
 }
 
-static bool test_methods_argument(PyObject *methods)
+PyDoc_STRVAR(
+	connect_call_iter_doc,
+	"call_iter(object, method, arguments, timeout=0, max_replies=0, max_bytes=0, raw=False, lazy=False)\n"
+	"\n"
+	"Calls object's method on ubus and yields each reply as soon as it arrives.\n"
+	"Messages are read only when all the received replies were taken.\n"
+	"\n"
+	":param object: name of the object\n"
+	":type object: str\n"
+	":param method: name of the method\n"
+	":type method: str\n"
+	":param arguments: arguments of the method (should be JSON serialisable).\n"
+	":type argument: dict\n"
+	":param timeout: timeout in ms (0 = wait forever)\n"
+	":type timeout: int\n"
+	":param max_replies: the request is aborted after this number of replies (0 = unlimited)\n"
+	":type max_replies: int\n"
+	":param max_bytes: the request is aborted before the replies exceed this size (0 = unlimited)\n"
+	":type max_bytes: int\n"
+	":param raw: yield the replies as serialized blobmsg messages (bytes)\n"
+	":type raw: bool\n"
+	":param lazy: yield the replies as MessageView which decodes fields on access\n"
+	":type lazy: bool\n"
+	":return: request handle which is an iterator over the replies\n"
+	":rtype: ubus.__Request\n"
+);
+
+static PyObject *ubus_Connection_call_iter(ubus_Connection *self, PyObject *args, PyObject *kwargs)
 {
-	if (!methods) {
-		return false;
+	if (!CONNECTED(self)) {
+		PyErr_Format(PyExc_RuntimeError, MSG_NOT_CONNECTED);
+		return NULL;
 	}
 
-	PyObject *method_name = NULL, *value = NULL;
-	Py_ssize_t pos = 0;
-	// Iterate through methods
-	while(PyDict_Next(methods, &pos, &method_name, &value)) {
-		// Test name
-		if (!PyStr_Check(method_name)) {
-			return false;
-		}
-		if (!PyDict_Check(value)) {
-			return false;
-		}
+	char *object = NULL, *method = NULL;
+	int timeout = 0;
+	Py_ssize_t max_replies = 0, max_bytes = 0;
+	PyObject *arguments = NULL;
+	PyObject *raw = Py_False, *lazy = Py_False;
+	static char *kwlist[] = {
+		"object", "method", "arguments", "timeout", "max_replies", "max_bytes", "raw", "lazy", NULL
+	};
+	if (!PyArg_ParseTupleAndKeywords(
+				args, kwargs, "ssO|innO!O!", kwlist, &object, &method, &arguments, &timeout,
+				&max_replies, &max_bytes, &PyBool_Type, &raw, &PyBool_Type, &lazy)){
+		return NULL;
+	}
+	enum message_format format;
+	if (!parse_message_format(raw, lazy, &format)) {
+		return NULL;
+	}
+	if (timeout < 0) {
+		PyErr_Format(PyExc_TypeError, "timeout can't be lower than 0");
+		return NULL;
+	}
+	if (max_replies < 0 || max_bytes < 0) {
+		PyErr_Format(PyExc_ValueError, "max_replies and max_bytes can't be lower than 0");
+		return NULL;
+	}
 
-		// Dict should contain only two elemnts - 'signature' and 'method'
-		if (PyDict_Size(value) != 2) {
-				return false;
-		}
+	uint32_t id = 0;
+	bool cached = false;
+	int retval = lookup_object_id(self, object, &id, &cached);
+	if (retval != UBUS_STATUS_OK) {
+		PyErr_Format(PyExc_RuntimeError, "Object '%s' was not found.", object);
+		return NULL;
+	}
 
-		// Test signature
-		PyObject *signature = PyDict_GetItemString(value, "signature");
-		if (!signature || !PyDict_Check(signature)) {
-			return false;
-		}
-		Py_ssize_t sig_pos = 0;
-		PyObject *signature_name = NULL, *signature_type = NULL;
-		while (PyDict_Next(signature, &sig_pos, &signature_name, &signature_type)) {
-			if (!PyStr_Check(signature_name)) {
-				return false;
-			}
-			if (!PyInt_Check(signature_type)) {
-				return false;
-			}
-			int type = PyLong_AsLong(signature_type);
-			if (type < 0 || type > BLOBMSG_TYPE_LAST) {  // indexed from 0
-				return false;
-			}
-		}
+	// put data into buffer
+	if (!encode_message(&self->buf, arguments)) {
+		return NULL;
+	}
 
-		// Test callable
-		PyObject *method = PyDict_GetItemString(value, "method");
-		if (!method || !PyCallable_Check(method)) {
-			return false;
+	ubus_Request *request = start_request(self, id, method, self->buf.head, Py_None, timeout);
+	if (!request) {
+		if (cached) {
+			invalidate_object_id(self, object);
 		}
+		return NULL;
 	}
+	// no reply can be received before the messages are processed
+	request->format = format;
+	request->stream = true;
+	request->max_replies = max_replies;
+	request->max_bytes = max_bytes;
 
-	return true;
+	return (PyObject *)request;
 }
 
 PyDoc_STRVAR(
-	connect_add_doc,
-	"add(object_name, methods)\n"
-	"\n"
-	"Adds an object to ubus.\n"
-	"methods should look like this: \n"
-	"{ \n"
-	"	<method_name>: {'signature': <method_signature>, 'method': <callable>} \n"
-	"} \n"
+	connect_send_async_doc,
+	"send_async(event, data, callback=None)\n"
 	"\n"
-	"{ \n"
-	"	test: {'signature': {'argument1': BLOBMSG_TYPE_STRING}, 'method': my_callback} \n"
-	"} \n"
+	"Send an event via ubus without waiting for the confirmation.\n"
 	"\n"
-	":param object_name: the name of the object which will be present on ubus \n"
-	":type object_name: str\n"
-	":param methods: {<method_name>: callable} where callable signature is (request, msg) \n"
-	":type methods: dict\n"
+	":param event: ubus event which will be used \n"
+	":type event: str\n"
+	":param data: python object which can be serialized to json \n"
+	":type data: dict\n"
+	":param callback: called as callback(status, results) when the event is sent\n"
+	":type callback: callable\n"
+	":return: request handle\n"
+	":rtype: ubus.__Request\n"
 );
 
-static PyObject *ubus_python_add(PyObject *module, PyObject *args, PyObject *kwargs)
+static PyObject *ubus_Connection_send_async(ubus_Connection *self, PyObject *args, PyObject *kwargs)
 {
-	if (!CONNECTED) {
+	if (!CONNECTED(self)) {
 		PyErr_Format(PyExc_RuntimeError, MSG_NOT_CONNECTED);
 		return NULL;
 	}
 
-	// arguments
-	PyObject *object_name = NULL;
-	PyObject *methods= NULL;
-	static char *kwlist[] = {"object_name", "methods",  NULL};
-	if (!PyArg_ParseTupleAndKeywords(args, kwargs, "OO", kwlist, &object_name, &methods)){
+	char *event = NULL;
+	PyObject *data = NULL, *callback = Py_None;
+	static char *kwlist[] = {"event", "data", "callback", NULL};
+	if (!PyArg_ParseTupleAndKeywords(args, kwargs, "sO|O", kwlist, &event, &data, &callback)){
 		return NULL;
 	}
-
-	// test arguments
-	if (!PyStr_Check(object_name)) {
-		PyErr_Format(PyExc_TypeError, MSG_ADD_SIGNATURE_INVALID);
+	if (callback != Py_None && !PyCallable_Check(callback)) {
+		PyErr_Format(PyExc_TypeError, "callback has to be callable");
 		return NULL;
 	}
 
-	if (!test_methods_argument(methods)) {
-		PyErr_Format(PyExc_TypeError, MSG_ADD_SIGNATURE_INVALID);
+	// put data into buffer
+	if (!encode_event(&self->buf, event, data)) {
 		return NULL;
 	}
 
-	// allocate the object
-	ubus_Object *object = calloc(1, sizeof(ubus_Object));
-	if (!object) {
-		PyErr_Format(PyExc_MemoryError, MSG_ALLOCATION_FAILS);
-		return NULL;
-	}
-	object->methods = methods;
+	return (PyObject *)start_request(self, UBUS_SYSTEM_OBJECT_EVENT, "send", self->buf.head, callback, 0);
+}
 
-	// set the object
-	object->object.name = PyUnicode_AsUTF8(object_name);
-	object->object.n_methods = PyDict_Size(methods);
+/* statistics */
 
-	if (object->object.n_methods > 0) {
-		struct ubus_method *ubus_methods = calloc(object->object.n_methods, sizeof(struct ubus_method));
-		if (!ubus_methods) {
-			free(object);
-			PyErr_Format(PyExc_MemoryError, MSG_ALLOCATION_FAILS);
-			return NULL;
+static bool set_nested_stats(PyObject *dict, const char *outer, const char *inner, const struct stats *stats)
+{
+	PyObject *nested = PyDict_GetItemString(dict, outer);
+	if (!nested) {
+		nested = PyDict_New();
+		if (!nested || PyDict_SetItemString(dict, outer, nested)) {
+			Py_XDECREF(nested);
+			return false;
 		}
+		Py_DECREF(nested);  // the reference is held by dict
+	}
 
-		PyObject *method_name = NULL, *value = NULL;
-		Py_ssize_t pos = 0;
-		// Iterate through methods
-		for (int i = 0; PyDict_Next(methods, &pos, &method_name, &value); i++) {
-			ubus_methods[i].name = PyUnicode_AsUTF8(method_name);
-			ubus_methods[i].handler = ubus_python_method_handler;
+	PyObject *item = stats_to_dict(stats);
+	if (!item || PyDict_SetItemString(nested, inner, item)) {
+		Py_XDECREF(item);
+		return false;
+	}
+	Py_DECREF(item);
 
-			// alocate and set policy objects
-			PyObject *signature = PyDict_GetItemString(value, "signature");
-			Py_ssize_t signature_size = PyDict_Size(signature);
-			struct blobmsg_policy *policy = calloc(signature_size, sizeof(struct blobmsg_policy));
-			if (!policy) {
-				// dealloc allocated data
-				free_ubus_object(object);
-				PyErr_Format(PyExc_MemoryError, MSG_ALLOCATION_FAILS);
-				return NULL;
-			}
-			Py_ssize_t sig_pos = 0;
-			PyObject *signature_name = NULL, *signature_type = NULL;
-			for (int j = 0; PyDict_Next(signature, &sig_pos, &signature_name, &signature_type); j++) {
-				policy[j].name = PyUnicode_AsUTF8(signature_name);
-				policy[j].type = PyLong_AsLong(signature_type);
-			}
-			ubus_methods[i].policy = policy;
-			ubus_methods[i].n_policy = signature_size;
+	return true;
+}
+
+PyObject *collect_stats(ubus_Connection *connection)
+{
+	PyObject *methods = PyDict_New(), *calls = PyDict_New(), *events = PyDict_New();
+	PyObject *bounds = PyList_New(STATS_BUCKETS - 1);
+	if (!methods || !calls || !events || !bounds) {
+		goto collect_stats_error;
+	}
+
+	for (int i = 0; i < STATS_BUCKETS - 1; i++) {
+		PyObject *bound = PyInt_FromLong(1L << i);
+		if (!bound) {
+			goto collect_stats_error;
 		}
+		PyList_SET_ITEM(bounds, i, bound);
+	}
 
-		// assign methods
-		object->object.methods = ubus_methods;
+	// served methods
+	for (int i = 0; i < connection->objects_size; i++) {
+		ubus_Object *object = connection->objects[i];
+		for (int j = 0; j < object->object.n_methods; j++) {
+			if (!set_nested_stats(methods, object->object.name, object->object.methods[j].name,
+						&object->dispatch[j].stats)) {
+				goto collect_stats_error;
+			}
+		}
 	}
 
-	object->object.type = calloc(1, sizeof(struct ubus_object_type));
-	if (!object->object.type) {
-		free_ubus_object(object);
-		PyErr_Format(PyExc_MemoryError, MSG_ALLOCATION_FAILS);
-		return NULL;
+	// outgoing calls
+	if (connection->call_stats) {
+		PyObject *key = NULL, *capsule = NULL;
+		Py_ssize_t pos = 0;
+		while (PyDict_Next(connection->call_stats, &pos, &key, &capsule)) {
+			if (!set_nested_stats(calls, PyUnicode_AsUTF8(PyTuple_GET_ITEM(key, 0)),
+						PyUnicode_AsUTF8(PyTuple_GET_ITEM(key, 1)), PyCapsule_GetPointer(capsule, NULL))) {
+				goto collect_stats_error;
+			}
+		}
 	}
-	object->object.type->name = PyUnicode_AsUTF8(object_name);
-	object->object.type->methods = object->object.methods;
-	object->object.type->n_methods = object->object.n_methods;
 
-	// add object to object array to be deallocated later
-	ubus_Object **new_objects = realloc(objects,
-			(objects_size + 1) * sizeof(*objects));
-	if (!new_objects) {
-		// dealloc the object
-		free_ubus_object(object);
-		PyErr_Format(PyExc_MemoryError, MSG_ALLOCATION_FAILS);
-		return NULL;
+	// listener callbacks (listeners of the same pattern are summed up)
+	ubus_Listener *listener;
+	list_for_each_entry(listener, &connection->listeners, list) {
+		if (listener->removed || PyDict_GetItemString(events, listener->pattern)) {
+			continue;
+		}
+		struct stats sum;
+		memset(&sum, 0, sizeof(sum));
+		bool wildcard;
+		struct pattern_node *node = find_pattern(connection, listener->pattern, &wildcard);
+		ubus_Listener *same;
+		list_for_each_entry(same, wildcard ? &node->prefix : &node->exact, pattern_list) {
+			if (!same->removed) {
+				stats_merge(&sum, &same->stats);
+			}
+		}
+		PyObject *item = stats_to_dict(&sum);
+		if (!item || PyDict_SetItemString(events, listener->pattern, item)) {
+			Py_XDECREF(item);
+			goto collect_stats_error;
+		}
+		Py_DECREF(item);
 	}
-	objects = new_objects;
-	objects[objects_size++] = object;
 
-	int ret = ubus_add_object(ctx, &object->object);
-	if (ret) {
-		// deallocate object on failure
-		objects_size--;  // no need to realloc the whole array
-		free_ubus_object(object);
+	return Py_BuildValue("{s:O,s:N,s:N,s:N,s:N}",
+			"enabled", connection->stats_enabled ? Py_True : Py_False,
+			"bounds_us", bounds,
+			"methods", methods,
+			"calls", calls,
+			"events", events);
+
+collect_stats_error:
+	Py_XDECREF(methods);
+	Py_XDECREF(calls);
+	Py_XDECREF(events);
+	Py_XDECREF(bounds);
+	return NULL;
+}
 
-		PyErr_Format(
-				PyExc_RuntimeError,
-				"ubus error occured: %s", ubus_strerror(ret)
-		);
-		return NULL;
+void reset_stats(ubus_Connection *connection)
+{
+	for (int i = 0; i < connection->objects_size; i++) {
+		ubus_Object *object = connection->objects[i];
+		for (int j = 0; j < object->object.n_methods; j++) {
+			memset(&object->dispatch[j].stats, 0, sizeof(struct stats));
+		}
+	}
+	ubus_Listener *listener;
+	list_for_each_entry(listener, &connection->listeners, list) {
+		memset(&listener->stats, 0, sizeof(struct stats));
+	}
+	if (connection->call_stats) {
+		// entries are kept because pointers to them might be used by a call in progress
+		PyObject *key = NULL, *capsule = NULL;
+		Py_ssize_t pos = 0;
+		while (PyDict_Next(connection->call_stats, &pos, &key, &capsule)) {
+			memset(PyCapsule_GetPointer(capsule, NULL), 0, sizeof(struct stats));
+		}
 	}
+}
 
-	// put arguments into alloc list (used for reference counting)
-	if (PyList_Append(python_alloc_list, object_name)) {
-		ubus_remove_object(ctx, &object->object);
-		free_ubus_object(object);
+PyDoc_STRVAR(
+	connect_enable_stats_doc,
+	"enable_stats(enabled=True)\n"
+	"\n"
+	"Turns on the counters of served methods, outgoing calls and listener callbacks.\n"
+	"The counters are disabled by default so that the handlers don't read the clock.\n"
+	"\n"
+	":param enabled: whether the counters should be updated\n"
+	":type enabled: bool\n"
+);
+
+static PyObject *ubus_Connection_enable_stats(ubus_Connection *self, PyObject *args, PyObject *kwargs)
+{
+	if (!CONNECTED(self)) {
+		PyErr_Format(PyExc_RuntimeError, MSG_NOT_CONNECTED);
 		return NULL;
 	}
 
-	if (PyList_Append(python_alloc_list, methods)) {
-		ubus_remove_object(ctx, &object->object);
-		free_ubus_object(object);
-		PyEval_CallMethod(python_alloc_list, "pop", "");
+	PyObject *enabled = Py_True;
+	static char *kwlist[] = {"enabled", NULL};
+	if (!PyArg_ParseTupleAndKeywords(args, kwargs, "|O!", kwlist, &PyBool_Type, &enabled)){
 		return NULL;
 	}
 
+	self->stats_enabled = PyObject_IsTrue(enabled);
+
 	Py_INCREF(Py_None);
 	return Py_None;
 }
 
-static void ubus_python_objects_handler(struct ubus_context *c, struct ubus_object_data *o, void *p)
+PyDoc_STRVAR(
+	connect_stats_doc,
+	"stats(reset=False)\n"
+	"\n"
+	"Returns the counters collected since enable_stats() was called.\n"
+	"{'methods': {object: {method: counters}}, 'calls': {object: {method: counters}},\n"
+	" 'events': {event: counters}, 'bounds_us': [1, 2, 4, ...], 'enabled': bool}\n"
+	"\n"
+	"counters contain 'invocations', 'errors' ({status message: count}), 'bytes_in',\n"
+	"'bytes_out' and 'decode', 'callback' and 'reply' latency histograms\n"
+	"({'count': int, 'total_us': float, 'buckets': [int, ...]}).\n"
+	"Bucket N counts latencies lower than bounds_us[N], the last bucket counts the rest.\n"
+	"'reply' of outgoing calls is the whole round trip.\n"
+	"\n"
+	":param reset: clears the counters after they are returned\n"
+	":type reset: bool\n"
+	":return: counters\n"
+	":rtype: dict\n"
+);
+
+static PyObject *ubus_Connection_stats(ubus_Connection *self, PyObject *args, PyObject *kwargs)
 {
-	// should be a single instance for all the objects
-	PyObject *objects = (PyObject *)p;
+	if (!CONNECTED(self)) {
+		PyErr_Format(PyExc_RuntimeError, MSG_NOT_CONNECTED);
+		return NULL;
+	}
 
-	PyObject *str_signatures = PyUnicode_FromString("{");
-	if (!str_signatures) {
-		return;
+	PyObject *reset = Py_False;
+	static char *kwlist[] = {"reset", NULL};
+	if (!PyArg_ParseTupleAndKeywords(args, kwargs, "|O!", kwlist, &PyBool_Type, &reset)){
+		return NULL;
 	}
 
-	bool first = true;
-	if (o->signature) {
-		struct blob_attr *cur;
-		int rem = 0;
-		blob_for_each_attr(cur, o->signature, rem) {
-			char *s = blobmsg_format_json(cur, false);
-			if (!s) {
-				goto object_handler_cleanup;
-			}
-			PyObject *str_signature = NULL;
-			if (first) {
-				first = false;
-				str_signature = PyUnicode_FromString(s);
-			} else {
-				str_signature = PyUnicode_FromFormat(" ,%s", s);
-			}
-			free(s);
-			if (!str_signature) {
-				goto object_handler_cleanup;
-			}
-			PyObject *tmp = PyUnicode_Concat(str_signatures, str_signature);
-			Py_DECREF(str_signature);
-			Py_DECREF(str_signatures);
-			if (!tmp) {
-				return;
-			}
-			str_signatures = tmp;
-		}
+	PyObject *res = collect_stats(self);
+	if (res && reset == Py_True) {
+		reset_stats(self);
 	}
 
-	PyObject *closing_bracket = PyUnicode_FromString("}");
-	PyObject *tmp = PyUnicode_Concat(str_signatures, closing_bracket);
-	Py_DECREF(closing_bracket);
-	Py_DECREF(str_signatures);
+	return res;
+}
 
-	if (!tmp) {
-		return;
+static PyObject *ubus_python_stats_method(PyObject *self, PyObject *args)
+{
+	PyObject *handler = NULL, *data = NULL;
+	if (!PyArg_ParseTuple(args, "O!O", &ubus_ResponseHandlerType, &handler, &data)) {
+		return NULL;
 	}
-	str_signatures = tmp;
 
-	// convert json string to json
-	PyObject *json_signatures = perform_json_function(LOADS, str_signatures);
-	if (!json_signatures) {
-		goto object_handler_cleanup;
+	ubus_Connection *connection = ((ubus_ResponseHandler *)handler)->connection;
+	if (!connection) {
+		PyErr_Format(PyExc_RuntimeError, "Handler is not linked to a call response.");
+		return NULL;
 	}
 
-	// Add it to dict object
-	PyObject *path = PyUnicode_FromString(o->path);
-	if (!path) {
-		goto object_handler_cleanup;
+	PyObject *stats = collect_stats(connection);
+	if (!stats) {
+		return NULL;
 	}
-	PyDict_SetItem(objects, path, json_signatures);  // we don't care about retval here
-	Py_DECREF(path);
+	PyObject *res = PyObject_CallMethod(handler, "reply", "(O)", stats);
+	Py_DECREF(stats);
 
-object_handler_cleanup:
-	Py_DECREF(str_signatures);
-
-	// Clear python exceptions
-	PyErr_Clear();
+	return res;
 }
 
+static PyMethodDef stats_method_def = {"stats", (PyCFunction)ubus_python_stats_method, METH_VARARGS, NULL};
+
 PyDoc_STRVAR(
-	connect_objects_doc,
-	"objects(path='*')\n"
+	connect_publish_stats_doc,
+	"publish_stats(object_name)\n"
 	"\n"
-	"Prints all objects present on ubus\n"
+	"Enables the counters and adds an object with a 'stats' method which replies\n"
+	"with the output of stats().\n"
 	"\n"
-	":param path: only object which match the given path \n"
-	":type path: str\n"
-	":return: {<object_path>: {{<function_name>: <function_signature>}, ...}, ...} \n"
-	":rtype: dict\n"
+	":param object_name: the name of the object which will be present on ubus\n"
+	":type object_name: str\n"
 );
 
-static PyObject *ubus_python_objects(PyObject *module, PyObject *args, PyObject *kwargs)
+static PyObject *ubus_Connection_publish_stats(ubus_Connection *self, PyObject *args, PyObject *kwargs)
 {
-	if (!CONNECTED) {
+	if (!CONNECTED(self)) {
 		PyErr_Format(PyExc_RuntimeError, MSG_NOT_CONNECTED);
 		return NULL;
 	}
 
-	char *ubus_path = NULL;
-	static char *kwlist[] = {"path", NULL};
-	if (!PyArg_ParseTupleAndKeywords(args, kwargs, "|s", kwlist, &ubus_path)){
+	PyObject *object_name = NULL;
+	static char *kwlist[] = {"object_name", NULL};
+	if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O", kwlist, &object_name)){
 		return NULL;
 	}
 
-	ubus_path = ubus_path ? ubus_path : "*";
-
-	PyObject *res = PyDict_New();
-	if (!res) {
+	// the connection is taken from the response handler to avoid a reference cycle
+	PyObject *method = PyCFunction_NewEx(&stats_method_def, NULL, NULL);
+	if (!method) {
 		return NULL;
 	}
-
-	int retval = ubus_lookup(ctx, ubus_path, ubus_python_objects_handler, res);
-	switch (retval) {
-		case UBUS_STATUS_OK:
-		case UBUS_STATUS_NOT_FOUND:
-			break;
-		default:
-			Py_DECREF(res);
-			PyErr_Format(
-					PyExc_RuntimeError,
-					"ubus error occured: %s", ubus_strerror(retval)
-			);
-			return NULL;
+	PyObject *add_args = Py_BuildValue("(O{s:{s:N,s:{}}})",
+			object_name, "stats", "method", method, "signature");
+	if (!add_args) {
+		return NULL;
+	}
+	PyObject *res = ubus_Connection_add(self, add_args, NULL);
+	Py_DECREF(add_args);
+	if (res) {
+		self->stats_enabled = true;
 	}
 
 	return res;
 }
 
-static void ubus_python_call_handler(struct ubus_request *req, int type, struct blob_attr *msg)
+/* Connection */
+
+typedef PyObject *(*connection_method)(ubus_Connection *self, PyObject *args, PyObject *kwargs);
+
+static PyObject *call_locked(connection_method method, ubus_Connection *self, PyObject *args, PyObject *kwargs)
 {
-	assert(type == UBUS_MSG_DATA);
+	if (!self) {
+		return method(self, args, kwargs);  // not connected
+	}
 
-	PyObject **results = (PyObject **)req->priv;
-	if (!*results) {
-		// error has occured in some previous call -> exit
-		return;
+	// keep the connection alive even if it is disconnected within a callback
+	Py_INCREF(self);
+	connection_lock(self, true);
+	PyObject *res = method(self, args, kwargs);
+	connection_unlock(self);
+	Py_DECREF(self);
+
+	return res;
+}
+
+/* methods which use the ubus context are serialized by the connection lock */
+#define LOCKED_METHOD(name) \
+	static PyObject *ubus_Connection_##name##_locked(ubus_Connection *self, PyObject *args, PyObject *kwargs) \
+	{ \
+		return call_locked(ubus_Connection_##name, self, args, kwargs); \
 	}
 
-	if (!msg) {
-		PyErr_Format(PyExc_RuntimeError, "No data in call hander");
-		goto call_handler_cleanup;
+LOCKED_METHOD(disconnect)
+LOCKED_METHOD(send)
+LOCKED_METHOD(send_many)
+LOCKED_METHOD(listen)
+LOCKED_METHOD(unlisten)
+LOCKED_METHOD(add)
+LOCKED_METHOD(add_many)
+LOCKED_METHOD(remove)
+LOCKED_METHOD(objects)
+LOCKED_METHOD(notify)
+LOCKED_METHOD(subscribe)
+LOCKED_METHOD(unsubscribe)
+LOCKED_METHOD(call)
+LOCKED_METHOD(call_many)
+LOCKED_METHOD(call_async)
+LOCKED_METHOD(call_iter)
+LOCKED_METHOD(send_async)
+LOCKED_METHOD(enable_stats)
+LOCKED_METHOD(stats)
+LOCKED_METHOD(publish_stats)
+
+static void ubus_Connection_dealloc(ubus_Connection *self)
+{
+	PyObject_GC_UnTrack(self);
+	if (self->lock) {
+		connection_lock(self, true);
+		dispose_connection(self, true);
+		connection_unlock(self);
+		PyThread_free_lock(self->lock);
 	}
+	Py_TYPE(self)->tp_free((PyObject*)self);
+}
 
-	// convert message do python json object
-	char *str = blobmsg_format_json(msg, true);
-	if (!str) {
-		PyErr_Format(PyExc_RuntimeError, MSG_JSON_FROM_UBUS_FAILED);
-		goto call_handler_cleanup;
+static int ubus_Connection_traverse(ubus_Connection *self, visitproc visit, void *arg)
+{
+	for (int i = 0; i < self->objects_size; i++) {
+		ubus_Object *object = self->objects[i];
+		Py_VISIT(object->name);
+		Py_VISIT(object->methods);
+		for (int j = 0; object->dispatch && j < object->object.n_methods; j++) {
+			Py_VISIT(object->dispatch[j].callable);
+			Py_VISIT(object->dispatch[j].names);
+		}
 	}
-	PyObject *data = PyUnicode_FromString(str);
-	free(str);
-	if (!data) {
-		goto call_handler_cleanup;
+	Py_VISIT(self->object_ids);
+	Py_VISIT(self->catalogue);
+	Py_VISIT(self->call_stats);
+	// pending requests are kept alive by the connection until they are completed
+	ubus_Request *request;
+	list_for_each_entry(request, &self->pending_requests, list) {
+		Py_VISIT((PyObject *)request);
 	}
-	PyObject *data_object = perform_json_function(LOADS, data);
-	Py_DECREF(data);
-	if (!data_object) {
-		goto call_handler_cleanup;
+	ubus_Listener *listener;
+	list_for_each_entry(listener, &self->listeners, list) {
+		Py_VISIT(listener->event);
+		Py_VISIT(listener->callback);
+		Py_VISIT(listener->filter_refs);
 	}
-
-	// append to results
-	int failed = PyList_Append(*results, data_object);
-	Py_DECREF(data_object);
-	if (failed) {
-		goto call_handler_cleanup;
+	ubus_Subscriber *subscriber;
+	list_for_each_entry(subscriber, &self->subscribers, list) {
+		Py_VISIT(subscriber->callback);
 	}
+	return 0;
+}
 
-	return;
-
-	call_handler_cleanup:
-
-	// clear the result
-	Py_DECREF(*results);
-	results = NULL;
+static int ubus_Connection_clear(ubus_Connection *self)
+{
+	// callbacks can't be released while they are registered on ubus
+	connection_lock(self, true);
+	if (self->ctx) {
+		// the callbacks of unreachable requests may have been cleared already
+		abort_requests(self, false);
+	}
+	dispose_connection(self, true);
+	connection_unlock(self);
+	return 0;
 }
 
 PyDoc_STRVAR(
-	connect_call_doc,
-	"call(object, method, arguments, timeout=0)\n"
-	"\n"
-	"Calls object's method on ubus.\n"
+	Connection_doc,
+	"Connection(socket_path='" DEFAULT_SOCKET "')\n"
 	"\n"
-	":param object: name of the object\n"
-	":type object: str\n"
-	":param method: name of the method\n"
-	":type method: str\n"
-	":param arguments: arguments of the method (should be JSON serialisable).\n"
-	":type argument: dict\n"
-	":param timeout: timeout in ms (0 = wait forever)\n"
-	":type timeout: int\n"
+	"Independent connection to ubus with its own objects and listeners.\n"
+	"It provides the same methods as the module which uses the connection\n"
+	"established by connect().\n"
 );
 
-static PyObject *ubus_python_call(PyObject *module, PyObject *args, PyObject *kwargs)
+static PyMethodDef ubus_Connection_methods[] = {
+	{"disconnect", (PyCFunction)ubus_Connection_disconnect_locked, METH_VARARGS|METH_KEYWORDS, disconnect_doc},
+	{"get_connected", (PyCFunction)ubus_Connection_get_connected, METH_NOARGS, get_connected_doc},
+	{"get_socket_path", (PyCFunction)ubus_Connection_get_socket_path, METH_NOARGS, get_socket_path_doc},
+	{"get_fd", (PyCFunction)ubus_Connection_get_fd, METH_NOARGS, get_fd_doc},
+	{"process_events", (PyCFunction)ubus_Connection_process_events, METH_NOARGS, process_events_doc},
+	{"send", (PyCFunction)ubus_Connection_send_locked, METH_VARARGS|METH_KEYWORDS, connect_send_doc},
+	{"send_many", (PyCFunction)ubus_Connection_send_many_locked, METH_VARARGS|METH_KEYWORDS, connect_send_many_doc},
+	{"listen", (PyCFunction)ubus_Connection_listen_locked, METH_VARARGS|METH_KEYWORDS, connect_listen_doc},
+	{"unlisten", (PyCFunction)ubus_Connection_unlisten_locked, METH_VARARGS|METH_KEYWORDS, connect_unlisten_doc},
+	{"loop", (PyCFunction)ubus_Connection_loop, METH_VARARGS|METH_KEYWORDS, connect_loop_doc},
+	{"poll", (PyCFunction)ubus_Connection_poll, METH_VARARGS|METH_KEYWORDS, connect_poll_doc},
+	{"stop", (PyCFunction)ubus_python_stop, METH_NOARGS, stop_doc},
+	{"add", (PyCFunction)ubus_Connection_add_locked, METH_VARARGS|METH_KEYWORDS, connect_add_doc},
+	{"add_many", (PyCFunction)ubus_Connection_add_many_locked, METH_VARARGS|METH_KEYWORDS, connect_add_many_doc},
+	{"remove", (PyCFunction)ubus_Connection_remove_locked, METH_VARARGS|METH_KEYWORDS, connect_remove_doc},
+	{"objects", (PyCFunction)ubus_Connection_objects_locked, METH_VARARGS|METH_KEYWORDS, connect_objects_doc},
+	{"notify", (PyCFunction)ubus_Connection_notify_locked, METH_VARARGS|METH_KEYWORDS, connect_notify_doc},
+	{"subscribe", (PyCFunction)ubus_Connection_subscribe_locked, METH_VARARGS|METH_KEYWORDS, connect_subscribe_doc},
+	{"unsubscribe", (PyCFunction)ubus_Connection_unsubscribe_locked, METH_VARARGS|METH_KEYWORDS, connect_unsubscribe_doc},
+	{"call", (PyCFunction)ubus_Connection_call_locked, METH_VARARGS|METH_KEYWORDS, connect_call_doc},
+	{"call_many", (PyCFunction)ubus_Connection_call_many_locked, METH_VARARGS|METH_KEYWORDS, connect_call_many_doc},
+	{"call_async", (PyCFunction)ubus_Connection_call_async_locked, METH_VARARGS|METH_KEYWORDS, connect_call_async_doc},
+	{"call_iter", (PyCFunction)ubus_Connection_call_iter_locked, METH_VARARGS|METH_KEYWORDS, connect_call_iter_doc},
+	{"send_async", (PyCFunction)ubus_Connection_send_async_locked, METH_VARARGS|METH_KEYWORDS, connect_send_async_doc},
+	{"enable_stats", (PyCFunction)ubus_Connection_enable_stats_locked, METH_VARARGS|METH_KEYWORDS, connect_enable_stats_doc},
+	{"stats", (PyCFunction)ubus_Connection_stats_locked, METH_VARARGS|METH_KEYWORDS, connect_stats_doc},
+	{"publish_stats", (PyCFunction)ubus_Connection_publish_stats_locked, METH_VARARGS|METH_KEYWORDS, connect_publish_stats_doc},
+	{NULL},
+};
+
+static int ubus_Connection_init(ubus_Connection *self, PyObject *args, PyObject *kwargs)
 {
-	if (!CONNECTED) {
-		PyErr_Format(PyExc_RuntimeError, MSG_NOT_CONNECTED);
-		return NULL;
+	if (CONNECTED(self)) {
+		PyErr_Format(PyExc_RuntimeError, MSG_ALREADY_CONNECTED);
+		return -1;
 	}
 
-	char *object = NULL, *method = NULL;
-	int timeout = 0;
-	PyObject *arguments = NULL;
-	static char *kwlist[] = {"object", "method", "arguments", "timeout", NULL};
-	if (!PyArg_ParseTupleAndKeywords(
-				args, kwargs, "ssO|i", kwlist, &object, &method, &arguments, &timeout)){
-		return NULL;
-	}
-	if (timeout < 0) {
-		PyErr_Format(PyExc_TypeError, "timeout can't be lower than 0");
-		return NULL;
+	char *socket_path = NULL;
+	static char *kwlist[] = {"socket_path", NULL};
+	if (!PyArg_ParseTupleAndKeywords(args, kwargs, "|s", kwlist, &socket_path)){
+		return -1;
 	}
 
-	uint32_t id = 0;
-	int retval = ubus_lookup_id(ctx, object, &id);
-	if (retval != UBUS_STATUS_OK) {
-		PyErr_Format(PyExc_RuntimeError, "Object '%s' was not found.", object);
+	return connect_connection(self, socket_path) ? 0 : -1;
+}
+
+static PyObject *ubus_Connection_new(PyTypeObject *type, PyObject *args, PyObject *kwargs)
+{
+	ubus_Connection *self = (ubus_Connection *)type->tp_alloc(type, 0);
+	if (!self) {
 		return NULL;
 	}
-
-	// Call python function json.dumps
-	PyObject *json_arguments = perform_json_function(DUMPS, arguments);
-	if (!json_arguments) {
+	INIT_LIST_HEAD(&self->pending_requests);
+	INIT_LIST_HEAD(&self->deferred_handlers);
+	INIT_LIST_HEAD(&self->subscribers);
+	INIT_LIST_HEAD(&self->listeners);
+
+	self->lock = PyThread_allocate_lock();
+	if (!self->lock) {
+		Py_DECREF(self);
+		PyErr_Format(PyExc_MemoryError, MSG_ALLOCATION_FAILS);
 		return NULL;
 	}
 
-	// put data into buffer
-	blob_buf_init(&python_buf, 0);
-	bool res = blobmsg_add_json_from_string(&python_buf, PyUnicode_AsUTF8(json_arguments));
-	Py_DECREF(json_arguments);
-	if (!res) {
-		PyErr_Format(PyExc_TypeError, MSG_JSON_TO_UBUS_FAILED);
+	return (PyObject *)self;
+}
+
+static PyTypeObject ubus_ConnectionType = {
+	PyVarObject_HEAD_INIT(NULL, 0)
+	CONNECTION_OBJECT_NAME,						/* tp_name */
+	sizeof(ubus_Connection),					/* tp_basicsize */
+	0,											/* tp_itemsize */
+	(destructor)ubus_Connection_dealloc,		/* tp_dealloc */
+	0,											/* tp_print */
+	0,											/* tp_getattr */
+	0,											/* tp_setattr */
+	0,											/* tp_compare */
+	0,											/* tp_repr */
+	0,											/* tp_as_number */
+	0,											/* tp_as_sequence */
+	0,											/* tp_as_mapping */
+	0,											/* tp_hash */
+	0,											/* tp_call */
+	0,											/* tp_str */
+	0,											/* tp_getattro */
+	0,											/* tp_setattro */
+	0,											/* tp_as_buffer */
+	Py_TPFLAGS_DEFAULT | Py_TPFLAGS_BASETYPE | Py_TPFLAGS_HAVE_GC,	/* tp_flags */
+	Connection_doc,								/* tp_doc */
+	(traverseproc)ubus_Connection_traverse,		/* tp_traverse */
+	(inquiry)ubus_Connection_clear,				/* tp_clear */
+	0,											/* tp_richcompare */
+	0,											/* tp_weaklistoffset */
+	0,											/* tp_iter */
+	0,											/* tp_iternext */
+	ubus_Connection_methods,					/* tp_methods */
+	0,											/* tp_members */
+	0,											/* tp_getset */
+	0,											/* tp_base */
+	0,											/* tp_dict */
+	0,											/* tp_descr_get */
+	0,											/* tp_descr_set */
+	0,											/* tp_dictoffset */
+	(initproc)ubus_Connection_init,				/* tp_init */
+	0,											/* tp_alloc */
+	ubus_Connection_new,						/* tp_new */
+};
+
+/* module functions which use the default connection */
+
+static PyObject *call_default_connection(connection_method method, PyObject *args, PyObject *kwargs)
+{
+	// keep the connection alive even if it is disconnected within a callback
+	ubus_Connection *connection = default_connection;
+	Py_XINCREF(connection);
+	PyObject *res = method(connection, args, kwargs);
+	Py_XDECREF(connection);
+	return res;
+}
+
+static PyObject *ubus_python_connect(PyObject *module, PyObject *args, PyObject *kwargs)
+{
+	if (CONNECTED(default_connection)) {
+		PyErr_Format(PyExc_RuntimeError, MSG_ALREADY_CONNECTED);
 		return NULL;
 	}
 
-	PyObject *results = PyList_New(0);
-	if (!results) {
+	PyObject *connection = PyObject_Call((PyObject *)&ubus_ConnectionType, args, kwargs);
+	if (!connection) {
 		return NULL;
 	}
+	Py_XDECREF(default_connection);
+	default_connection = (ubus_Connection *)connection;
 
-	retval = ubus_invoke(
-			ctx, id, method, python_buf.head, ubus_python_call_handler, &results, timeout);
+	return prepare_bool(true);
+}
 
-	if (retval != UBUS_STATUS_OK) {
-		Py_XDECREF(results);
-		PyErr_Format(
-				PyExc_RuntimeError,
-				"ubus error occured: %s", ubus_strerror(retval)
-		);
-		return NULL;
+static PyObject *ubus_python_disconnect(PyObject *module, PyObject *args, PyObject *kwargs)
+{
+	PyObject *res = call_default_connection(ubus_Connection_disconnect_locked, args, kwargs);
+	if (res) {
+		Py_CLEAR(default_connection);
 	}
+	return res;
+}
 
-	// Note that results might be NULL indicating that something went wrong in the handler
-	return results;
+static PyObject *ubus_python_get_connected(PyObject *module, PyObject *args, PyObject *kwargs)
+{
+	return call_default_connection(ubus_Connection_get_connected, args, kwargs);
+}
+
+static PyObject *ubus_python_get_socket_path(PyObject *module, PyObject *args, PyObject *kwargs)
+{
+	return call_default_connection(ubus_Connection_get_socket_path, args, kwargs);
+}
+
+static PyObject *ubus_python_get_fd(PyObject *module, PyObject *args, PyObject *kwargs)
+{
+	return call_default_connection(ubus_Connection_get_fd, args, kwargs);
+}
+
+static PyObject *ubus_python_process_events(PyObject *module, PyObject *args, PyObject *kwargs)
+{
+	return call_default_connection(ubus_Connection_process_events, args, kwargs);
+}
+
+static PyObject *ubus_python_send(PyObject *module, PyObject *args, PyObject *kwargs)
+{
+	return call_default_connection(ubus_Connection_send_locked, args, kwargs);
+}
+
+static PyObject *ubus_python_send_many(PyObject *module, PyObject *args, PyObject *kwargs)
+{
+	return call_default_connection(ubus_Connection_send_many_locked, args, kwargs);
+}
+
+static PyObject *ubus_python_listen(PyObject *module, PyObject *args, PyObject *kwargs)
+{
+	return call_default_connection(ubus_Connection_listen_locked, args, kwargs);
+}
+
+static PyObject *ubus_python_unlisten(PyObject *module, PyObject *args, PyObject *kwargs)
+{
+	return call_default_connection(ubus_Connection_unlisten_locked, args, kwargs);
+}
+
+static PyObject *ubus_python_loop(PyObject *module, PyObject *args, PyObject *kwargs)
+{
+	return call_default_connection(ubus_Connection_loop, args, kwargs);
+}
+
+static PyObject *ubus_python_poll(PyObject *module, PyObject *args, PyObject *kwargs)
+{
+	return call_default_connection(ubus_Connection_poll, args, kwargs);
+}
+
+static PyObject *ubus_python_add(PyObject *module, PyObject *args, PyObject *kwargs)
+{
+	return call_default_connection(ubus_Connection_add_locked, args, kwargs);
+}
+
+static PyObject *ubus_python_add_many(PyObject *module, PyObject *args, PyObject *kwargs)
+{
+	return call_default_connection(ubus_Connection_add_many_locked, args, kwargs);
+}
+
+static PyObject *ubus_python_remove(PyObject *module, PyObject *args, PyObject *kwargs)
+{
+	return call_default_connection(ubus_Connection_remove_locked, args, kwargs);
+}
+
+static PyObject *ubus_python_objects(PyObject *module, PyObject *args, PyObject *kwargs)
+{
+	return call_default_connection(ubus_Connection_objects_locked, args, kwargs);
+}
+
+static PyObject *ubus_python_notify(PyObject *module, PyObject *args, PyObject *kwargs)
+{
+	return call_default_connection(ubus_Connection_notify_locked, args, kwargs);
+}
+
+static PyObject *ubus_python_subscribe(PyObject *module, PyObject *args, PyObject *kwargs)
+{
+	return call_default_connection(ubus_Connection_subscribe_locked, args, kwargs);
+}
+
+static PyObject *ubus_python_unsubscribe(PyObject *module, PyObject *args, PyObject *kwargs)
+{
+	return call_default_connection(ubus_Connection_unsubscribe_locked, args, kwargs);
+}
+
+static PyObject *ubus_python_call(PyObject *module, PyObject *args, PyObject *kwargs)
+{
+	return call_default_connection(ubus_Connection_call_locked, args, kwargs);
+}
+
+static PyObject *ubus_python_call_many(PyObject *module, PyObject *args, PyObject *kwargs)
+{
+	return call_default_connection(ubus_Connection_call_many_locked, args, kwargs);
+}
+
+static PyObject *ubus_python_call_async(PyObject *module, PyObject *args, PyObject *kwargs)
+{
+	return call_default_connection(ubus_Connection_call_async_locked, args, kwargs);
+}
+
+static PyObject *ubus_python_call_iter(PyObject *module, PyObject *args, PyObject *kwargs)
+{
+	return call_default_connection(ubus_Connection_call_iter_locked, args, kwargs);
+}
+
+static PyObject *ubus_python_send_async(PyObject *module, PyObject *args, PyObject *kwargs)
+{
+	return call_default_connection(ubus_Connection_send_async_locked, args, kwargs);
+}
+
+static PyObject *ubus_python_enable_stats(PyObject *module, PyObject *args, PyObject *kwargs)
+{
+	return call_default_connection(ubus_Connection_enable_stats_locked, args, kwargs);
+}
+
+static PyObject *ubus_python_stats(PyObject *module, PyObject *args, PyObject *kwargs)
+{
+	return call_default_connection(ubus_Connection_stats_locked, args, kwargs);
+}
+
+static PyObject *ubus_python_publish_stats(PyObject *module, PyObject *args, PyObject *kwargs)
+{
+	return call_default_connection(ubus_Connection_publish_stats_locked, args, kwargs);
 }
 
 static PyMethodDef ubus_methods[] = {
@@ -1338,12 +6598,36 @@ static PyMethodDef ubus_methods[] = {
 	{"connect", (PyCFunction)ubus_python_connect, METH_VARARGS|METH_KEYWORDS, connect_doc},
 	{"get_connected", (PyCFunction)ubus_python_get_connected, METH_NOARGS, get_connected_doc},
 	{"get_socket_path", (PyCFunction)ubus_python_get_socket_path, METH_NOARGS, get_socket_path_doc},
+	{"get_fd", (PyCFunction)ubus_python_get_fd, METH_NOARGS, get_fd_doc},
+	{"process_events", (PyCFunction)ubus_python_process_events, METH_NOARGS, process_events_doc},
+	{"set_native_codec", (PyCFunction)ubus_python_set_native_codec, METH_VARARGS|METH_KEYWORDS, set_native_codec_doc},
+	{"get_native_codec", (PyCFunction)ubus_python_get_native_codec, METH_NOARGS, get_native_codec_doc},
+	{"set_codec", (PyCFunction)ubus_python_set_codec, METH_VARARGS|METH_KEYWORDS, set_codec_doc},
+	{"get_codec", (PyCFunction)ubus_python_get_codec, METH_NOARGS, get_codec_doc},
+	{"encode", (PyCFunction)ubus_python_encode, METH_VARARGS|METH_KEYWORDS, encode_doc},
+	{"decode", (PyCFunction)ubus_python_decode, METH_VARARGS|METH_KEYWORDS, decode_doc},
 	{"send", (PyCFunction)ubus_python_send, METH_VARARGS|METH_KEYWORDS, connect_send_doc},
-	{"listen", (PyCFunction)ubus_python_listen, METH_VARARGS, connect_listen_doc},
+	{"send_many", (PyCFunction)ubus_python_send_many, METH_VARARGS|METH_KEYWORDS, connect_send_many_doc},
+	{"listen", (PyCFunction)ubus_python_listen, METH_VARARGS|METH_KEYWORDS, connect_listen_doc},
+	{"unlisten", (PyCFunction)ubus_python_unlisten, METH_VARARGS|METH_KEYWORDS, connect_unlisten_doc},
 	{"loop", (PyCFunction)ubus_python_loop, METH_VARARGS|METH_KEYWORDS, connect_loop_doc},
+	{"poll", (PyCFunction)ubus_python_poll, METH_VARARGS|METH_KEYWORDS, connect_poll_doc},
+	{"stop", (PyCFunction)ubus_python_stop, METH_NOARGS, stop_doc},
 	{"add", (PyCFunction)ubus_python_add, METH_VARARGS|METH_KEYWORDS, connect_add_doc},
+	{"add_many", (PyCFunction)ubus_python_add_many, METH_VARARGS|METH_KEYWORDS, connect_add_many_doc},
+	{"remove", (PyCFunction)ubus_python_remove, METH_VARARGS|METH_KEYWORDS, connect_remove_doc},
 	{"objects", (PyCFunction)ubus_python_objects, METH_VARARGS|METH_KEYWORDS, connect_objects_doc},
+	{"notify", (PyCFunction)ubus_python_notify, METH_VARARGS|METH_KEYWORDS, connect_notify_doc},
+	{"subscribe", (PyCFunction)ubus_python_subscribe, METH_VARARGS|METH_KEYWORDS, connect_subscribe_doc},
+	{"unsubscribe", (PyCFunction)ubus_python_unsubscribe, METH_VARARGS|METH_KEYWORDS, connect_unsubscribe_doc},
 	{"call", (PyCFunction)ubus_python_call, METH_VARARGS|METH_KEYWORDS, connect_call_doc},
+	{"call_many", (PyCFunction)ubus_python_call_many, METH_VARARGS|METH_KEYWORDS, connect_call_many_doc},
+	{"call_async", (PyCFunction)ubus_python_call_async, METH_VARARGS|METH_KEYWORDS, connect_call_async_doc},
+	{"call_iter", (PyCFunction)ubus_python_call_iter, METH_VARARGS|METH_KEYWORDS, connect_call_iter_doc},
+	{"send_async", (PyCFunction)ubus_python_send_async, METH_VARARGS|METH_KEYWORDS, connect_send_async_doc},
+	{"enable_stats", (PyCFunction)ubus_python_enable_stats, METH_VARARGS|METH_KEYWORDS, connect_enable_stats_doc},
+	{"stats", (PyCFunction)ubus_python_stats, METH_VARARGS|METH_KEYWORDS, connect_stats_doc},
+	{"publish_stats", (PyCFunction)ubus_python_publish_stats, METH_VARARGS|METH_KEYWORDS, connect_publish_stats_doc},
 	{NULL}
 };
 
@@ -1359,10 +6643,33 @@ void initubus(void)
 		goto init_ubus_exit_fail;
 	}
 
+	if (PyType_Ready(&ubus_RequestType)) {
+		goto init_ubus_exit_fail;
+	}
+
+	if (PyType_Ready(&ubus_ConnectionType)) {
+		goto init_ubus_exit_fail;
+	}
+
+	if (PyType_Ready(&ubus_MessageViewType)) {
+		goto init_ubus_exit_fail;
+	}
+
+	if (PyType_Ready(&ubus_RawMessageType)) {
+		goto init_ubus_exit_fail;
+	}
+
 	json_module = PyImport_ImportModule("json");
 	if (!json_module) {
 		goto init_ubus_exit_fail;
 	}
+	send_error = PyErr_NewException("ubus.SendError", PyExc_RuntimeError, NULL);
+	if (!send_error) {
+		goto init_ubus_exit_fail;
+	}
+	if (!set_json_functions(NULL, NULL)) {
+		goto init_ubus_exit_fail;
+	}
 
 	PyObject *module = ubus_python_module_init();
 	if (!module) {
@@ -1378,6 +6685,16 @@ void initubus(void)
 
 	Py_INCREF(&ubus_ResponseHandlerType);
 	PyModule_AddObject(module, "__ResponseHandler", (PyObject *)&ubus_ResponseHandlerType);
+	Py_INCREF(&ubus_RequestType);
+	PyModule_AddObject(module, "__Request", (PyObject *)&ubus_RequestType);
+	Py_INCREF(&ubus_ConnectionType);
+	PyModule_AddObject(module, "Connection", (PyObject *)&ubus_ConnectionType);
+	Py_INCREF(&ubus_MessageViewType);
+	PyModule_AddObject(module, "MessageView", (PyObject *)&ubus_MessageViewType);
+	Py_INCREF(&ubus_RawMessageType);
+	PyModule_AddObject(module, "RawMessage", (PyObject *)&ubus_RawMessageType);
+	Py_INCREF(send_error);
+	PyModule_AddObject(module, "SendError", send_error);
 
 	/* export ubus json types */
 	PyModule_AddIntMacro(module, BLOBMSG_TYPE_UNSPEC);
@@ -1391,6 +6708,19 @@ void initubus(void)
 	PyModule_AddIntMacro(module, BLOBMSG_TYPE_DOUBLE);
 	PyModule_AddIntMacro(module, BLOBMSG_TYPE_BOOL);
 
+	/* export ubus statuses */
+	PyModule_AddIntMacro(module, UBUS_STATUS_OK);
+	PyModule_AddIntMacro(module, UBUS_STATUS_INVALID_COMMAND);
+	PyModule_AddIntMacro(module, UBUS_STATUS_INVALID_ARGUMENT);
+	PyModule_AddIntMacro(module, UBUS_STATUS_METHOD_NOT_FOUND);
+	PyModule_AddIntMacro(module, UBUS_STATUS_NOT_FOUND);
+	PyModule_AddIntMacro(module, UBUS_STATUS_NO_DATA);
+	PyModule_AddIntMacro(module, UBUS_STATUS_PERMISSION_DENIED);
+	PyModule_AddIntMacro(module, UBUS_STATUS_TIMEOUT);
+	PyModule_AddIntMacro(module, UBUS_STATUS_NOT_SUPPORTED);
+	PyModule_AddIntMacro(module, UBUS_STATUS_UNKNOWN_ERROR);
+	PyModule_AddIntMacro(module, UBUS_STATUS_CONNECTION_FAILED);
+
 #if PY_MAJOR_VERSION >= 3
 	return module;
 #endif